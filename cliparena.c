@@ -0,0 +1,195 @@
+/*****************************************************************************
+ * cliparena.c                                                               *
+ *                                                                           *
+ * Scratch memory arenas for CLIPUNI.  The temporary buffers needed by a     *
+ * clipboard operation are carved out of an arena, and all released at once  *
+ * when the operation ends; the memory itself is kept for the next one.      *
+ * When an arena has had to grow by more than one block, the blocks are      *
+ * merged when it is reset, so that once it has reached the size needed, it  *
+ * makes no more heap allocations at all.  An arena that has not been used   *
+ * for a while can be shrunk back to a single small block (ArenaShrink).     *
+ *                                                                           *
+ * An arena must only be used by one thread.  Initialize it to all zeroes.   *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#include <os2.h>
+#include <stdlib.h>
+#include "cliparena.h"
+
+
+// FUNCTION DECLARATIONS
+//
+PARENA_BLOCK NewArenaBlock( PARENA pArena, ULONG cbSize );
+
+
+/* ------------------------------------------------------------------------- *
+ * ArenaAlloc                                                                *
+ *                                                                           *
+ * Allocates memory from an arena, adding a block to it if there is not      *
+ * enough room.  The memory stays allocated until the arena is reset.        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PARENA pArena: The arena.                                               *
+ *   ULONG cb     : Number of bytes needed.                                  *
+ *                                                                           *
+ * RETURNS: PVOID                                                            *
+ *   The memory, or NULL if there is not enough.                             *
+ * ------------------------------------------------------------------------- */
+PVOID ArenaAlloc( PARENA pArena, ULONG cb )
+{
+    PARENA_BLOCK pBlock;                // block to allocate from
+    PVOID        pv;                    // the memory allocated
+    ULONG        cbInUse;               // bytes now allocated from the arena
+
+
+    cb = ( cb + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 );
+
+    // Use the first block (from the current one on) with enough room
+    for ( pBlock = pArena->pCurrent; pBlock; pBlock = pBlock->pNext ) {
+        if ( pBlock->cbSize - pBlock->cbUsed >= cb ) break;
+    }
+    if ( ! pBlock ) {
+        if (( pBlock = NewArenaBlock( pArena, max( cb, max( ARENA_MIN_BLOCK, pArena->cbHeld )))) == NULL )
+            return ( NULL );
+    }
+
+    pv = (PVOID)( (PCHAR)( pBlock + 1 ) + pBlock->cbUsed );
+    pBlock->cbUsed += cb;
+    pArena->pCurrent = pBlock;
+    pArena->ulAllocs++;
+
+    for ( cbInUse = 0, pBlock = pArena->pFirst; pBlock; pBlock = pBlock->pNext )
+        cbInUse += pBlock->cbUsed;
+    pArena->cbPeak = max( pArena->cbPeak, cbInUse );
+    return ( pv );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ArenaBegin                                                                *
+ *                                                                           *
+ * Marks the start of an operation which allocates from the arena.           *
+ * Operations may be nested (for example, a format rendered while we are     *
+ * pasting from our own copied text); the arena is only reset when the       *
+ * outermost one ends.                                                       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PARENA pArena: The arena.                                               *
+ * ------------------------------------------------------------------------- */
+void ArenaBegin( PARENA pArena )
+{
+    pArena->ulDepth++;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ArenaEnd                                                                  *
+ *                                                                           *
+ * Marks the end of an operation (see ArenaBegin).  When no operation is     *
+ * left in progress, everything allocated from the arena is released.        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PARENA pArena: The arena.                                               *
+ * ------------------------------------------------------------------------- */
+void ArenaEnd( PARENA pArena )
+{
+    if ( pArena->ulDepth && ( --(pArena->ulDepth) == 0 )) ArenaReset( pArena );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ArenaReset                                                                *
+ *                                                                           *
+ * Releases everything allocated from an arena.  If it has more than one     *
+ * block, they are replaced with a single block as big as all of them.       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PARENA pArena: The arena.                                               *
+ * ------------------------------------------------------------------------- */
+void ArenaReset( PARENA pArena )
+{
+    PARENA_BLOCK pBlock;
+    ULONG        cbTotal;
+
+    pArena->ulResets++;
+    if ( pArena->pFirst && pArena->pFirst->pNext ) {
+        cbTotal = pArena->cbHeld;
+        ArenaFree( pArena );
+        NewArenaBlock( pArena, cbTotal );
+    }
+    for ( pBlock = pArena->pFirst; pBlock; pBlock = pBlock->pNext ) pBlock->cbUsed = 0;
+    pArena->pCurrent = pArena->pFirst;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ArenaShrink                                                               *
+ *                                                                           *
+ * Gives an idle arena's memory back to the heap, apart from one block of    *
+ * ARENA_MIN_BLOCK bytes.  Nothing happens while an operation is in          *
+ * progress.                                                                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PARENA pArena: The arena.                                               *
+ * ------------------------------------------------------------------------- */
+void ArenaShrink( PARENA pArena )
+{
+    if ( pArena->ulDepth || ( pArena->cbHeld <= ARENA_MIN_BLOCK )) return;
+
+    ArenaFree( pArena );
+    NewArenaBlock( pArena, ARENA_MIN_BLOCK );
+    pArena->pCurrent = pArena->pFirst;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ArenaFree                                                                 *
+ *                                                                           *
+ * Frees all of an arena's memory.  (The counters are kept.)                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PARENA pArena: The arena.                                               *
+ * ------------------------------------------------------------------------- */
+void ArenaFree( PARENA pArena )
+{
+    PARENA_BLOCK pBlock;
+
+    while (( pBlock = pArena->pFirst ) != NULL ) {
+        pArena->pFirst = pBlock->pNext;
+        free( pBlock );
+    }
+    pArena->pCurrent = NULL;
+    pArena->cbHeld   = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * NewArenaBlock                                                             *
+ *                                                                           *
+ * Allocates a new block and adds it to the end of an arena.                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PARENA pArena: The arena.                                               *
+ *   ULONG cbSize : Usable size of the block.                                *
+ *                                                                           *
+ * RETURNS: PARENA_BLOCK                                                     *
+ *   The new block, or NULL if there is not enough memory.                   *
+ * ------------------------------------------------------------------------- */
+PARENA_BLOCK NewArenaBlock( PARENA pArena, ULONG cbSize )
+{
+    PARENA_BLOCK pBlock,
+                 *ppLast;
+
+    if (( pBlock = (PARENA_BLOCK) malloc( sizeof(ARENA_BLOCK) + cbSize )) == NULL ) return ( NULL );
+    pBlock->pNext  = NULL;
+    pBlock->cbSize = cbSize;
+    pBlock->cbUsed = 0;
+
+    for ( ppLast = &(pArena->pFirst); *ppLast; ppLast = &((*ppLast)->pNext) ) ;
+    *ppLast = pBlock;
+    pArena->cbHeld += cbSize;
+    pArena->ulHeapAllocs++;
+    return ( pBlock );
+}
@@ -0,0 +1,50 @@
+/*****************************************************************************
+ * cliparena.h                                                               *
+ *                                                                           *
+ * Declarations for the scratch memory arenas (cliparena.c).  os2.h must be  *
+ * included before this file.                                                *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPARENA_H
+#define CLIPARENA_H
+
+
+// CONSTANTS
+//
+#define ARENA_MIN_BLOCK 65536   // minimum size of an arena block (and size kept when idle)
+#define ARENA_ALIGN     4       // alignment of every allocation
+
+
+// TYPES
+//
+typedef struct _ARENA_BLOCK {
+    struct _ARENA_BLOCK *pNext;             // next block in the arena
+    ULONG       cbSize;                     // usable size of the block
+    ULONG       cbUsed;                     // bytes allocated from it
+} ARENA_BLOCK, *PARENA_BLOCK;
+
+typedef struct _ARENA {
+    PARENA_BLOCK pFirst;                    // first block (NULL = none)
+    PARENA_BLOCK pCurrent;                  // block being allocated from
+    ULONG       ulDepth;                    // operations in progress (see ArenaBegin)
+    ULONG       cbHeld;                     // total size of all blocks
+    ULONG       cbPeak;                     // most ever allocated between resets
+    ULONG       ulAllocs;                   // allocations made from the arena
+    ULONG       ulHeapAllocs;               // blocks allocated from the heap
+    ULONG       ulResets;                   // number of times reset
+} ARENA, *PARENA;
+
+
+// FUNCTION DECLARATIONS
+//
+PVOID ArenaAlloc( PARENA pArena, ULONG cb );
+void  ArenaBegin( PARENA pArena );
+void  ArenaEnd( PARENA pArena );
+void  ArenaReset( PARENA pArena );
+void  ArenaShrink( PARENA pArena );
+void  ArenaFree( PARENA pArena );
+
+
+#endif
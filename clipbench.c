@@ -0,0 +1,756 @@
+/*****************************************************************************
+ * clipbench.c                                                               *
+ *                                                                           *
+ * Benchmarks for the portable parts of CLIPUNI.  Synthetic text of each     *
+ * size asked for is put through the conversion routines (table, UTF-8 and   *
+ * conversion object paths, and the parallel conversion with 1, 2, 4 and 8   *
+ * threads), the hash used by the paste cache, the scratch arenas, the       *
+ * clipboard history and the conversion worker (clipjob.c), and the          *
+ * throughput of each is reported.  The time taken to capture copied text in *
+ * the history (which the program does after the copy, not as part of it)    *
+ * is also shown against the time taken by the copy itself.                  *
+ *                                                                           *
+ * Usage: clipbench [ size[K|M] ... ]   (default 4K 256K 4M)                 *
+ *                                                                           *
+ * Each measurement is repeated until it has run for at least BENCH_USEC,    *
+ * and the average is reported: MB/s of input, nanoseconds per character,    *
+ * and (where anything is allocated) allocations and peak memory per run.    *
+ *                                                                           *
+ * The worker posts its pieces with WinPostMsg(), which is supplied here as  *
+ * a simple queue read by the benchmark's own thread; each piece is copied   *
+ * out (standing in for the MLE import) and released.  Besides throughput,   *
+ * the delay before the first piece and the longest wait between pieces are  *
+ * reported, as these are what a user sees while a large paste goes on.      *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#define INCL_DOSMISC
+#define INCL_DOSPROFILE
+#define INCL_DOSSEMAPHORES
+#define INCL_WINMESSAGEMGR
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uconv.h>
+#include "cliparena.h"
+#include "clipconv.h"
+#include "clipfmt.h"
+#include "cliphist.h"
+#include "clipjob.h"
+#include "clipmem.h"
+#include "clippar.h"
+
+
+// CONSTANTS
+//
+#define BENCH_USEC      200000  // minimum time to spend on each measurement
+#define DEFAULT_SIZES   "4K 256K 4M"
+#define BENCH_LINE      72      // characters per line of benchmark text
+#define ARENA_ALLOCS    64      // allocations per arena run
+#define QUEUE_SIZE      16      // messages the stand-in message queue holds
+#define BENCH_HWND      1       // window the worker posts to (any non-zero value)
+
+
+// TYPES
+//
+typedef struct _BENCH {
+    PSZ         pszName;                    // what is being measured
+    void        (*pfnRun)( struct _BENCH *pBench );     // does it once
+    PVOID       pvIn;                       // input
+    ULONG       cbIn;                       // size of the input in bytes
+    ULONG       ulChars;                    // characters in the input
+    PVOID       pvOut;                      // output buffer
+    ULONG       cbOut;                      // its size in bytes
+    ULONG       ulCP;                       // codepage involved
+    PSBCS_TABLE pTable;                     // its conversion tables (if SBCS)
+    ULONG       ulResult;                   // result of the last run
+    ULONG       ulAllocs;                   // allocations made by all runs
+    ULONG       cbPeak;                     // most memory held by any run
+    ULONG       ulThreads;                  // threads to use (parallel conversion)
+    BOOL        fToUcs;                     // convert to UCS-2 (parallel conversion)
+    double      dUsec;                      // average time of one run
+} BENCH, *PBENCH;
+
+typedef struct _BENCH_MSG {
+    ULONG       msg;                        // message posted by the worker
+    MPARAM      mp1, mp2;                   // its parameters
+} BENCH_MSG, *PBENCH_MSG;
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG  ParseSize( PSZ pszSize );
+double QueryUsec( PQWORD pqwStart );
+void   RunBench( PBENCH pBench );
+PSZ    MakeSbcsText( ULONG cb, ULONG ulHighEvery, UCHAR chHigh );
+PSZ    MakeDbcsText( ULONG cb );
+UniChar *MakeUcsText( ULONG ulChars, ULONG ulEvery, UniChar suOther, BOOL fPairs );
+void   BenchSize( ULONG cb );
+void   RunSbcsToUcs( PBENCH pBench );
+void   RunSbcsFromUcs( PBENCH pBench );
+void   RunUtf8ToUcs( PBENCH pBench );
+void   RunUcsToUtf8( PBENCH pBench );
+void   RunUconvToUcs( PBENCH pBench );
+void   RunHash( PBENCH pBench );
+void   RunCopy( PBENCH pBench );
+void   RunCollapse( PBENCH pBench );
+void   RunArena( PBENCH pBench );
+void   RunMalloc( PBENCH pBench );
+void   RunHistoryNew( PBENCH pBench );
+void   RunHistorySame( PBENCH pBench );
+void   RunCopyRender( PBENCH pBench );
+void   RunParallel( PBENCH pBench );
+void   RunPaste( PBENCH pBench );
+void   GetBenchMsg( PBENCH_MSG pMsg );
+
+
+// GLOBAL VARIABLES
+//
+ULONG   ulBenchFreq = 0;                // timer frequency (ticks per second)
+ARENA   arBench;                        // arena being measured
+HISTORY hsBench;                        // history being measured
+ULONG   ulHistNext = 0;                 // next text to add to the history
+
+HMTX      hmtxQueue;                    // protects the stand-in message queue
+HEV       hevQueue;                     // posted when a message is queued
+BENCH_MSG abmQueue[ QUEUE_SIZE ];       // the queue itself
+ULONG     ulQueueFirst = 0,             // oldest message in the queue
+          ulQueued     = 0;             // number of messages in the queue
+BOOL      fBenchWorker = FALSE;         // the conversion worker is running
+double    dFirstUsec,                   // longest delay before a job's first piece
+          dGapUsec;                     // longest wait between pieces of a job
+
+
+/* ------------------------------------------------------------------------- *
+ * Main program.                                                             *
+ * ------------------------------------------------------------------------- */
+int main( int argc, char *argv[] )
+{
+    CHAR  szDefault[] = DEFAULT_SIZES;
+    PSZ   pszSize;
+    ULONG cb;
+    int   i;
+
+    DosTmrQueryFreq( &ulBenchFreq );
+    if ( ! DosCreateMutexSem( NULL, &hmtxQueue, 0, FALSE ) &&
+         ! DosCreateEventSem( NULL, &hevQueue, 0, FALSE ))
+        fBenchWorker = StartWorker();
+    printf("%-8s %-34s %10s %10s %8s %10s\n",
+           "size", "benchmark", "MB/s", "ns/char", "allocs", "peak KB");
+
+    if ( argc < 2 ) {
+        for ( pszSize = strtok( szDefault, " "); pszSize; pszSize = strtok( NULL, " "))
+            BenchSize( ParseSize( pszSize ));
+    }
+    for ( i = 1; i < argc; i++ ) {
+        if (( cb = ParseSize( argv[ i ] )) == 0 ) {
+            fprintf( stderr, "Usage: clipbench [ size[K|M] ... ]\n");
+            return ( 1 );
+        }
+        BenchSize( cb );
+    }
+
+    if ( fBenchWorker ) StopWorker();
+    HistoryFree( &hsBench );
+    ArenaFree( &arBench );
+    FreeSbcsTables();
+    FreeUconvCache();
+    return ( 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ParseSize                                                                 *
+ *                                                                           *
+ * Reads a size in bytes, with an optional K or M suffix (0 if invalid).     *
+ * ------------------------------------------------------------------------- */
+ULONG ParseSize( PSZ pszSize )
+{
+    PSZ   pszEnd;
+    ULONG cb = strtoul( pszSize, &pszEnd, 10 );
+
+    if (( *pszEnd == 'K' ) || ( *pszEnd == 'k' )) { cb *= 1024;    pszEnd++; }
+    if (( *pszEnd == 'M' ) || ( *pszEnd == 'm' )) { cb *= 1048576; pszEnd++; }
+    return ( *pszEnd ? 0 : cb );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * QueryUsec                                                                 *
+ *                                                                           *
+ * Returns the number of microseconds since a time from DosTmrQueryTime.     *
+ * ------------------------------------------------------------------------- */
+double QueryUsec( PQWORD pqwStart )
+{
+    QWORD  qwNow;
+    double dTicks;
+
+    DosTmrQueryTime( &qwNow );
+    dTicks = ((double) qwNow.ulHi - pqwStart->ulHi ) * 4294967296.0 +
+             ((double) qwNow.ulLo - pqwStart->ulLo );
+    return ( dTicks * 1000000.0 / ulBenchFreq );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RunBench                                                                  *
+ *                                                                           *
+ * Runs a benchmark repeatedly (doubling the count each time) until it has   *
+ * taken at least BENCH_USEC, then prints the average of the last batch.     *
+ * ------------------------------------------------------------------------- */
+void RunBench( PBENCH pBench )
+{
+    QWORD  qwStart;
+    double dUsec;
+    ULONG  ulRuns,
+           i;
+
+    pBench->pfnRun( pBench );           // (warm up caches and tables)
+    for ( ulRuns = 1; ; ulRuns *= 2 ) {
+        pBench->ulAllocs = 0;
+        pBench->cbPeak   = 0;
+        DosTmrQueryTime( &qwStart );
+        for ( i = 0; i < ulRuns; i++ ) pBench->pfnRun( pBench );
+        dUsec = QueryUsec( &qwStart );
+        if (( dUsec >= BENCH_USEC ) || ( ulRuns >= 0x40000000 )) break;
+    }
+    dUsec /= ulRuns;
+    pBench->dUsec = dUsec;
+
+    // (MB/s only means something if there is text being processed)
+    printf("%-8u %-34s", pBench->cbIn, pBench->pszName );
+    if ( pBench->pvIn ) printf(" %10.1f", ( dUsec > 0 ) ? pBench->cbIn / dUsec : 0.0 );
+    else                printf(" %10s", "-");
+    printf(" %10.2f", pBench->ulChars ? dUsec * 1000.0 / pBench->ulChars : 0.0 );
+    if ( pBench->ulAllocs || pBench->cbPeak )
+        printf(" %8.1f %10u", (double) pBench->ulAllocs / ulRuns, pBench->cbPeak / 1024 );
+    printf("\n");
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MakeSbcsText                                                              *
+ *                                                                           *
+ * Makes single-byte text: lines of printable ASCII, with every ulHighEvery  *
+ * character (if not 0) a byte of 0x80 or above, counting up from chHigh.    *
+ * ------------------------------------------------------------------------- */
+PSZ MakeSbcsText( ULONG cb, ULONG ulHighEvery, UCHAR chHigh )
+{
+    PSZ   pszText;
+    ULONG ulNext = 0x20,
+          ulHigh = chHigh,
+          i;
+
+    if (( pszText = (PSZ) malloc( cb + 1 )) == NULL ) return ( NULL );
+    for ( i = 0; i < cb; i++ ) {
+        if (( i % BENCH_LINE ) == BENCH_LINE - 1 ) pszText[ i ] = '\n';
+        else if ( ulHighEvery && (( i % ulHighEvery ) == ulHighEvery - 1 )) {
+            pszText[ i ] = (CHAR) ulHigh;
+            if ( ++ulHigh > 0xFF ) ulHigh = chHigh;
+        }
+        else {
+            pszText[ i ] = (CHAR) ulNext;
+            if ( ++ulNext > 0x7E ) ulNext = 0x20;
+        }
+    }
+    pszText[ cb ] = '\0';
+    return ( pszText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MakeDbcsText                                                              *
+ *                                                                           *
+ * Makes IBM-943 text, alternating ASCII and double-byte characters.         *
+ * ------------------------------------------------------------------------- */
+PSZ MakeDbcsText( ULONG cb )
+{
+    static UCHAR abDbcs[] = { 0x93, 0xFA, 0x96, 0x7B, 0x8C, 0xEA, 0x82, 0xA0, 0x83, 0x41 };
+    PSZ   pszText;
+    ULONG i,
+          n = 0;
+
+    if (( pszText = (PSZ) malloc( cb + 1 )) == NULL ) return ( NULL );
+    for ( i = 0; i < cb; ) {
+        if (( i % BENCH_LINE ) >= BENCH_LINE - 2 ) pszText[ i++ ] = '\n';
+        else if (( n++ & 1 ) && ( i + 2 <= cb )) {
+            memcpy( pszText + i, abDbcs + ( n % 5 ) * 2, 2 );
+            i += 2;
+        }
+        else pszText[ i++ ] = (CHAR)( 'a' + ( n % 26 ));
+    }
+    pszText[ cb ] = '\0';
+    return ( pszText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MakeUcsText                                                               *
+ *                                                                           *
+ * Makes UCS-2 text: lines of printable ASCII with every ulEvery character   *
+ * (if not 0) replaced by suOther, or by a surrogate pair if fPairs.         *
+ * ------------------------------------------------------------------------- */
+UniChar *MakeUcsText( ULONG ulChars, ULONG ulEvery, UniChar suOther, BOOL fPairs )
+{
+    UniChar *psuText;
+    ULONG   ulNext = 0x20,
+            i;
+
+    if (( psuText = (UniChar *) malloc(( ulChars + 1 ) * sizeof(UniChar) )) == NULL ) return ( NULL );
+    for ( i = 0; i < ulChars; i++ ) {
+        if (( i % BENCH_LINE ) == BENCH_LINE - 1 ) psuText[ i ] = '\n';
+        else if ( ulEvery && (( i % ulEvery ) == ulEvery - 1 )) {
+            if ( fPairs && ( i + 1 < ulChars )) {
+                psuText[ i++ ] = 0xD83D;
+                psuText[ i ]   = 0xDE00;
+            }
+            else psuText[ i ] = suOther;
+        }
+        else {
+            psuText[ i ] = (UniChar) ulNext;
+            if ( ++ulNext > 0x7E ) ulNext = 0x20;
+        }
+    }
+    psuText[ ulChars ] = 0;
+    return ( psuText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * BenchSize                                                                 *
+ *                                                                           *
+ * Runs every benchmark on text of the given size (in bytes of input).       *
+ * ------------------------------------------------------------------------- */
+void BenchSize( ULONG cb )
+{
+    BENCH   b;
+    CHAR    szName[ 40 ];
+    PSZ     pszAscii   = MakeSbcsText( cb, 0, 0 ),
+            pszLatin   = MakeSbcsText( cb, 4, 0xA0 ),
+            pszCp850   = MakeSbcsText( cb, 4, 0xD5 ),
+            pszDbcs    = MakeDbcsText( cb ),
+            pszUtf8    = NULL;
+    UniChar *psuAscii  = MakeUcsText( cb / 2, 0, 0, FALSE ),
+            *psuLatin  = MakeUcsText( cb / 2, 4, 0x00E9, FALSE ),
+            *psuCjk    = MakeUcsText( cb / 2, 2, 0x65E5, FALSE ),
+            *psuPairs  = MakeUcsText( cb / 2, 8, 0, TRUE ),
+            *psu;
+    PVOID   pvOut      = malloc( cb * 2 + 16 );
+    double  dCopyUsec;
+    ULONG   cbUtf8;
+
+    if ( !pszAscii || !pszLatin || !pszCp850 || !pszDbcs || !psuAscii || !psuLatin ||
+         !psuCjk || !psuPairs || !pvOut )
+    {
+        fprintf( stderr, "Not enough memory for %u-byte texts.\n", cb );
+        goto done;
+    }
+
+    // Table conversions, to and from UCS-2
+    memset( &b, 0, sizeof(b) );
+    b.pvOut = pvOut;
+    b.cbOut = cb * 2 + 16;
+
+    b.pfnRun = RunSbcsToUcs;
+    b.ulChars = b.cbIn = cb;
+    b.pTable = GetSbcsTable( 850, TRUE );
+    b.pszName = "SbcsToUcs 850 ascii";       b.pvIn = pszAscii; RunBench( &b );
+    b.pszName = "SbcsToUcs 850 25% high";    b.pvIn = pszCp850; RunBench( &b );
+    b.pTable = GetSbcsTable( 1252, TRUE );
+    b.pszName = "SbcsToUcs 1252 25% high";   b.pvIn = pszLatin; RunBench( &b );
+
+    b.pfnRun = RunSbcsFromUcs;
+    b.ulChars = cb / 2;
+    b.cbIn = b.ulChars * sizeof(UniChar);
+    b.pTable = GetSbcsTable( 850, TRUE );
+    b.pszName = "SbcsFromUcs 850 ascii";     b.pvIn = psuAscii; RunBench( &b );
+    b.pszName = "SbcsFromUcs 850 25% latin"; b.pvIn = psuLatin; RunBench( &b );
+    b.pszName = "SbcsFromUcs 850 50% unmapped"; b.pvIn = psuCjk; RunBench( &b );
+
+    // UTF-8
+    b.pfnRun = RunUcsToUtf8;
+    b.pszName = "UcsToUtf8 ascii";           b.pvIn = psuAscii; RunBench( &b );
+    b.pszName = "UcsToUtf8 50% CJK";         b.pvIn = psuCjk;   RunBench( &b );
+    b.pszName = "UcsToUtf8 with pairs";      b.pvIn = psuPairs; RunBench( &b );
+
+    b.pfnRun = RunUtf8ToUcs;
+    psu = psuCjk;
+    cbUtf8 = UcsToUtf8( &psu, NULL, 0 );
+    if (( pszUtf8 = (PSZ) malloc( cbUtf8 + 1 )) != NULL ) {
+        psu = psuCjk;
+        UcsToUtf8( &psu, pszUtf8, cbUtf8 + 1 );
+        b.pszName = "Utf8ToUcs 50% CJK";
+        b.pvIn    = pszUtf8;
+        b.cbIn    = cbUtf8;
+        b.ulChars = cb / 2;
+        RunBench( &b );
+    }
+    b.pszName = "Utf8ToUcs ascii";
+    b.pvIn    = pszAscii;
+    b.cbIn    = b.ulChars = cb;
+    RunBench( &b );
+
+    // Conversion objects (DBCS), for comparison
+    b.pfnRun  = RunUconvToUcs;
+    b.pszName = "ConvertToUcsBuf 943 (uconv)";
+    b.ulCP    = 943;
+    b.pvIn    = pszDbcs;
+    b.cbIn    = cb;
+    RunUconvToUcs( &b );
+    b.ulChars = UniStrlen( (UniChar *) pvOut );
+    RunBench( &b );
+
+    // Parallel conversion (only worth it once there is more than one segment)
+    if ( cb >= PAR_MIN_SEGMENT * 2 ) {
+        b.pfnRun = RunParallel;
+        b.pszName = szName;
+        b.pvIn    = pszLatin;
+        b.cbIn    = b.ulChars = cb;
+        b.ulCP    = 1252;
+        b.fToUcs  = TRUE;
+        for ( b.ulThreads = 1; b.ulThreads <= MAX_PAR_THREADS; b.ulThreads *= 2 ) {
+            sprintf( szName, "Parallel to UCS 1252, %u thread%s", b.ulThreads, ( b.ulThreads > 1 ) ? "s" : "");
+            RunBench( &b );
+        }
+        b.pvIn    = psuCjk;
+        b.ulChars = cb / 2;
+        b.cbIn    = b.ulChars * sizeof(UniChar);
+        b.ulCP    = CP_UTF8;
+        b.fToUcs  = FALSE;
+        for ( b.ulThreads = 1; b.ulThreads <= MAX_PAR_THREADS; b.ulThreads *= 2 ) {
+            sprintf( szName, "Parallel UTF-8 50%% CJK, %u thread%s", b.ulThreads, ( b.ulThreads > 1 ) ? "s" : "");
+            RunBench( &b );
+        }
+    }
+
+    // Hashing and surrogates
+    b.pfnRun = RunHash;
+    b.pszName = "HashText";
+    b.pvIn = pszLatin;
+    b.cbIn = b.ulChars = cb;
+    RunBench( &b );
+
+    b.ulChars = cb / 2;
+    b.cbIn    = b.ulChars * sizeof(UniChar);
+    b.pvIn    = psuPairs;
+    b.pfnRun  = RunCopy;
+    b.pszName = "memcpy (baseline)";         RunBench( &b );
+    b.pfnRun  = RunCollapse;
+    b.pszName = "CollapseSurrogates (+memcpy)"; RunBench( &b );
+
+    // Scratch memory
+    b.pvIn    = NULL;
+    b.cbIn    = cb;
+    b.ulChars = ARENA_ALLOCS + 1;
+    b.pfnRun  = RunArena;
+    b.pszName = "ArenaAlloc (per allocation)";   RunBench( &b );
+    b.pfnRun  = RunMalloc;
+    b.pszName = "malloc/free (per allocation)";  RunBench( &b );
+    ArenaFree( &arBench );
+
+    // History (text bigger than its budget is simply refused).  Capturing
+    // copied text is compared with the copy itself, taken as exporting the
+    // text, offering the formats and rendering text/unicode for whoever
+    // pastes it.
+    if ( cb <= HIST_BUDGET ) {
+        b.pvIn    = pszLatin;
+        b.cbIn    = b.ulChars = cb;
+        b.ulCP    = 1252;
+        b.pfnRun  = RunCopyRender;
+        b.pszName = "Export, copy, render Unicode 1252"; RunBench( &b );
+        dCopyUsec = b.dUsec;
+        b.pfnRun  = RunHistoryNew;
+        b.pszName = "HistoryAdd new text";          RunBench( &b );
+        printf("%-8u %-34s %10.2f us (after the copy; %.1f%% of it)\n", b.cbIn, "  capture (new text)",
+               b.dUsec, b.dUsec * 100.0 / dCopyUsec );
+        b.pfnRun  = RunHistorySame;
+        b.pszName = "HistoryAdd same text";         RunBench( &b );
+        printf("%-8u %-34s %10.2f us (after the copy; %.1f%% of it)\n", b.cbIn, "  capture (same text)",
+               b.dUsec, b.dUsec * 100.0 / dCopyUsec );
+        HistoryFree( &hsBench );
+    }
+
+    // The conversion worker, as used for a large paste (this is where the
+    // table conversion above ends up, so the two can be compared)
+    if ( fBenchWorker ) {
+        b.pvIn    = psuAscii;
+        b.ulChars = cb / 2;
+        b.cbIn    = b.ulChars * sizeof(UniChar);
+        b.ulCP    = 850;
+        b.pTable  = GetSbcsTable( 850, TRUE );
+        b.pfnRun  = RunPaste;
+        b.pszName = "Paste job 850 ascii (worker)";
+        dFirstUsec = dGapUsec = 0;
+        RunBench( &b );
+        printf("%-8u %-34s %10.0f us\n", b.cbIn, "  delay before the first piece", dFirstUsec );
+        printf("%-8u %-34s %10.0f us\n", b.cbIn, "  longest wait between pieces", dGapUsec );
+    }
+
+done:
+    free( pszAscii );
+    free( pszLatin );
+    free( pszCp850 );
+    free( pszDbcs );
+    free( pszUtf8 );
+    free( psuAscii );
+    free( psuLatin );
+    free( psuCjk );
+    free( psuPairs );
+    free( pvOut );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Benchmark functions (see BENCH).                                          *
+ * ------------------------------------------------------------------------- */
+void RunSbcsToUcs( PBENCH pBench )
+{
+    pBench->ulResult = SbcsToUcs( pBench->pTable, (PSZ) pBench->pvIn, (UniChar *) pBench->pvOut,
+                                  pBench->cbOut / sizeof(UniChar) );
+}
+
+void RunSbcsFromUcs( PBENCH pBench )
+{
+    UniChar *psu = (UniChar *) pBench->pvIn;
+
+    pBench->ulResult = SbcsFromUcs( pBench->pTable, &psu, (PCHAR) pBench->pvOut, pBench->cbOut );
+}
+
+void RunUtf8ToUcs( PBENCH pBench )
+{
+    pBench->ulResult = Utf8ToUcs( (PCHAR) pBench->pvIn, pBench->cbIn, (UniChar *) pBench->pvOut,
+                                  pBench->cbOut / sizeof(UniChar) );
+}
+
+void RunUcsToUtf8( PBENCH pBench )
+{
+    UniChar *psu = (UniChar *) pBench->pvIn;
+
+    pBench->ulResult = UcsToUtf8( &psu, (PCHAR) pBench->pvOut, pBench->cbOut );
+}
+
+void RunUconvToUcs( PBENCH pBench )
+{
+    PSZ pszFailed;
+
+    pBench->ulResult = ConvertToUcsBuf( pBench->ulCP, (PSZ) pBench->pvIn, (UniChar *) pBench->pvOut,
+                                        pBench->cbOut / sizeof(UniChar), &pszFailed );
+}
+
+void RunHash( PBENCH pBench )
+{
+    pBench->ulResult = HashText( pBench->pvIn, pBench->cbIn );
+}
+
+void RunCopy( PBENCH pBench )
+{
+    memcpy( pBench->pvOut, pBench->pvIn, pBench->cbIn + sizeof(UniChar) );
+}
+
+void RunCollapse( PBENCH pBench )
+{
+    memcpy( pBench->pvOut, pBench->pvIn, pBench->cbIn + sizeof(UniChar) );
+    pBench->ulResult = CollapseSurrogates( (UniChar *) pBench->pvOut );
+}
+
+// One clipboard operation's worth of scratch memory: many small buffers
+// and one the size of the text
+void RunArena( PBENCH pBench )
+{
+    ULONG ulHeap = arBench.ulHeapAllocs,
+          i;
+
+    ArenaBegin( &arBench );
+    for ( i = 0; i < ARENA_ALLOCS; i++ ) ArenaAlloc( &arBench, 16 << ( i % 9 ));
+    ArenaAlloc( &arBench, pBench->cbIn );
+    ArenaEnd( &arBench );
+    pBench->ulAllocs += arBench.ulHeapAllocs - ulHeap;
+    pBench->cbPeak    = max( pBench->cbPeak, arBench.cbHeld );
+}
+
+void RunMalloc( PBENCH pBench )
+{
+    PVOID apv[ ARENA_ALLOCS + 1 ];
+    ULONG cbHeld = pBench->cbIn,
+          i;
+
+    for ( i = 0; i < ARENA_ALLOCS; i++ ) {
+        apv[ i ] = malloc( 16 << ( i % 9 ));
+        cbHeld  += 16 << ( i % 9 );
+    }
+    apv[ i ] = malloc( pBench->cbIn );
+    for ( i = 0; i <= ARENA_ALLOCS; i++ ) free( apv[ i ] );
+    pBench->ulAllocs += ARENA_ALLOCS + 1;
+    pBench->cbPeak    = max( pBench->cbPeak, cbHeld );
+}
+
+// Every text is new (they differ in their first bytes), so the history
+// is always full and each one replaces the least recently used
+void RunHistoryNew( PBENCH pBench )
+{
+    PSZ   pszText = (PSZ) pBench->pvIn;
+    ULONG ulDuplicates = hsBench.ulDuplicates;
+
+    if ( pBench->cbIn > 8 ) {
+        sprintf( pszText, "%08u", ulHistNext++ );
+        pszText[ 8 ] = ' ';
+    }
+    pBench->ulResult = HistoryAdd( &hsBench, pszText, pBench->cbIn, pBench->ulCP );
+    if ( pBench->ulResult && ( hsBench.ulDuplicates == ulDuplicates )) pBench->ulAllocs++;
+    pBench->cbPeak = max( pBench->cbPeak, hsBench.cbHeld );
+}
+
+void RunHistorySame( PBENCH pBench )
+{
+    pBench->ulResult = HistoryAdd( &hsBench, (PSZ) pBench->pvIn, pBench->cbIn, pBench->ulCP );
+    pBench->cbPeak   = max( pBench->cbPeak, hsBench.cbHeld );
+}
+
+// A copy to the in-memory clipboard (the text is first copied into an arena,
+// standing in for the export from the MLE), and a paste of it as text/unicode
+void RunCopyRender( PBENCH pBench )
+{
+    CLIP_BACKEND  cbMem;
+    MEM_CLIPBOARD mcClip;
+    CLIP_SOURCE   csCopied;
+    CHAR          szError[ MAX_CLIP_ERROR ];
+    ULONG         ulUniError,
+                  ulTxtError,
+                  cbOut = 0;
+
+    ArenaBegin( &arBench );
+    csCopied.pszText  = (PSZ) ArenaAlloc( &arBench, pBench->cbIn + 1 );
+    csCopied.ulLength = pBench->cbIn;
+    csCopied.ulCP     = pBench->ulCP;
+    memcpy( csCopied.pszText, pBench->pvIn, pBench->cbIn + 1 );
+
+    MemClipInit( &mcClip, &cbMem );
+
+    cbMem.pfnOpen( &cbMem );
+    cbMem.pfnEmpty( &cbMem );
+    ClipOfferText( &cbMem, &ulUniError, &ulTxtError );
+    cbMem.pfnClose( &cbMem );
+
+    cbMem.pfnOpen( &cbMem );
+    ArenaBegin( &arBench );
+    ClipRenderText( &cbMem, CCF_UNICODE, &csCopied, &arBench, &cbOut, szError );
+    ArenaEnd( &arBench );
+    cbMem.pfnClose( &cbMem );
+    MemClipFree( &mcClip );
+    ArenaEnd( &arBench );
+    pBench->ulResult = cbOut;
+}
+
+// Both passes, into a buffer of the exact size
+void RunParallel( PBENCH pBench )
+{
+    PAR_CONVERT pc;
+    PSZ         pszFailed;
+
+    if (( ParallelOpen( &pc, pBench->ulCP, pBench->fToUcs, pBench->pvIn, pBench->ulChars,
+                        pBench->ulThreads, &pszFailed ) == ULS_SUCCESS ) &&
+        (( pc.ulOutLength + 1 ) * ( pBench->fToUcs ? sizeof(UniChar) : 1 ) <= pBench->cbOut ))
+    {
+        ParallelConvert( &pc, pBench->pvOut, &pszFailed );
+    }
+    pBench->ulResult = pc.ulOutLength;
+    ParallelClose( &pc );
+}
+
+// A whole paste job, handled as the program's window does: each piece is
+// taken off the queue, "imported" and released, until the job is done
+void RunPaste( PBENCH pBench )
+{
+    PASTE_JOB    job;
+    PPASTE_PIECE pPiece;
+    BENCH_MSG    bm;
+    QWORD        qwLast;
+    double       dUsec;
+    ULONG        cbDone = 0;
+    BOOL         fFirst = TRUE;
+
+    memset( &job, 0, sizeof(job) );
+    job.hwndNotify = BENCH_HWND;
+    job.ulCP       = pBench->ulCP;
+    job.psuText    = (UniChar *) pBench->pvIn;
+    job.ulChars    = pBench->ulChars;
+    DosTmrQueryTime( &qwLast );
+    if ( ! QueueJob( &job )) return;
+
+    for ( ;; ) {
+        GetBenchMsg( &bm );
+        if ( bm.msg == WM_JOBDONE ) break;
+        if ( bm.msg != WM_JOBPIECE ) continue;
+
+        dUsec = QueryUsec( &qwLast );
+        if ( fFirst ) dFirstUsec = max( dFirstUsec, dUsec );
+        else          dGapUsec   = max( dGapUsec, dUsec );
+        fFirst = FALSE;
+
+        pPiece = (PPASTE_PIECE) PVOIDFROMMP( bm.mp2 );
+        if ( cbDone + pPiece->cb <= pBench->cbOut )
+            memcpy( (PCHAR) pBench->pvOut + cbDone, pPiece->ach, pPiece->cb );
+        cbDone += pPiece->cb;
+        pBench->ulAllocs++;
+        ReleasePiece( pPiece );
+        DosTmrQueryTime( &qwLast );
+    }
+    pBench->ulResult = cbDone;
+    pBench->cbPeak   = max( pBench->cbPeak, JOB_INFLIGHT * sizeof(PASTE_PIECE) );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * WinPostMsg                                                                *
+ *                                                                           *
+ * Stands in for the PM function for the conversion worker, adding the       *
+ * message to the end of the benchmark's queue.                              *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the message was queued; FALSE if the queue is full.             *
+ * ------------------------------------------------------------------------- */
+BOOL APIENTRY WinPostMsg( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
+{
+    PBENCH_MSG pMsg;
+
+    DosRequestMutexSem( hmtxQueue, SEM_INDEFINITE_WAIT );
+    if ( ulQueued == QUEUE_SIZE ) {
+        DosReleaseMutexSem( hmtxQueue );
+        return ( FALSE );
+    }
+    pMsg = abmQueue + (( ulQueueFirst + ulQueued++ ) % QUEUE_SIZE );
+    pMsg->msg = msg;
+    pMsg->mp1 = mp1;
+    pMsg->mp2 = mp2;
+    DosPostEventSem( hevQueue );
+    DosReleaseMutexSem( hmtxQueue );
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GetBenchMsg                                                               *
+ *                                                                           *
+ * Takes the oldest message off the benchmark's queue, waiting for one if    *
+ * the queue is empty.                                                       *
+ * ------------------------------------------------------------------------- */
+void GetBenchMsg( PBENCH_MSG pMsg )
+{
+    ULONG ulPosts;
+
+    for ( ;; ) {
+        DosRequestMutexSem( hmtxQueue, SEM_INDEFINITE_WAIT );
+        if ( ulQueued ) {
+            *pMsg = abmQueue[ ulQueueFirst ];
+            ulQueueFirst = ( ulQueueFirst + 1 ) % QUEUE_SIZE;
+            ulQueued--;
+            DosReleaseMutexSem( hmtxQueue );
+            return;
+        }
+        DosResetEventSem( hevQueue, &ulPosts );
+        DosReleaseMutexSem( hmtxQueue );
+        DosWaitEventSem( hevQueue, SEM_INDEFINITE_WAIT );
+    }
+}
@@ -0,0 +1,1226 @@
+/*****************************************************************************
+ * clipconv.c                                                                *
+ *                                                                           *
+ * Clipboard text conversion routines used by CLIPUNI.  These handle the     *
+ * conversion between the local codepage and UCS-2 ("text/unicode"), along   *
+ * with the fixups for known converter problems and the choice of which      *
+ * clipboard format to paste from.  Nothing in here uses Presentation        *
+ * Manager, so the same code can be used outside of the GUI.                 *
+ *                                                                           *
+ * "text/unicode" is treated as UTF-16: surrogate pairs are kept intact when *
+ * converting to or from UTF-8 (codepage 1208), which is done here directly  *
+ * rather than through the Unicode API; other codepages get a single         *
+ * substitution character for each pair.                                     *
+ *                                                                           *
+ * Single-byte codepages are converted through lookup tables, which are      *
+ * generated from the Unicode API the first time each codepage is used (see  *
+ * CreateSbcsTable); the Unicode API itself is only used for DBCS codepages. *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#include <os2.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uconv.h>
+#include "clipconv.h"
+#include "cliptrace.h"
+
+
+// GLOBAL VARIABLES
+//
+UCONV_ENTRY aUconvCache[ MAX_UCONV_CACHE ];     // cached conversion objects
+ULONG       ulUconvSeq    = 0,                  // cache lookup sequence counter
+            ulUconvHits   = 0,                  // lookups satisfied from the cache
+            ulUconvMisses = 0;                  // lookups that created a new object
+SBCS_ENTRY  aSbcsTables[ MAX_SBCS_TABLES ];     // conversion tables by codepage
+
+// Known conversion problems which are patched up after converting
+UCS_FIXUP aUcsFixups[] = {
+    { 850,  0x0131, 0xFFFD },   // CP850 erroneously maps U+0131 to the euro sign
+    { 0,    0,      0      }
+};
+TEXT_FIXUP aTextFixups[] = {
+    { 0,    0x1A,   '?'    },   // some codepages use 0x1A for substitutions
+    { 0,    0,      0      }
+};
+
+
+/* ------------------------------------------------------------------------- *
+ * GetUconvObject                                                            *
+ *                                                                           *
+ * Returns a conversion object for the specified codepage, using the default *
+ * conversion modifiers.  Conversion objects are cached (keyed on the full   *
+ * specifier) for the life of the process; the caller must NOT free the      *
+ * object it receives.  When the cache is full, the least recently used      *
+ * entry is replaced.                                                        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP          : The codepage to convert to/from.                  *
+ *   UconvObject *puconv : Receives the conversion object.                   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code from UniCreateUconvObject().               *
+ * ------------------------------------------------------------------------- */
+ULONG GetUconvObject( ULONG ulCP, UconvObject *puconv )
+{
+    UniChar      suCodepage[ MAX_CP_SPEC ];     // conversion specifier
+    PUCONV_ENTRY pEntry;                        // cache entry to (re)use
+    UconvObject  uconv;                         // new conversion object
+    ULONG        ulRC;                          // return code
+    int          i;
+
+
+    UniMapCpToUcsCp( ulCP, suCodepage, MAX_CP_NAME );
+    UniStrcat( suCodepage, (UniChar *) UCONV_MAP_OPTIONS );
+
+    // Look for a matching object in the cache
+    pEntry = &aUconvCache[ 0 ];
+    for ( i = 0; i < MAX_UCONV_CACHE; i++ ) {
+        if (( aUconvCache[ i ].ulCP == ulCP ) &&
+            ( UniStrcmp( aUconvCache[ i ].suSpec, suCodepage ) == 0 ))
+        {
+            aUconvCache[ i ].ulLastUse = ++ulUconvSeq;
+            *puconv = aUconvCache[ i ].uconv;
+            ulUconvHits++;
+            return ( ULS_SUCCESS );
+        }
+        if ( aUconvCache[ i ].ulLastUse < pEntry->ulLastUse )
+            pEntry = &aUconvCache[ i ];
+    }
+
+    // Not found, so create a new one and put it in the oldest slot
+    ulUconvMisses++;
+    if (( ulRC = UniCreateUconvObject( suCodepage, &uconv )) != ULS_SUCCESS )
+        return ( ulRC );
+
+    if ( pEntry->ulCP ) UniFreeUconvObject( pEntry->uconv );
+    pEntry->ulCP      = ulCP;
+    pEntry->uconv     = uconv;
+    pEntry->ulLastUse = ++ulUconvSeq;
+    UniStrcpy( pEntry->suSpec, suCodepage );
+
+    *puconv = uconv;
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * CreateUconvObject                                                         *
+ *                                                                           *
+ * Creates a new, uncached conversion object for the specified codepage,     *
+ * using the default conversion modifiers.  This is for use by threads other *
+ * than the main one (the cache is not thread-safe); the caller must free    *
+ * the object with UniFreeUconvObject() when done.                           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP          : The codepage to convert to/from.                  *
+ *   UconvObject *puconv : Receives the conversion object.                   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code from UniCreateUconvObject().               *
+ * ------------------------------------------------------------------------- */
+ULONG CreateUconvObject( ULONG ulCP, UconvObject *puconv )
+{
+    UniChar suCodepage[ MAX_CP_SPEC ];  // conversion specifier
+
+    UniMapCpToUcsCp( ulCP, suCodepage, MAX_CP_NAME );
+    UniStrcat( suCodepage, (UniChar *) UCONV_MAP_OPTIONS );
+    return ( UniCreateUconvObject( suCodepage, puconv ));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FreeUconvCache                                                            *
+ *                                                                           *
+ * Frees all cached conversion objects.  (The hit/miss counters are kept.)   *
+ * ------------------------------------------------------------------------- */
+void FreeUconvCache( void )
+{
+    int i;
+
+    for ( i = 0; i < MAX_UCONV_CACHE; i++ ) {
+        if ( aUconvCache[ i ].ulCP ) UniFreeUconvObject( aUconvCache[ i ].uconv );
+        aUconvCache[ i ].ulCP      = 0;
+        aUconvCache[ i ].ulLastUse = 0;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FixupUcsText                                                              *
+ *                                                                           *
+ * Replaces UCS-2 characters which are known to be mishandled by the         *
+ * converter for the given codepage (see aUcsFixups).  All applicable        *
+ * fixups are done in a single pass over the string.                         *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   UniChar *psuText: The UCS-2 string to fix up (modified in place).       *
+ *   ULONG ulCP      : The codepage being converted to or from.              *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Length of the string in UniChars.                                       *
+ * ------------------------------------------------------------------------- */
+ULONG FixupUcsText( UniChar *psuText, ULONG ulCP )
+{
+    UniChar  auniFrom[ MAX_FIXUPS ] = { 0 },    // characters to be replaced...
+             auniTo[ MAX_FIXUPS ]   = { 0 };    // ...and their replacements
+    UniChar *puniC;                     // pointer into psuText
+    ULONG    ulStage;                   // trace stage to return to
+    int      iCount,                    // number of applicable fixups
+             i;
+
+
+    // Collect the fixups which apply to this codepage
+    for ( iCount = 0, i = 0; aUcsFixups[ i ].uniFrom && ( iCount < MAX_FIXUPS ); i++ ) {
+        if (( aUcsFixups[ i ].ulCP == 0 ) || ( aUcsFixups[ i ].ulCP == ulCP )) {
+            auniFrom[ iCount ] = aUcsFixups[ i ].uniFrom;
+            auniTo[ iCount ]   = aUcsFixups[ i ].uniTo;
+            iCount++;
+        }
+    }
+    if ( ! iCount ) return UniStrlen( psuText );
+
+    ulStage = TraceStage( TST_FIXUP );
+    for ( puniC = psuText; *puniC; puniC++ ) {
+        for ( i = 0; i < iCount; i++ ) {
+            if ( *puniC == auniFrom[ i ] ) {
+                *puniC = auniTo[ i ];
+                break;
+            }
+        }
+    }
+    TraceStage( ulStage );
+    return ( puniC - psuText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * QueryTextXlate                                                            *
+ *                                                                           *
+ * Builds the byte translation table that applies the codepage fixups (see   *
+ * aTextFixups) for the given codepage.  UTF-8 has no substitution byte, so  *
+ * its table leaves every byte as it is.                                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PUCHAR pbXlate: Buffer of 256 bytes to receive the table.               *
+ *   ULONG ulCP    : The codepage.                                           *
+ * ------------------------------------------------------------------------- */
+void QueryTextXlate( PUCHAR pbXlate, ULONG ulCP )
+{
+    int i;
+
+    for ( i = 0; i < 256; i++ ) pbXlate[ i ] = (UCHAR) i;
+    if ( ulCP == CP_UTF8 ) return;
+    for ( i = 0; aTextFixups[ i ].chFrom; i++ ) {
+        if (( aTextFixups[ i ].ulCP == 0 ) || ( aTextFixups[ i ].ulCP == ulCP ))
+            pbXlate[ aTextFixups[ i ].chFrom ] = aTextFixups[ i ].chTo;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FixupLocalText                                                            *
+ *                                                                           *
+ * Replaces codepage characters which should not be passed on to the user    *
+ * (see aTextFixups).  A translation table is built for the codepage, and    *
+ * the string is then translated in a single pass.                           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PSZ pszText: The string to fix up (modified in place).                  *
+ *   ULONG ulCP : The codepage of the string.                                *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Length of the string in bytes.                                          *
+ * ------------------------------------------------------------------------- */
+ULONG FixupLocalText( PSZ pszText, ULONG ulCP )
+{
+    UCHAR  achXlate[ 256 ];             // byte translation table
+    PUCHAR pch;                         // pointer into pszText
+    ULONG  ulStage;                     // trace stage to return to
+
+
+    QueryTextXlate( achXlate, ulCP );
+
+    ulStage = TraceStage( TST_FIXUP );
+    for ( pch = (PUCHAR) pszText; *pch; pch++ ) *pch = achXlate[ *pch ];
+    TraceStage( ulStage );
+    return ( pch - (PUCHAR) pszText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertFromUcs                                                            *
+ *                                                                           *
+ * Converts a UCS-2 string into the specified codepage, applying any         *
+ * necessary fixups.  Note that the source string may be modified.           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP       : The codepage to convert to.                          *
+ *   UniChar *psuText : The UCS-2 string to convert.                         *
+ *   PSZ *ppszText    : Receives the converted string, which the caller      *
+ *                      must free().                                         *
+ *   PULONG pulLength : Receives the length of the converted string.         *
+ *   PSZ *ppszFailed  : Receives the name of the failing function, if any.   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG ConvertFromUcs( ULONG ulCP, UniChar *psuText, PSZ *ppszText, PULONG pulLength, PSZ *ppszFailed )
+{
+    UconvObject uconv;                      // conversion object
+    PSBCS_TABLE pTable;                     // conversion tables
+    UniChar     *psuIn;                     // UTF-8 conversion input pointer
+    PSZ         pszLocalText;               // converted text
+    ULONG       ulBufLen,                   // length of output buffer
+                ulRC;                       // return code
+
+
+    *ppszText  = NULL;
+    *pulLength = 0;
+
+    // UTF-8 is converted directly, at its exact size
+    if ( ulCP == CP_UTF8 ) {
+        psuIn    = psuText;
+        ulBufLen = UcsToUtf8( &psuIn, NULL, 0 ) + 1;
+        if (( pszLocalText = (PSZ) malloc( ulBufLen )) == NULL ) {
+            *ppszFailed = "malloc()";
+            return ( ULS_NOMEMORY );
+        }
+        psuIn = psuText;
+        *pulLength = UcsToUtf8( &psuIn, pszLocalText, ulBufLen );
+        *ppszText  = pszLocalText;
+        return ( ULS_SUCCESS );
+    }
+
+    // Single-byte codepages use the tables (which include the fixups)
+    if (( pTable = GetSbcsTable( ulCP, TRUE )) != NULL ) {
+        ulBufLen = UniStrlen( psuText ) + 1;
+        if (( pszLocalText = (PSZ) malloc( ulBufLen )) == NULL ) {
+            *ppszFailed = "malloc()";
+            return ( ULS_NOMEMORY );
+        }
+        psuIn      = psuText;
+        *pulLength = SbcsFromUcs( pTable, &psuIn, pszLocalText, ulBufLen );
+        *ppszText  = pszLocalText;
+        return ( ULS_SUCCESS );
+    }
+
+    if (( ulRC = GetUconvObject( ulCP, &uconv )) != ULS_SUCCESS ) {
+        *ppszFailed = "UniCreateUconvObject()";
+        return ( ulRC );
+    }
+
+    // Patch up known mapping problems (this also measures the text)
+    CollapseSurrogates( psuText );
+    ulBufLen = ( FixupUcsText( psuText, ulCP ) * 4 ) + 1;
+
+    if (( pszLocalText = (PSZ) malloc( ulBufLen )) == NULL ) {
+        *ppszFailed = "malloc()";
+        return ( ULS_NOMEMORY );
+    }
+    if (( ulRC = UniStrFromUcs( uconv, pszLocalText, psuText, ulBufLen )) != ULS_SUCCESS ) {
+        free( pszLocalText );
+        *ppszFailed = "UniStrFromUcs()";
+        return ( ulRC );
+    }
+
+    // Clean up substitution characters (this also measures the result)
+    *pulLength = FixupLocalText( pszLocalText, ulCP );
+    *ppszText  = pszLocalText;
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertToUcs                                                              *
+ *                                                                           *
+ * Converts a string in the specified codepage into UCS-2, applying any      *
+ * necessary fixups.  The output buffer is allocated at its exact size.      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP         : The codepage to convert from.                      *
+ *   PSZ pszText        : The string to convert.                             *
+ *   ULONG ulLength     : Length of pszText in bytes.                        *
+ *   UniChar **ppsuText : Receives the UCS-2 string, which the caller must   *
+ *                        free().                                            *
+ *   PSZ *ppszFailed    : Receives the name of the failing function, if any. *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG ConvertToUcs( ULONG ulCP, PSZ pszText, ULONG ulLength, UniChar **ppsuText, PSZ *ppszFailed )
+{
+    UniChar     *psuUniText;                // converted text
+    ULONG       ulChars,                    // length of converted text
+                ulRC;                       // return code
+
+
+    *ppsuText = NULL;
+
+    if (( ulRC = QueryUcsLength( ulCP, pszText, ulLength, &ulChars, ppszFailed )) != ULS_SUCCESS )
+        return ( ulRC );
+    if (( psuUniText = (UniChar *) malloc( ( ulChars + 1 ) * sizeof(UniChar) )) == NULL ) {
+        *ppszFailed = "malloc()";
+        return ( ULS_NOMEMORY );
+    }
+    if (( ulRC = ConvertToUcsBuf( ulCP, pszText, psuUniText, ulChars + 1, ppszFailed )) != ULS_SUCCESS ) {
+        free( psuUniText );
+        return ( ulRC );
+    }
+
+    *ppsuText = psuUniText;
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertToUcsBuf                                                           *
+ *                                                                           *
+ * Converts a string in the specified codepage into UCS-2 in the caller's    *
+ * buffer, applying any necessary fixups.  QueryUcsLength can be used to     *
+ * find out how big the buffer needs to be.                                  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP       : The codepage to convert from.                        *
+ *   PSZ pszText      : The string to convert.                               *
+ *   UniChar *psuBuf  : The output buffer.                                   *
+ *   ULONG ulBufLen   : Size of the output buffer in UniChars (incl. NUL).   *
+ *   PSZ *ppszFailed  : Receives the name of the failing function, if any.   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG ConvertToUcsBuf( ULONG ulCP, PSZ pszText, UniChar *psuBuf, ULONG ulBufLen, PSZ *ppszFailed )
+{
+    UconvObject uconv;                      // conversion object
+    PSBCS_TABLE pTable;                     // conversion tables
+    ULONG       ulRC;                       // return code
+
+
+    // UTF-8 is converted directly (so that surrogates are produced)
+    if ( ulCP == CP_UTF8 ) {
+        Utf8ToUcs( pszText, strlen( pszText ), psuBuf, ulBufLen );
+        return ( ULS_SUCCESS );
+    }
+
+    // Single-byte codepages use the tables (which include the fixups)
+    if (( pTable = GetSbcsTable( ulCP, TRUE )) != NULL ) {
+        SbcsToUcs( pTable, pszText, psuBuf, ulBufLen );
+        return ( ULS_SUCCESS );
+    }
+
+    if (( ulRC = GetUconvObject( ulCP, &uconv )) != ULS_SUCCESS ) {
+        *ppszFailed = "UniCreateUconvObject()";
+        return ( ulRC );
+    }
+    if (( ulRC = UniStrToUcs( uconv, psuBuf, pszText, ulBufLen )) != ULS_SUCCESS ) {
+        *ppszFailed = "UniStrToUcs()";
+        return ( ulRC );
+    }
+
+    // Patch up known mapping problems
+    FixupUcsText( psuBuf, ulCP );
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * QueryUcsLength                                                            *
+ *                                                                           *
+ * Determines the exact number of UniChars a string in the specified         *
+ * codepage will produce when converted to UCS-2 (not counting the NUL).     *
+ * For single-byte codepages this is just the length of the string; other    *
+ * codepages need a counting pass through the converter.                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP       : The codepage to convert from.                        *
+ *   PSZ pszText      : The string to convert.                               *
+ *   ULONG ulLength   : Length of pszText in bytes.                          *
+ *   PULONG pulChars  : Receives the length of the UCS-2 string.             *
+ *   PSZ *ppszFailed  : Receives the name of the failing function, if any.   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG QueryUcsLength( ULONG ulCP, PSZ pszText, ULONG ulLength, PULONG pulChars, PSZ *ppszFailed )
+{
+    UconvObject       uconv;                    // conversion object
+    uconv_attribute_t attr;                     // conversion object attributes
+    UniChar           asuCount[ COUNT_CHARS ],  // scratch output buffer
+                      *psuOut;                  // conversion output pointer
+    PVOID             pIn;                      // conversion input pointer
+    size_t            stInLeft,                 // bytes left to convert
+                      stOutLeft,                // UniChars left in scratch buffer
+                      stSubst;                  // number of substitutions made
+    ULONG             ulRC;                     // return code
+
+
+    *pulChars = 0;
+
+    if ( ulCP == CP_UTF8 ) {
+        *pulChars = Utf8ToUcs( pszText, ulLength, NULL, 0 );
+        return ( ULS_SUCCESS );
+    }
+    if ( GetSbcsTable( ulCP, TRUE ) != NULL ) {
+        *pulChars = ulLength;
+        return ( ULS_SUCCESS );
+    }
+
+    if (( ulRC = GetUconvObject( ulCP, &uconv )) != ULS_SUCCESS ) {
+        *ppszFailed = "UniCreateUconvObject()";
+        return ( ulRC );
+    }
+    if (( UniQueryUconvObject( uconv, &attr, sizeof(attr), NULL, NULL, NULL ) == ULS_SUCCESS ) &&
+        ( attr.mb_max_len == 1 ))
+    {
+        *pulChars = ulLength;
+        return ( ULS_SUCCESS );
+    }
+
+    pIn      = (PVOID) pszText;
+    stInLeft = ulLength;
+    while ( stInLeft ) {
+        psuOut    = asuCount;
+        stOutLeft = COUNT_CHARS;
+        ulRC = UniUconvToUcs( uconv, &pIn, &stInLeft, &psuOut, &stOutLeft, &stSubst );
+        *pulChars += psuOut - asuCount;
+        if ( ulRC == ULS_BUFFERFULL ) continue;
+        if ( ulRC != ULS_SUCCESS ) {
+            *ppszFailed = "UniUconvToUcs()";
+            return ( ulRC );
+        }
+        break;
+    }
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ChunkBoundary                                                             *
+ *                                                                           *
+ * Finds how much of a piece of text read from a longer string can be        *
+ * converted on its own, i.e. the length up to the end of its last complete  *
+ * character.  The piece must start at the beginning of a character; the     *
+ * bytes after the boundary (part of a character that continues in the next  *
+ * piece) should be converted along with the next piece.                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP       : The codepage of the text.                            *
+ *   PCHAR pchText    : The piece of text.                                   *
+ *   ULONG cbText     : Its length in bytes.                                 *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The number of bytes that make up whole characters.                      *
+ * ------------------------------------------------------------------------- */
+ULONG ChunkBoundary( ULONG ulCP, PCHAR pchText, ULONG cbText )
+{
+    UconvObject       uconv;                    // conversion object
+    uconv_attribute_t attr;                     // conversion object attributes
+    UCHAR             abFirst[ 256 ];           // character length for each first byte
+    PUCHAR            pb = (PUCHAR) pchText;    // the text, as bytes
+    ULONG             ulPos,                    // current position
+                      ulSize;                   // size of the character there
+
+
+    // UTF-8: back up over a sequence which is cut short at the end (a lead
+    // byte can be at most three bytes before the end of an incomplete one)
+    if ( ulCP == CP_UTF8 ) {
+        for ( ulPos = cbText; ulPos && ( cbText - ulPos < 3 ); ) {
+            ulPos--;
+            if (( pb[ ulPos ] & 0xC0 ) == 0x80 ) continue;
+            if      (( pb[ ulPos ] & 0xE0 ) == 0xC0 ) ulSize = 2;
+            else if (( pb[ ulPos ] & 0xF0 ) == 0xE0 ) ulSize = 3;
+            else if (( pb[ ulPos ] & 0xF8 ) == 0xF0 ) ulSize = 4;
+            else ulSize = 1;
+            return (( ulPos + ulSize > cbText ) ? ulPos : cbText );
+        }
+        return ( cbText );
+    }
+    if ( GetSbcsTable( ulCP, TRUE ) != NULL ) return ( cbText );
+
+    // Otherwise walk forward through the characters, using the length which
+    // the converter gives for each possible first byte
+    if (( GetUconvObject( ulCP, &uconv ) != ULS_SUCCESS ) ||
+        ( UniQueryUconvObject( uconv, &attr, sizeof(attr), (char *) abFirst, NULL, NULL ) != ULS_SUCCESS ) ||
+        ( attr.mb_max_len == 1 ))
+        return ( cbText );
+    for ( ulPos = 0; ulPos < cbText; ulPos += ulSize ) {
+        ulSize = abFirst[ pb[ ulPos ]] ? abFirst[ pb[ ulPos ]] : 1;
+        if ( ulPos + ulSize > cbText ) break;
+    }
+    return ( ulPos );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * QueryPasteFormat                                                          *
+ *                                                                           *
+ * Decides which of the available clipboard formats to paste from.           *
+ * UTF-8 text is used as-is if that is the target codepage.  Otherwise,      *
+ * preference is given to "text/unicode", then to UTF-8 text (which is       *
+ * converted via UCS-2); if neither is available, we use plain text          *
+ * (CF_TEXT) instead.                                                        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG flAvailable: The formats available on the clipboard (CCF_*).      *
+ *   ULONG ulCP       : The codepage the text will be pasted as.             *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The format to use (CCF_*), or 0 if none is suitable.                    *
+ * ------------------------------------------------------------------------- */
+ULONG QueryPasteFormat( ULONG flAvailable, ULONG ulCP )
+{
+    if (( ulCP == CP_UTF8 ) && ( flAvailable & CCF_UTF8 ))
+        return ( CCF_UTF8 );
+    if ( flAvailable & CCF_UNICODE ) return ( CCF_UNICODE );
+    if ( flAvailable & CCF_UTF8 )    return ( CCF_UTF8 );
+    if ( flAvailable & CCF_TEXT )    return ( CCF_TEXT );
+    return ( 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * StreamFromUcsOpen                                                         *
+ *                                                                           *
+ * Prepares to convert a UCS-2 string into the specified codepage a piece at *
+ * a time (see StreamFromUcs).  The source string is not modified.  A stream *
+ * used outside the main thread must have its own conversion object, which   *
+ * is freed again by StreamFromUcsClose, and can only use conversion tables  *
+ * which the main thread has already created.                                *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCONV_STREAM pStream: The stream state to initialize.                   *
+ *   ULONG ulCP          : The codepage to convert to.                       *
+ *   UniChar *psuText    : The UCS-2 string to convert.                      *
+ *   BOOL fPrivate       : Use a private (uncached) conversion object.       *
+ *   PSZ *ppszFailed     : Receives the name of the failing function.        *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG StreamFromUcsOpen( PCONV_STREAM pStream, ULONG ulCP, UniChar *psuText, BOOL fPrivate, PSZ *ppszFailed )
+{
+    ULONG ulRC;
+
+    pStream->ulCP     = ulCP;
+    pStream->psuNext  = psuText;
+    pStream->fPrivate = FALSE;
+    pStream->pTable   = NULL;
+    if ( ulCP == CP_UTF8 ) return ( ULS_SUCCESS );
+    if (( pStream->pTable = GetSbcsTable( ulCP, ! fPrivate )) != NULL )
+        return ( ULS_SUCCESS );
+    if ( fPrivate )
+        ulRC = CreateUconvObject( ulCP, &(pStream->uconv) );
+    else
+        ulRC = GetUconvObject( ulCP, &(pStream->uconv) );
+    if ( ulRC != ULS_SUCCESS )
+        *ppszFailed = "UniCreateUconvObject()";
+    else
+        pStream->fPrivate = fPrivate;
+    return ( ulRC );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * StreamFromUcsClose                                                        *
+ *                                                                           *
+ * Releases a conversion stream (see StreamFromUcsOpen).                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCONV_STREAM pStream: The stream state.                                 *
+ * ------------------------------------------------------------------------- */
+void StreamFromUcsClose( PCONV_STREAM pStream )
+{
+    if ( pStream->fPrivate ) UniFreeUconvObject( pStream->uconv );
+    pStream->fPrivate = FALSE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * StreamFromUcs                                                             *
+ *                                                                           *
+ * Converts the next piece of a UCS-2 string (see StreamFromUcsOpen) into    *
+ * the caller's buffer, applying any necessary fixups.  As much text is      *
+ * converted as will fit; the output is always NUL-terminated and never      *
+ * ends with a partial character.  The caller should keep calling this until *
+ * it returns a length of 0.                                                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCONV_STREAM pStream: The stream state.                                 *
+ *   PCHAR pchBuf        : The output buffer.                                *
+ *   ULONG cbBuf         : Size of the output buffer (including the NUL).    *
+ *   PULONG pulLength    : Receives the number of bytes converted.           *
+ *   PSZ *ppszFailed     : Receives the name of the failing function.        *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG StreamFromUcs( PCONV_STREAM pStream, PCHAR pchBuf, ULONG cbBuf, PULONG pulLength, PSZ *ppszFailed )
+{
+    UniChar *psuSrc,                    // source slice
+            *psuIn,                     // conversion input pointer
+            uniC;                       // current character
+    PVOID   pOut;                       // conversion output pointer
+    size_t  stInLeft,                   // UniChars left to convert
+            stOutLeft,                  // bytes left in output buffer
+            stSubst;                    // number of substitutions made
+    ULONG   ulSlice,                    // maximum UniChars in this slice
+            ulIn,                       // source UniChars in this slice
+            ulOut,                      // work UniChars in this slice
+            i,
+            ulRC;                       // return code
+
+
+    *pulLength = 0;
+    *pchBuf    = '\0';
+    if ( cbBuf < 2 ) return ( ULS_BUFFERFULL );
+
+    // UTF-8 is converted directly
+    if ( pStream->ulCP == CP_UTF8 ) {
+        *pulLength = UcsToUtf8( &(pStream->psuNext), pchBuf, cbBuf );
+        return ( ULS_SUCCESS );
+    }
+
+    // Single-byte codepages are converted through the tables
+    if ( pStream->pTable ) {
+        *pulLength = SbcsFromUcs( pStream->pTable, &(pStream->psuNext), pchBuf, cbBuf );
+        return ( ULS_SUCCESS );
+    }
+
+    // Copy the next slice of the source into the work buffer.  Each source
+    // character produces at least one byte, so never take more than fit.
+    // Surrogate pairs become a single substitution character, and are never
+    // split between slices.
+    ulSlice = min( STREAM_CHARS, cbBuf - 1 );
+    psuSrc  = pStream->psuNext;
+    for ( ulIn = 0, ulOut = 0; ( ulIn < ulSlice ) && psuSrc[ ulIn ]; ulIn++ ) {
+        uniC = psuSrc[ ulIn ];
+        if ( IS_HIGH_SURROGATE( uniC ) && IS_LOW_SURROGATE( psuSrc[ ulIn + 1 ] )) {
+            if (( ulIn + 1 >= ulSlice ) && ulOut ) break;
+            ulIn++;
+            uniC = 0xFFFD;
+        }
+        else if ( IS_HIGH_SURROGATE( uniC ) || IS_LOW_SURROGATE( uniC ))
+            uniC = 0xFFFD;
+        pStream->asuWork[ ulOut++ ] = uniC;
+    }
+    if ( ! ulOut ) return ( ULS_SUCCESS );
+    pStream->asuWork[ ulOut ] = 0;
+
+    // Patch up known mapping problems
+    FixupUcsText( pStream->asuWork, pStream->ulCP );
+
+    // Convert as much as will fit; if the buffer fills up (e.g. with a DBCS
+    // codepage) the remainder is picked up on the next call.
+    psuIn     = pStream->asuWork;
+    pOut      = (PVOID) pchBuf;
+    stInLeft  = ulOut;
+    stOutLeft = cbBuf - 1;
+    ulRC = UniUconvFromUcs( pStream->uconv, &psuIn, &stInLeft, &pOut, &stOutLeft, &stSubst );
+    if (( ulRC != ULS_SUCCESS ) && ( ulRC != ULS_BUFFERFULL )) {
+        *ppszFailed = "UniUconvFromUcs()";
+        return ( ulRC );
+    }
+    if ( psuIn == pStream->asuWork ) {
+        *ppszFailed = "UniUconvFromUcs()";
+        return ( ULS_BUFFERFULL );
+    }
+
+    // Advance past the source characters that were actually converted
+    if ( psuIn - pStream->asuWork == ulOut )
+        pStream->psuNext += ulIn;
+    else for ( i = psuIn - pStream->asuWork; i; i-- ) {
+        if ( IS_HIGH_SURROGATE( pStream->psuNext[ 0 ] ) && IS_LOW_SURROGATE( pStream->psuNext[ 1 ] ))
+            pStream->psuNext++;
+        pStream->psuNext++;
+    }
+    *((PCHAR) pOut) = '\0';
+
+    // Clean up substitution characters (this also measures the result)
+    *pulLength = FixupLocalText( pchBuf, pStream->ulCP );
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * CollapseSurrogates                                                        *
+ *                                                                           *
+ * Replaces each surrogate pair (or unpaired surrogate) in a UTF-16 string   *
+ * with a single U+FFFD, for conversion to codepages which cannot represent  *
+ * characters outside the BMP.                                               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   UniChar *psuText: The string to fix up (modified in place).             *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   New length of the string in UniChars.                                   *
+ * ------------------------------------------------------------------------- */
+ULONG CollapseSurrogates( UniChar *psuText )
+{
+    UniChar *psuIn,                     // read pointer
+            *psuOut;                    // write pointer
+
+    for ( psuIn = psuOut = psuText; *psuIn; psuIn++, psuOut++ ) {
+        if ( IS_HIGH_SURROGATE( *psuIn ) && IS_LOW_SURROGATE( psuIn[ 1 ] )) {
+            psuIn++;
+            *psuOut = 0xFFFD;
+        }
+        else if ( IS_HIGH_SURROGATE( *psuIn ) || IS_LOW_SURROGATE( *psuIn ))
+            *psuOut = 0xFFFD;
+        else
+            *psuOut = *psuIn;
+    }
+    *psuOut = 0;
+    return ( psuOut - psuText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GetSbcsTable                                                              *
+ *                                                                           *
+ * Returns the conversion tables for a single-byte codepage, creating them   *
+ * the first time (see CreateSbcsTable).  Tables are kept until the program  *
+ * ends, and are never changed once created, so any thread may use them;     *
+ * only the main thread may create them, however.                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP   : The codepage.                                            *
+ *   BOOL fCreate : Create the tables if they do not exist yet.              *
+ *                                                                           *
+ * RETURNS: PSBCS_TABLE                                                      *
+ *   The tables, or NULL if the codepage is not a single-byte one (or they   *
+ *   could not be created).                                                  *
+ * ------------------------------------------------------------------------- */
+PSBCS_TABLE GetSbcsTable( ULONG ulCP, BOOL fCreate )
+{
+    PSBCS_TABLE pTable;
+    int         i;
+
+    for ( i = 0; ( i < MAX_SBCS_TABLES ) && aSbcsTables[ i ].ulCP; i++ ) {
+        if ( aSbcsTables[ i ].ulCP == ulCP ) return ( aSbcsTables[ i ].pTable );
+    }
+    if ( ! fCreate || ( i == MAX_SBCS_TABLES ) || ( ulCP == CP_UTF8 )) return ( NULL );
+
+    // (a failure is remembered too, so that it is not retried every time)
+    pTable = CreateSbcsTable( ulCP );
+    aSbcsTables[ i ].pTable = pTable;
+    aSbcsTables[ i ].ulCP   = ulCP;
+    return ( pTable );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * CreateSbcsTable                                                           *
+ *                                                                           *
+ * Generates the conversion tables for a single-byte codepage by running     *
+ * every byte, and every UCS-2 character, through the Unicode API once.      *
+ * The fixups (see aUcsFixups and aTextFixups) are applied to the results,   *
+ * so converting with the tables gives exactly the same text as converting   *
+ * with the Unicode API and then fixing it up.                               *
+ *                                                                           *
+ * The reverse table is stored as 256 pages of 256 bytes, one for each high  *
+ * byte of the UCS-2 character; identical pages (most of them, since most    *
+ * characters are not in the codepage) are only stored once.                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP: The codepage.                                               *
+ *                                                                           *
+ * RETURNS: PSBCS_TABLE                                                      *
+ *   The tables (to be freed by the caller), or NULL if the codepage is not  *
+ *   a single-byte one or the tables could not be created.                   *
+ * ------------------------------------------------------------------------- */
+PSBCS_TABLE CreateSbcsTable( ULONG ulCP )
+{
+    UconvObject       uconv;                    // conversion object
+    uconv_attribute_t attr;                     // conversion object attributes
+    PSBCS_TABLE       pTable = NULL;            // the new tables
+    UniChar           asuBytes[ 257 ],          // UCS-2 for bytes 1-255
+                      *psuAll = NULL,           // every UCS-2 character from U+0001
+                      *psuIn;                   // conversion input pointer
+    UCHAR             achXlate[ 256 ],          // codepage fixups
+                      achBytes[ 256 ];          // bytes 1-255
+    PUCHAR            pbAll = NULL,             // codepage byte for every UCS-2 character
+                      pbPages;                  // distinct pages of the reverse table
+    PVOID             pIn, pOut;                // conversion pointers
+    size_t            stInLeft,                 // input left to convert
+                      stOutLeft,                // room left for output
+                      stSubst;                  // number of substitutions made
+    ULONG             aulPage[ 256 ],           // distinct page used for each high byte
+                      ulPages,                  // number of distinct pages
+                      i, j;
+
+
+    if ( CreateUconvObject( ulCP, &uconv ) != ULS_SUCCESS ) return ( NULL );
+    if (( UniQueryUconvObject( uconv, &attr, sizeof(attr), NULL, NULL, NULL ) != ULS_SUCCESS ) ||
+        ( attr.mb_max_len != 1 ))
+        goto done;
+
+    // Forward table: convert bytes 1-255 in one go
+    for ( i = 1; i < 256; i++ ) achBytes[ i - 1 ] = (UCHAR) i;
+    pIn       = (PVOID) achBytes;
+    stInLeft  = 255;
+    psuIn     = asuBytes;
+    stOutLeft = 255;
+    if (( UniUconvToUcs( uconv, &pIn, &stInLeft, &psuIn, &stOutLeft, &stSubst ) != ULS_SUCCESS ) ||
+        stInLeft || stOutLeft )
+        goto done;
+    asuBytes[ 255 ] = 0;
+    FixupUcsText( asuBytes, ulCP );
+
+    // Reverse table: convert U+0001-FFFF in one go, treating surrogates and
+    // fixups exactly as StreamFromUcs and ConvertFromUcs do
+    if ((( psuAll = (UniChar *) malloc( 0x10000 * sizeof(UniChar) )) == NULL ) ||
+        (( pbAll  = (PUCHAR) malloc( 0x10000 )) == NULL ))
+        goto done;
+    for ( i = 1; i < 0x10000; i++ )
+        psuAll[ i - 1 ] = ( IS_HIGH_SURROGATE( i ) || IS_LOW_SURROGATE( i )) ? 0xFFFD : (UniChar) i;
+    psuAll[ 0xFFFF ] = 0;
+    FixupUcsText( psuAll, ulCP );
+    psuIn     = psuAll;
+    stInLeft  = 0xFFFF;
+    pOut      = (PVOID)( pbAll + 1 );
+    stOutLeft = 0xFFFF;
+    if (( UniUconvFromUcs( uconv, &psuIn, &stInLeft, &pOut, &stOutLeft, &stSubst ) != ULS_SUCCESS ) ||
+        stInLeft || stOutLeft )
+        goto done;
+    pbAll[ 0 ] = 0;
+    QueryTextXlate( achXlate, ulCP );
+    for ( i = 1; i < 0x10000; i++ ) pbAll[ i ] = achXlate[ pbAll[ i ]];
+
+    // Find the distinct pages
+    for ( ulPages = 0, i = 0; i < 256; i++ ) {
+        for ( j = 0; j < i; j++ )
+            if ( memcmp( pbAll + ( i << 8 ), pbAll + ( j << 8 ), 256 ) == 0 ) break;
+        aulPage[ i ] = ( j < i ) ? aulPage[ j ] : ulPages++;
+    }
+
+    if (( pTable = (PSBCS_TABLE) malloc( sizeof(SBCS_TABLE) + ( ulPages << 8 ))) == NULL )
+        goto done;
+    pTable->asuToUcs[ 0 ] = 0;
+    memcpy( pTable->asuToUcs + 1, asuBytes, 255 * sizeof(UniChar) );
+    pbPages = (PUCHAR)( pTable + 1 );
+    for ( i = 0; i < 256; i++ ) {
+        pTable->apbFromUcs[ i ] = pbPages + ( aulPage[ i ] << 8 );
+        memcpy( pTable->apbFromUcs[ i ], pbAll + ( i << 8 ), 256 );
+    }
+    // (0x1A is left out, since the text fixups always change it: the fast
+    // paths in SbcsToUcs and SbcsFromUcs leave it to the tables instead)
+    pTable->fAscii = TRUE;
+    for ( i = 0; i < 0x80; i++ ) {
+        if ( i == 0x1A ) continue;
+        if (( pTable->asuToUcs[ i ] != i ) || ( pbAll[ i ] != i )) pTable->fAscii = FALSE;
+    }
+
+done:
+    free( pbAll );
+    free( psuAll );
+    UniFreeUconvObject( uconv );
+    return ( pTable );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FreeSbcsTables                                                            *
+ *                                                                           *
+ * Frees all conversion tables.  No other thread may be using them.          *
+ * ------------------------------------------------------------------------- */
+void FreeSbcsTables( void )
+{
+    int i;
+
+    for ( i = 0; i < MAX_SBCS_TABLES; i++ ) {
+        free( aSbcsTables[ i ].pTable );
+        aSbcsTables[ i ].pTable = NULL;
+        aSbcsTables[ i ].ulCP   = 0;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * SbcsToUcs                                                                 *
+ *                                                                           *
+ * Converts a string in a single-byte codepage to UCS-2 using its tables.    *
+ * Runs of ASCII are handled four bytes at a time where the codepage allows  *
+ * (except for 0x1A, which is always looked up).                             *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PSBCS_TABLE pTable: The codepage's conversion tables.                   *
+ *   PSZ pszText       : The string to convert.                              *
+ *   UniChar *psuBuf   : The output buffer.                                  *
+ *   ULONG ulBufLen    : Size of the output buffer in UniChars (incl. NUL).  *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of UniChars converted (not counting the terminating NUL).        *
+ * ------------------------------------------------------------------------- */
+ULONG SbcsToUcs( PSBCS_TABLE pTable, PSZ pszText, UniChar *psuBuf, ULONG ulBufLen )
+{
+    PUCHAR  pb = (PUCHAR) pszText;
+    UniChar *psu, *psuEnd;
+    ULONG   ul, ulSub;
+
+    if ( ! ulBufLen ) return ( 0 );
+    psu    = psuBuf;
+    psuEnd = psuBuf + ulBufLen - 1;
+    while (( psu < psuEnd ) && *pb ) {
+        // (an aligned word never crosses the end of the string's memory)
+        if ( pTable->fAscii && ((( ULONG ) pb & 3 ) == 0 ) && ( psu + 4 <= psuEnd )) {
+            // (no byte may be 0x80 or above, 0, or 0x1A)
+            ul    = *((PULONG) pb );
+            ulSub = ul ^ 0x1A1A1A1A;
+            if ((( ul & 0x80808080 ) == 0 ) && ((( ul - 0x01010101 ) & ~ul & 0x80808080 ) == 0 ) &&
+                ((( ulSub - 0x01010101 ) & ~ulSub & 0x80808080 ) == 0 )) {
+                psu[ 0 ] = pb[ 0 ];
+                psu[ 1 ] = pb[ 1 ];
+                psu[ 2 ] = pb[ 2 ];
+                psu[ 3 ] = pb[ 3 ];
+                psu += 4;
+                pb  += 4;
+                continue;
+            }
+        }
+        *psu++ = pTable->asuToUcs[ *pb++ ];
+    }
+    *psu = 0;
+    return ( psu - psuBuf );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * SbcsFromUcs                                                               *
+ *                                                                           *
+ * Converts UTF-16 text to a single-byte codepage using its tables, as far   *
+ * as it will fit in the buffer.  A surrogate pair becomes one substitution  *
+ * character.  Runs of ASCII are handled two characters at a time where the  *
+ * codepage allows (except for U+001A, which is always looked up).           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PSBCS_TABLE pTable : The codepage's conversion tables.                  *
+ *   UniChar **ppsuText : The text to convert; advanced past what was done.  *
+ *   PCHAR pchBuf       : The output buffer.                                 *
+ *   ULONG cbBuf        : Size of the output buffer (including the NUL).     *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes converted (not counting the terminating NUL).           *
+ * ------------------------------------------------------------------------- */
+ULONG SbcsFromUcs( PSBCS_TABLE pTable, UniChar **ppsuText, PCHAR pchBuf, ULONG cbBuf )
+{
+    UniChar *psu = *ppsuText,
+            uniC;
+    PUCHAR  pb, pbEnd;
+    ULONG   ul;
+
+    if ( ! cbBuf ) return ( 0 );
+    pb    = (PUCHAR) pchBuf;
+    pbEnd = pb + cbBuf - 1;
+    while (( pb < pbEnd ) && (( uniC = *psu ) != 0 )) {
+        // (an aligned word never crosses the end of the string's memory)
+        if ( pTable->fAscii && ((( ULONG ) psu & 3 ) == 0 ) && ( pb + 2 <= pbEnd )) {
+            ul = *((PULONG) psu );
+            if ((( ul & 0xFF80FF80 ) == 0 ) && ( ul >> 16 ) &&
+                (( ul >> 16 ) != 0x1A ) && ( uniC != 0x1A )) {
+                pb[ 0 ] = (UCHAR) uniC;
+                pb[ 1 ] = (UCHAR)( ul >> 16 );
+                pb  += 2;
+                psu += 2;
+                continue;
+            }
+        }
+        if ( IS_HIGH_SURROGATE( uniC ) && IS_LOW_SURROGATE( psu[ 1 ] )) {
+            uniC = 0xFFFD;
+            psu++;
+        }
+        *pb++ = pTable->apbFromUcs[ uniC >> 8 ][ uniC & 0xFF ];
+        psu++;
+    }
+    *pb = '\0';
+    *ppsuText = psu;
+    return ( pb - (PUCHAR) pchBuf );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8ToUcs                                                                 *
+ *                                                                           *
+ * Converts UTF-8 text into UTF-16.  Characters outside the BMP become       *
+ * surrogate pairs; malformed sequences (including overlong forms, encoded   *
+ * surrogates and values above U+10FFFF) become U+FFFD, one per bad byte.    *
+ * Runs of ASCII are copied without decoding.                                *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCHAR pchText   : The UTF-8 text.                                       *
+ *   ULONG ulLength  : Length of pchText in bytes.                           *
+ *   UniChar *psuBuf : The output buffer, or NULL just to count.             *
+ *   ULONG ulBufLen  : Size of the output buffer in UniChars (incl. NUL).    *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of UniChars produced (or needed), not counting the NUL.          *
+ * ------------------------------------------------------------------------- */
+ULONG Utf8ToUcs( PCHAR pchText, ULONG ulLength, UniChar *psuBuf, ULONG ulBufLen )
+{
+    PUCHAR pch    = (PUCHAR) pchText,   // read pointer
+           pchEnd = pch + ulLength;     // end of input
+    ULONG  ulChars = 0,                 // UniChars produced
+           ulMax,                       // UniChars that will fit
+           ulCode,                      // decoded code point
+           ulMin;                       // smallest value for the sequence length
+    int    iTrail,                      // number of trailing bytes
+           i;
+
+
+    ulMax = psuBuf ? ulBufLen - 1 : 0xFFFFFFFF;
+
+    while (( pch < pchEnd ) && ( ulChars < ulMax )) {
+
+        // ASCII fast path
+        if ( *pch < 0x80 ) {
+            if ( psuBuf ) psuBuf[ ulChars ] = *pch;
+            ulChars++;
+            pch++;
+            continue;
+        }
+
+        if      (( *pch & 0xE0 ) == 0xC0 ) { iTrail = 1; ulCode = *pch & 0x1F; ulMin = 0x80;    }
+        else if (( *pch & 0xF0 ) == 0xE0 ) { iTrail = 2; ulCode = *pch & 0x0F; ulMin = 0x800;   }
+        else if (( *pch & 0xF8 ) == 0xF0 ) { iTrail = 3; ulCode = *pch & 0x07; ulMin = 0x10000; }
+        else iTrail = -1;
+
+        if (( iTrail > 0 ) && ( pch + iTrail < pchEnd )) {
+            for ( i = 1; i <= iTrail; i++ ) {
+                if (( pch[ i ] & 0xC0 ) != 0x80 ) break;
+                ulCode = ( ulCode << 6 ) | ( pch[ i ] & 0x3F );
+            }
+            if (( i > iTrail ) && ( ulCode >= ulMin ) && ( ulCode <= 0x10FFFF ) &&
+                (( ulCode < 0xD800 ) || ( ulCode > 0xDFFF )))
+            {
+                if ( ulCode >= 0x10000 ) {
+                    if ( ulChars + 2 > ulMax ) break;
+                    if ( psuBuf ) {
+                        psuBuf[ ulChars ]     = (UniChar)( 0xD800 + (( ulCode - 0x10000 ) >> 10 ));
+                        psuBuf[ ulChars + 1 ] = (UniChar)( 0xDC00 + (( ulCode - 0x10000 ) & 0x3FF ));
+                    }
+                    ulChars += 2;
+                } else {
+                    if ( psuBuf ) psuBuf[ ulChars ] = (UniChar) ulCode;
+                    ulChars++;
+                }
+                pch += iTrail + 1;
+                continue;
+            }
+        }
+
+        // Malformed: substitute for this byte and resynchronize
+        if ( psuBuf ) psuBuf[ ulChars ] = 0xFFFD;
+        ulChars++;
+        pch++;
+    }
+
+    if ( psuBuf ) psuBuf[ ulChars ] = 0;
+    return ( ulChars );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UcsToUtf8                                                                 *
+ *                                                                           *
+ * Converts UTF-16 text into UTF-8, stopping at the end of the string or     *
+ * when the output buffer is full; surrogate pairs are never split.  Any     *
+ * unpaired surrogate becomes U+FFFD.  The output is NUL-terminated.         *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   UniChar **ppsuText: The UTF-16 text; this is advanced past whatever     *
+ *                       was converted.                                      *
+ *   PCHAR pchBuf      : The output buffer, or NULL just to count.           *
+ *   ULONG cbBuf       : Size of the output buffer (including the NUL).      *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes produced (or needed), not counting the NUL.             *
+ * ------------------------------------------------------------------------- */
+ULONG UcsToUtf8( UniChar **ppsuText, PCHAR pchBuf, ULONG cbBuf )
+{
+    UniChar *psu = *ppsuText;           // read pointer
+    PUCHAR  pch  = (PUCHAR) pchBuf;     // write pointer
+    ULONG   ulLen = 0,                  // bytes produced
+            ulMax,                      // bytes that will fit
+            ulCode;                     // current code point
+    int     iBytes,                     // length of the current sequence
+            iPair;                      // UniChars used by the current character
+
+
+    ulMax = pchBuf ? cbBuf - 1 : 0xFFFFFFFF;
+
+    while ( *psu ) {
+
+        // ASCII fast path
+        if ( *psu < 0x80 ) {
+            if ( ulLen >= ulMax ) break;
+            if ( pch ) *pch++ = (UCHAR) *psu;
+            ulLen++;
+            psu++;
+            continue;
+        }
+
+        iPair  = 1;
+        ulCode = *psu;
+        if ( IS_HIGH_SURROGATE( ulCode ) && IS_LOW_SURROGATE( psu[ 1 ] )) {
+            ulCode = 0x10000 + (( ulCode - 0xD800 ) << 10 ) + ( psu[ 1 ] - 0xDC00 );
+            iPair  = 2;
+        }
+        else if ( IS_HIGH_SURROGATE( ulCode ) || IS_LOW_SURROGATE( ulCode ))
+            ulCode = 0xFFFD;
+
+        iBytes = ( ulCode < 0x800 ) ? 2 : ( ulCode < 0x10000 ) ? 3 : 4;
+        if ( ulLen + iBytes > ulMax ) break;
+        if ( pch ) switch ( iBytes ) {
+            case 2:
+                *pch++ = (UCHAR)( 0xC0 | ( ulCode >> 6 ));
+                *pch++ = (UCHAR)( 0x80 | ( ulCode & 0x3F ));
+                break;
+            case 3:
+                *pch++ = (UCHAR)( 0xE0 | ( ulCode >> 12 ));
+                *pch++ = (UCHAR)( 0x80 | (( ulCode >> 6 ) & 0x3F ));
+                *pch++ = (UCHAR)( 0x80 | ( ulCode & 0x3F ));
+                break;
+            case 4:
+                *pch++ = (UCHAR)( 0xF0 | ( ulCode >> 18 ));
+                *pch++ = (UCHAR)( 0x80 | (( ulCode >> 12 ) & 0x3F ));
+                *pch++ = (UCHAR)( 0x80 | (( ulCode >> 6 ) & 0x3F ));
+                *pch++ = (UCHAR)( 0x80 | ( ulCode & 0x3F ));
+                break;
+        }
+        ulLen += iBytes;
+        psu   += iPair;
+    }
+
+    if ( pch ) *pch = '\0';
+    *ppsuText = psu;
+    return ( ulLen );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * HashText                                                                  *
+ *                                                                           *
+ * Calculates a 32-bit hash of a block of text (or any other data), used to  *
+ * recognize clipboard contents that have been seen before.  This is FNV-1a  *
+ * applied four bytes at a time, so it is much quicker than any conversion.  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PVOID pvText: The text.                                                 *
+ *   ULONG cb    : Its length in bytes.                                      *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The hash value.                                                         *
+ * ------------------------------------------------------------------------- */
+ULONG HashText( PVOID pvText, ULONG cb )
+{
+    PUCHAR pb = (PUCHAR) pvText;        // read pointer
+    ULONG  ulHash = 2166136261UL;       // FNV offset basis
+
+
+    for ( ; cb >= 4; cb -= 4, pb += 4 )
+        ulHash = ( ulHash ^ ( pb[0] | ( pb[1] << 8 ) | ( pb[2] << 16 ) | ( (ULONG) pb[3] << 24 ))) * 16777619UL;
+    for ( ; cb; cb--, pb++ )
+        ulHash = ( ulHash ^ *pb ) * 16777619UL;
+    return ( ulHash );
+}
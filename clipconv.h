@@ -0,0 +1,117 @@
+/*****************************************************************************
+ * clipconv.h                                                                *
+ *                                                                           *
+ * Declarations for the clipboard text conversion routines (clipconv.c).     *
+ * These do not depend on Presentation Manager; os2.h and uconv.h must be    *
+ * included before this file.                                                *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPCONV_H
+#define CLIPCONV_H
+
+
+// CONSTANTS
+//
+#define MAX_CP_NAME     12      // maximum length of a codepage name
+#define MAX_CP_SPEC     64      // maximum length of a UconvObject codepage specifier
+#define MAX_UCONV_CACHE 4       // number of conversion objects kept in the cache
+#define MAX_FIXUPS      8       // maximum number of fixups applied in one pass
+#define STREAM_CHARS    32768   // maximum UCS-2 characters converted per chunk
+#define COUNT_CHARS     1024    // size of the scratch buffer for counting UniChars
+#define MAX_SBCS_TABLES 8       // maximum number of codepages with conversion tables
+
+#define UCONV_MAP_OPTIONS   L"@map=cdra,path=no"    // conversion modifiers
+
+#define CP_UTF8         1208    // codepage number of UTF-8
+
+// Clipboard text formats (as flags, so that sets of them can be described)
+#define CCF_TEXT        0x0001  // plain text in the local codepage (CF_TEXT)
+#define CCF_UNICODE     0x0002  // UTF-16 text ("text/unicode")
+#define CCF_UTF8        0x0004  // UTF-8 text ("text/plain;charset=utf-8")
+
+
+// MACROS
+//
+#define IS_HIGH_SURROGATE( c )  ((( c ) >= 0xD800 ) && (( c ) <= 0xDBFF ))
+#define IS_LOW_SURROGATE( c )   ((( c ) >= 0xDC00 ) && (( c ) <= 0xDFFF ))
+
+
+// TYPES
+//
+typedef struct _UCONV_ENTRY {
+    ULONG       ulCP;                       // codepage of this entry (0 = unused)
+    UniChar     suSpec[ MAX_CP_SPEC ];      // full specifier, including modifiers
+    UconvObject uconv;                      // the conversion object
+    ULONG       ulLastUse;                  // lookup sequence number (for LRU)
+} UCONV_ENTRY, *PUCONV_ENTRY;
+
+typedef struct _UCS_FIXUP {
+    ULONG       ulCP;                       // codepage affected (0 = all)
+    UniChar     uniFrom;                    // UCS-2 character to replace...
+    UniChar     uniTo;                      // ...and its replacement
+} UCS_FIXUP, *PUCS_FIXUP;
+
+typedef struct _TEXT_FIXUP {
+    ULONG       ulCP;                       // codepage affected (0 = all)
+    UCHAR       chFrom;                     // codepage byte to replace...
+    UCHAR       chTo;                       // ...and its replacement
+} TEXT_FIXUP, *PTEXT_FIXUP;
+
+typedef struct _SBCS_TABLE {
+    UniChar     asuToUcs[ 256 ];            // UCS-2 character for each byte
+    PUCHAR      apbFromUcs[ 256 ];          // byte for each UCS-2 character, by high byte
+    BOOL        fAscii;                     // bytes 0-0x7F (but 0x1A) are the same as U+0000-007F
+} SBCS_TABLE, *PSBCS_TABLE;
+
+typedef struct _SBCS_ENTRY {
+    ULONG       ulCP;                       // codepage of this entry (0 = unused)
+    PSBCS_TABLE pTable;                     // its tables (NULL = not a SBCS codepage)
+} SBCS_ENTRY, *PSBCS_ENTRY;
+
+typedef struct _CONV_STREAM {
+    ULONG       ulCP;                           // codepage being converted to
+    UconvObject uconv;                          // conversion object
+    BOOL        fPrivate;                       // uconv belongs to this stream
+    PSBCS_TABLE pTable;                         // conversion tables (if SBCS)
+    UniChar     *psuNext;                       // next source character to convert
+    UniChar     asuWork[ STREAM_CHARS + 1 ];    // fixed-up copy of the current slice
+} CONV_STREAM, *PCONV_STREAM;
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG GetUconvObject( ULONG ulCP, UconvObject *puconv );
+ULONG CreateUconvObject( ULONG ulCP, UconvObject *puconv );
+void  FreeUconvCache( void );
+void  QueryTextXlate( PUCHAR pbXlate, ULONG ulCP );
+ULONG FixupUcsText( UniChar *psuText, ULONG ulCP );
+ULONG FixupLocalText( PSZ pszText, ULONG ulCP );
+ULONG ConvertFromUcs( ULONG ulCP, UniChar *psuText, PSZ *ppszText, PULONG pulLength, PSZ *ppszFailed );
+ULONG ConvertToUcs( ULONG ulCP, PSZ pszText, ULONG ulLength, UniChar **ppsuText, PSZ *ppszFailed );
+ULONG ConvertToUcsBuf( ULONG ulCP, PSZ pszText, UniChar *psuBuf, ULONG ulBufLen, PSZ *ppszFailed );
+ULONG QueryUcsLength( ULONG ulCP, PSZ pszText, ULONG ulLength, PULONG pulChars, PSZ *ppszFailed );
+ULONG ChunkBoundary( ULONG ulCP, PCHAR pchText, ULONG cbText );
+ULONG QueryPasteFormat( ULONG flAvailable, ULONG ulCP );
+ULONG StreamFromUcsOpen( PCONV_STREAM pStream, ULONG ulCP, UniChar *psuText, BOOL fPrivate, PSZ *ppszFailed );
+ULONG StreamFromUcs( PCONV_STREAM pStream, PCHAR pchBuf, ULONG cbBuf, PULONG pulLength, PSZ *ppszFailed );
+void  StreamFromUcsClose( PCONV_STREAM pStream );
+ULONG CollapseSurrogates( UniChar *psuText );
+PSBCS_TABLE GetSbcsTable( ULONG ulCP, BOOL fCreate );
+PSBCS_TABLE CreateSbcsTable( ULONG ulCP );
+void  FreeSbcsTables( void );
+ULONG SbcsToUcs( PSBCS_TABLE pTable, PSZ pszText, UniChar *psuBuf, ULONG ulBufLen );
+ULONG SbcsFromUcs( PSBCS_TABLE pTable, UniChar **ppsuText, PCHAR pchBuf, ULONG cbBuf );
+ULONG Utf8ToUcs( PCHAR pchText, ULONG ulLength, UniChar *psuBuf, ULONG ulBufLen );
+ULONG UcsToUtf8( UniChar **ppsuText, PCHAR pchBuf, ULONG cbBuf );
+ULONG HashText( PVOID pvText, ULONG cb );
+
+
+// GLOBAL VARIABLES
+//
+extern ULONG ulUconvHits,       // conversion object lookups satisfied from the cache
+             ulUconvMisses;     // conversion object lookups that created a new object
+
+
+#endif
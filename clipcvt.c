@@ -0,0 +1,548 @@
+/*****************************************************************************
+ * clipcvt.c                                                                 *
+ *                                                                           *
+ * CLIPCVT is a command-line companion to CLIPUNI.  It converts text files   *
+ * between a codepage, UCS-2/UTF-16 ("text/unicode") and UTF-8, using the    *
+ * same conversion routines and fixups (clipconv.c) as the clipboard.        *
+ *                                                                           *
+ *   clipcvt -f <from> -t <to> [-j <threads>] [-s <suffix>] [file ...]       *
+ *                                                                           *
+ * <from> and <to> are codepage numbers, "unicode" or "utf8".  Each file is  *
+ * converted into a new file with the suffix added to its name (".cvt" by    *
+ * default); with no files, standard input is converted to standard          *
+ * output.  Between table-driven codepages, files are converted in parallel  *
+ * by a pool of threads; otherwise they are converted one at a time, with    *
+ * the threads dividing up each file.  The throughput for each file is       *
+ * reported on standard error.                                               *
+ *                                                                           *
+ * Where the system can map files into memory (CVT_MMAP, set by the POSIX    *
+ * build), input files are mapped rather than read.                          *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#define INCL_DOSMISC
+#define INCL_DOSPROCESS
+#define INCL_DOSPROFILE
+#define INCL_DOSSEMAPHORES
+#include <os2.h>
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uconv.h>
+#include "clipconv.h"
+#include "clippar.h"
+#ifdef CVT_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+// CONSTANTS
+//
+#define CVT_UNICODE     0           // "codepage" value used for UCS-2/UTF-16
+#define MAX_THREADS     16          // maximum size of the thread pool
+#define CVT_STACK       65536       // stack size of each conversion thread
+#define READ_CHUNK      65536       // bytes read from standard input at a time
+#define DEFAULT_SUFFIX  ".cvt"      // added to the name of each output file
+
+
+// TYPES
+//
+typedef struct _CVT_FILE {
+    PSZ         pszName;                    // name of the input file
+    ULONG       cbIn,                       // bytes read
+                cbOut;                      // bytes written
+    ULONG       ulUsec;                     // time taken (usec)
+    ULONG       ulRC;                       // result (0 = success)
+    PSZ         pszFailed;                  // name of failed function (if any)
+} CVT_FILE, *PCVT_FILE;
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG ParseCodepage( PSZ pszArg );
+PCHAR ReadInput( FILE *pf, PULONG pcbIn );
+#ifdef CVT_MMAP
+PCHAR MapInput( PSZ pszName, PULONG pcbIn );
+#endif
+ULONG ConvertBuffer( PCHAR pchIn, ULONG cbIn, PCHAR *ppchOut, PULONG pcbOut, PSZ *ppszFailed );
+void  ConvertFile( PCVT_FILE pFile );
+void  ConvertThread( void *pArg );
+void  ReportFile( PCVT_FILE pFile );
+ULONG QueryUsec( PQWORD pqwStart );
+void  Usage( void );
+
+
+// GLOBAL VARIABLES
+//
+ULONG     ulFromCP   = (ULONG) -1,      // codepage being converted from
+          ulToCP     = (ULONG) -1,      // codepage being converted to
+          ulFiles    = 0,               // number of files to convert
+          ulNextFile = 0,               // next file to be converted
+          ulSegments = 1,               // threads to divide each text between
+          ulCvtFreq  = 0;               // timer frequency (ticks per second)
+PCVT_FILE aFiles     = NULL;            // the files to convert
+PSZ       pszSuffix  = DEFAULT_SUFFIX;  // suffix for output file names
+HMTX      hmtxFiles;                    // protects ulNextFile
+
+
+/* ------------------------------------------------------------------------- *
+ * Main program.                                                             *
+ * ------------------------------------------------------------------------- */
+int main( int argc, char *argv[] )
+{
+    CVT_FILE cfStdin;                   // standard input, as a "file"
+    PCHAR    pchIn,                     // text read from standard input
+             pchOut;                    // converted text
+    QWORD    qwStart;                   // timer value at start
+    TID      atid[ MAX_THREADS ];       // the conversion threads
+    ULONG    ulThreads = 0,             // total number of threads to use
+             ulPool,                    // size of the thread pool
+             ulTotalIn = 0,             // total bytes read
+             ulTotalOut = 0,            // total bytes written
+             ulFailed = 0,              // number of files that failed
+             ulStarted,                 // number of threads started
+             i;
+    int      iArg,
+             iTid;
+
+
+    for ( iArg = 1; ( iArg < argc ) && ( argv[ iArg ][ 0 ] == '-' ); iArg++ ) {
+        if ( iArg + 1 >= argc ) Usage();
+        switch ( argv[ iArg ][ 1 ] ) {
+            case 'f': ulFromCP  = ParseCodepage( argv[ ++iArg ] );      break;
+            case 't': ulToCP    = ParseCodepage( argv[ ++iArg ] );      break;
+            case 'j': ulThreads = strtoul( argv[ ++iArg ], NULL, 10 );  break;
+            case 's': pszSuffix = argv[ ++iArg ];                       break;
+            default:  Usage();
+        }
+    }
+    if (( ulFromCP == (ULONG) -1 ) || ( ulToCP == (ULONG) -1 )) Usage();
+
+    DosTmrQueryFreq( &ulCvtFreq );
+    if ( ! ulThreads ) ulThreads = QueryParallelThreads();
+    ulThreads = min( ulThreads, MAX_THREADS );
+
+    // Standard input to standard output (divided between all the threads)
+    if ( iArg >= argc ) {
+        ulSegments = ulThreads;
+        memset( &cfStdin, 0, sizeof(cfStdin) );
+        cfStdin.pszName = "(stdin)";
+        DosTmrQueryTime( &qwStart );
+        setmode( fileno( stdin ), O_BINARY );
+        setmode( fileno( stdout ), O_BINARY );
+        if (( pchIn = ReadInput( stdin, &(cfStdin.cbIn) )) == NULL ) {
+            cfStdin.ulRC      = ULS_NOMEMORY;
+            cfStdin.pszFailed = "malloc()";
+        }
+        else {
+            cfStdin.ulRC = ConvertBuffer( pchIn, cfStdin.cbIn, &pchOut, &(cfStdin.cbOut),
+                                          &(cfStdin.pszFailed) );
+            if ( cfStdin.ulRC == ULS_SUCCESS ) {
+                fwrite( pchOut, 1, cfStdin.cbOut, stdout );
+                free( pchOut );
+            }
+            free( pchIn );
+        }
+        cfStdin.ulUsec = QueryUsec( &qwStart );
+        ReportFile( &cfStdin );
+        return ( cfStdin.ulRC ? 1 : 0 );
+    }
+
+    // Set up the list of files
+    ulFiles = argc - iArg;
+    if (( aFiles = (PCVT_FILE) calloc( ulFiles, sizeof(CVT_FILE) )) == NULL ) {
+        fprintf( stderr, "Not enough memory.\n");
+        return ( 1 );
+    }
+    for ( i = 0; i < ulFiles; i++ ) aFiles[ i ].pszName = argv[ iArg + i ];
+
+    // The conversion object cache may only be used by one thread at a time,
+    // so only table-driven conversions can be done in parallel.  (Creating
+    // the tables here also means the threads never have to.)  Any threads
+    // not needed for whole files are used to divide up each file's text.
+    ulPool = max( 1, min( ulThreads, ulFiles ));
+    if ((( ulFromCP != CVT_UNICODE ) && ( ulFromCP != CP_UTF8 ) && ! GetSbcsTable( ulFromCP, TRUE )) ||
+        (( ulToCP != CVT_UNICODE ) && ( ulToCP != CP_UTF8 ) && ! GetSbcsTable( ulToCP, TRUE )))
+        ulPool = 1;
+    ulSegments = max( 1, ulThreads / ulPool );
+
+    // Convert the files, then wait for all the threads to finish
+    DosTmrQueryTime( &qwStart );
+    DosCreateMutexSem( NULL, &hmtxFiles, 0, FALSE );
+    for ( ulStarted = 0; ulStarted < ulPool; ulStarted++ ) {
+        if (( iTid = _beginthread( ConvertThread, NULL, CVT_STACK, NULL )) == -1 ) break;
+        atid[ ulStarted ] = (TID) iTid;
+    }
+    if ( ! ulStarted ) ConvertThread( NULL );
+    for ( i = 0; i < ulStarted; i++ ) DosWaitThread( &atid[ i ], DCWW_WAIT );
+    DosCloseMutexSem( hmtxFiles );
+
+    for ( i = 0; i < ulFiles; i++ ) {
+        ReportFile( &aFiles[ i ] );
+        ulTotalIn  += aFiles[ i ].cbIn;
+        ulTotalOut += aFiles[ i ].cbOut;
+        if ( aFiles[ i ].ulRC ) ulFailed++;
+    }
+    fprintf( stderr, "%u file(s), %u failed, %u -> %u bytes in %u ms using %u x %u thread(s)\n",
+             ulFiles, ulFailed, ulTotalIn, ulTotalOut, QueryUsec( &qwStart ) / 1000,
+             max( ulStarted, 1 ), ulSegments );
+
+    FreeUconvCache();
+    FreeSbcsTables();
+    free( aFiles );
+    return ( ulFailed ? 1 : 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ParseCodepage                                                             *
+ *                                                                           *
+ * Interprets a codepage argument: a number, "utf8" or "unicode".            *
+ * ------------------------------------------------------------------------- */
+ULONG ParseCodepage( PSZ pszArg )
+{
+    ULONG ulCP;
+
+    if ( stricmp( pszArg, "unicode") == 0 ) return ( CVT_UNICODE );
+    if ( stricmp( pszArg, "utf8") == 0 )    return ( CP_UTF8 );
+    if (( ulCP = strtoul( pszArg, NULL, 10 )) == 0 ) Usage();
+    return ( ulCP );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ReadInput                                                                 *
+ *                                                                           *
+ * Reads all of a (binary mode) file into memory.  The text is followed by   *
+ * two NUL bytes, so that it is terminated whether it is UCS-2 or not.       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   FILE *pf     : The file to read.                                        *
+ *   PULONG pcbIn : Receives the number of bytes read.                       *
+ *                                                                           *
+ * RETURNS: PCHAR                                                            *
+ *   The text (to be freed by the caller), or NULL if out of memory.         *
+ * ------------------------------------------------------------------------- */
+PCHAR ReadInput( FILE *pf, PULONG pcbIn )
+{
+    PCHAR pchText,                      // the text
+          pchNew;                       // reallocated text
+    ULONG cbBuf,                        // size of the buffer
+          cbRead;                       // bytes read by the last call
+    long  lSize;                        // size of the file (if known)
+
+
+    *pcbIn = 0;
+
+    // Read a file of known size in one go; otherwise, a chunk at a time
+    if (( fseek( pf, 0, SEEK_END ) == 0 ) && (( lSize = ftell( pf )) >= 0 )) {
+        fseek( pf, 0, SEEK_SET );
+        cbBuf = lSize + 2;
+    }
+    else
+        cbBuf = READ_CHUNK + 2;
+    if (( pchText = (PCHAR) malloc( cbBuf )) == NULL ) return ( NULL );
+
+    while (( cbRead = fread( pchText + *pcbIn, 1, cbBuf - 2 - *pcbIn, pf )) > 0 ) {
+        *pcbIn += cbRead;
+        if ( *pcbIn < cbBuf - 2 ) continue;
+        if (( pchNew = (PCHAR) realloc( pchText, cbBuf + READ_CHUNK )) == NULL ) {
+            free( pchText );
+            return ( NULL );
+        }
+        pchText = pchNew;
+        cbBuf  += READ_CHUNK;
+    }
+    pchText[ *pcbIn ]     = '\0';
+    pchText[ *pcbIn + 1 ] = '\0';
+    return ( pchText );
+}
+
+
+#ifdef CVT_MMAP
+/* ------------------------------------------------------------------------- *
+ * MapInput                                                                  *
+ *                                                                           *
+ * Maps a file into memory, in place of ReadInput.  The mapping is private,  *
+ * so the text can be changed as it is converted (see ParallelOpen) without  *
+ * touching the file.  The two NUL bytes that follow the text must fit in    *
+ * the rest of its last page (which the system fills with zeros), since any  *
+ * page beyond the end of the file cannot be used.                           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PSZ pszName  : The name of the file.                                    *
+ *   PULONG pcbIn : Receives the size of the file in bytes.                  *
+ *                                                                           *
+ * RETURNS: PCHAR                                                            *
+ *   The text (to be unmapped by the caller), or NULL if the file cannot be  *
+ *   mapped this way, and must be read instead.                              *
+ * ------------------------------------------------------------------------- */
+PCHAR MapInput( PSZ pszName, PULONG pcbIn )
+{
+    struct stat st;                     // file information
+    PCHAR       pchText = NULL;         // the text
+    long        lPage;                  // size of a memory page
+    int         fd;                     // the open file
+
+
+    if (( fd = open( pszName, O_RDONLY )) == -1 ) return ( NULL );
+    lPage = sysconf( _SC_PAGESIZE );
+    if (( fstat( fd, &st ) == 0 ) && S_ISREG( st.st_mode ) && ( st.st_size < 0xFFFFFFF0 ) &&
+        ( lPage > 2 ) && ( st.st_size % lPage ) && ( st.st_size % lPage <= lPage - 2 ))
+    {
+        pchText = (PCHAR) mmap( NULL, st.st_size + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+        if ( pchText == (PCHAR) MAP_FAILED )
+            pchText = NULL;
+        else {
+            *pcbIn = st.st_size;
+            pchText[ *pcbIn ]     = '\0';
+            pchText[ *pcbIn + 1 ] = '\0';
+        }
+    }
+    close( fd );
+    return ( pchText );
+}
+#endif
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertBuffer                                                             *
+ *                                                                           *
+ * Converts text from ulFromCP to ulToCP, by way of UCS-2, exactly as the    *
+ * clipboard text would be.  A large text is divided between ulSegments      *
+ * threads (see clippar.c).  A leading byte order mark is dropped from UCS-2 *
+ * input, which is byte-swapped first if the mark shows it to be in the      *
+ * other byte order; other input ends at the first NUL, as clipboard text    *
+ * does.                                                                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCHAR pchIn      : The text to convert (see ReadInput).                 *
+ *   ULONG cbIn       : Length of the text in bytes.                         *
+ *   PCHAR *ppchOut   : Receives the converted text (to be freed).           *
+ *   PULONG pcbOut    : Receives the length of the converted text.           *
+ *   PSZ *ppszFailed  : Receives the name of the failing function.           *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG ConvertBuffer( PCHAR pchIn, ULONG cbIn, PCHAR *ppchOut, PULONG pcbOut, PSZ *ppszFailed )
+{
+    PAR_CONVERT pc;                     // conversion state
+    UniChar     *psuText = NULL,        // the text as UCS-2
+                *puniC;                 // pointer into psuText
+    ULONG       ulChars,                // length of psuText
+                ulRC;                   // return code
+    BOOL        fOwnText = FALSE;       // psuText must be freed
+
+
+    *ppchOut = NULL;
+    *pcbOut  = 0;
+
+    if ( ulFromCP == CVT_UNICODE ) {
+        psuText = (UniChar *) pchIn;
+        psuText[ cbIn / sizeof(UniChar) ] = 0;
+        // Text with a reversed byte order mark is put into our byte order
+        if ( *psuText == 0xFFFE )
+            for ( puniC = psuText; *puniC; puniC++ )
+                *puniC = (UniChar)(( *puniC << 8 ) | ( *puniC >> 8 ));
+        if ( *psuText == 0xFEFF ) psuText++;
+        ulChars = UniStrlen( psuText );
+    }
+    else {
+        ulRC = ParallelOpen( &pc, ulFromCP, TRUE, pchIn, strlen( pchIn ), ulSegments, ppszFailed );
+        if ( ulRC == ULS_SUCCESS ) {
+            ulChars = pc.ulOutLength;
+            if (( psuText = (UniChar *) malloc(( ulChars + 1 ) * sizeof(UniChar) )) == NULL ) {
+                *ppszFailed = "malloc()";
+                ulRC = ULS_NOMEMORY;
+            }
+            else if (( ulRC = ParallelConvert( &pc, psuText, ppszFailed )) != ULS_SUCCESS )
+                free( psuText );
+        }
+        ParallelClose( &pc );
+        if ( ulRC != ULS_SUCCESS ) return ( ulRC );
+        fOwnText = TRUE;
+    }
+
+    if ( ulToCP == CVT_UNICODE ) {
+        if (( *ppchOut = (PCHAR) malloc( ulChars * sizeof(UniChar) + 1 )) != NULL ) {
+            memcpy( *ppchOut, psuText, ulChars * sizeof(UniChar) );
+            *pcbOut = ulChars * sizeof(UniChar);
+        }
+        else {
+            *ppszFailed = "malloc()";
+            ulRC = ULS_NOMEMORY;
+        }
+    }
+    else {
+        ulRC = ParallelOpen( &pc, ulToCP, FALSE, psuText, ulChars, ulSegments, ppszFailed );
+        if ( ulRC == ULS_SUCCESS ) {
+            if (( *ppchOut = (PCHAR) malloc( pc.ulOutLength + 1 )) == NULL ) {
+                *ppszFailed = "malloc()";
+                ulRC = ULS_NOMEMORY;
+            }
+            else if (( ulRC = ParallelConvert( &pc, *ppchOut, ppszFailed )) != ULS_SUCCESS ) {
+                free( *ppchOut );
+                *ppchOut = NULL;
+            }
+            else
+                *pcbOut = pc.ulOutLength;
+        }
+        ParallelClose( &pc );
+    }
+
+    if ( fOwnText ) free( psuText );
+    return ( ulRC );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertFile                                                               *
+ *                                                                           *
+ * Converts one file, writing the result to a file named with pszSuffix      *
+ * added, and records the outcome and time taken.                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCVT_FILE pFile: The file to convert.                                   *
+ * ------------------------------------------------------------------------- */
+void ConvertFile( PCVT_FILE pFile )
+{
+    QWORD qwStart;                      // timer value at start
+    FILE  *pf;                          // input or output file
+    PCHAR pchIn = NULL,                 // text read
+          pchOut;                       // converted text
+    PSZ   pszOutName;                   // name of the output file
+    BOOL  fMapped = FALSE;              // pchIn is mapped rather than read
+
+
+    DosTmrQueryTime( &qwStart );
+
+#ifdef CVT_MMAP
+    fMapped = (( pchIn = MapInput( pFile->pszName, &(pFile->cbIn) )) != NULL );
+#endif
+    if ( ! fMapped ) {
+        if (( pf = fopen( pFile->pszName, "rb")) == NULL ) {
+            pFile->pszFailed = "fopen()";
+            pFile->ulRC      = 1;
+            return;
+        }
+        pchIn = ReadInput( pf, &(pFile->cbIn) );
+        fclose( pf );
+        if ( pchIn == NULL ) {
+            pFile->pszFailed = "malloc()";
+            pFile->ulRC      = ULS_NOMEMORY;
+            return;
+        }
+    }
+
+    pFile->ulRC = ConvertBuffer( pchIn, pFile->cbIn, &pchOut, &(pFile->cbOut), &(pFile->pszFailed) );
+#ifdef CVT_MMAP
+    if ( fMapped ) munmap( pchIn, pFile->cbIn + 2 );
+    else
+#endif
+    free( pchIn );
+    if ( pFile->ulRC != ULS_SUCCESS ) return;
+
+    if (( pszOutName = (PSZ) malloc( strlen( pFile->pszName ) + strlen( pszSuffix ) + 1 )) != NULL ) {
+        strcpy( pszOutName, pFile->pszName );
+        strcat( pszOutName, pszSuffix );
+        if (( pf = fopen( pszOutName, "wb")) != NULL ) {
+            if ( fwrite( pchOut, 1, pFile->cbOut, pf ) != pFile->cbOut ) {
+                pFile->pszFailed = "fwrite()";
+                pFile->ulRC      = 1;
+            }
+            fclose( pf );
+        }
+        else {
+            pFile->pszFailed = "fopen()";
+            pFile->ulRC      = 1;
+        }
+        free( pszOutName );
+    }
+    else {
+        pFile->pszFailed = "malloc()";
+        pFile->ulRC      = ULS_NOMEMORY;
+    }
+    free( pchOut );
+
+    pFile->ulUsec = QueryUsec( &qwStart );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertThread                                                             *
+ *                                                                           *
+ * Conversion thread: converts files from the list until none are left.      *
+ * ------------------------------------------------------------------------- */
+void ConvertThread( void *pArg )
+{
+    ULONG i;
+
+    for ( ;; ) {
+        DosRequestMutexSem( hmtxFiles, SEM_INDEFINITE_WAIT );
+        i = ulNextFile++;
+        DosReleaseMutexSem( hmtxFiles );
+        if ( i >= ulFiles ) break;
+        ConvertFile( &aFiles[ i ] );
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ReportFile                                                                *
+ *                                                                           *
+ * Reports the outcome of converting a file on standard error.               *
+ * ------------------------------------------------------------------------- */
+void ReportFile( PCVT_FILE pFile )
+{
+    if ( pFile->ulRC ) {
+        fprintf( stderr, "%s: failed, %s = %08X\n", pFile->pszName, pFile->pszFailed, pFile->ulRC );
+        return;
+    }
+    fprintf( stderr, "%s: %u -> %u bytes, %u.%03u ms, %.2f MB/s\n", pFile->pszName,
+             pFile->cbIn, pFile->cbOut, pFile->ulUsec / 1000, pFile->ulUsec % 1000,
+             pFile->ulUsec ? ( pFile->cbIn / (double) pFile->ulUsec ) : 0.0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * QueryUsec                                                                 *
+ *                                                                           *
+ * Returns the number of microseconds elapsed since the given timer value.   *
+ * ------------------------------------------------------------------------- */
+ULONG QueryUsec( PQWORD pqwStart )
+{
+    QWORD  qwNow;
+    double dTicks;
+
+    if ( ! ulCvtFreq ) return ( 0 );
+    DosTmrQueryTime( &qwNow );
+    dTicks = ((double) qwNow.ulHi - pqwStart->ulHi ) * 4294967296.0 +
+             ((double) qwNow.ulLo - pqwStart->ulLo );
+    return (ULONG)( dTicks * 1000000.0 / ulCvtFreq );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Usage                                                                     *
+ *                                                                           *
+ * Shows the command syntax and exits.                                       *
+ * ------------------------------------------------------------------------- */
+void Usage( void )
+{
+    fprintf( stderr,
+             "Usage: clipcvt -f <from> -t <to> [-j <threads>] [-s <suffix>] [file ...]\n\n"
+             "  <from>, <to>  codepage number, \"unicode\" (UCS-2/UTF-16) or \"utf8\"\n"
+             "  -j <threads>  number of threads to use (default: one per CPU); files are\n"
+             "                converted at once only between table-driven codepages,\n"
+             "                otherwise the threads divide up each file in turn\n"
+             "  -s <suffix>   added to the name of each output file (default: %s)\n\n"
+             "With no files, standard input is converted to standard output.\n",
+             DEFAULT_SUFFIX );
+    exit( 1 );
+}
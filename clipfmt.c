@@ -0,0 +1,531 @@
+/*****************************************************************************
+ * clipfmt.c                                                                 *
+ *                                                                           *
+ * Clipboard format handling for CLIPUNI: choosing which format to paste,    *
+ * offering copied text in every format, and rendering it into a format on   *
+ * request.  The clipboard itself is reached only through a CLIP_BACKEND,    *
+ * so that the same code serves the PM clipboard (in clipuni.c) and the      *
+ * in-memory clipboard the tests and benchmarks use (clipmem.c).             *
+ *                                                                           *
+ * Rendered data is always converted straight into clipboard memory of       *
+ * exactly the right size; the size is measured first (see clippar.c).  Text *
+ * which is not in memory is read twice, a chunk at a time: once to measure  *
+ * it, and once to convert it.                                               *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#include <os2.h>
+#include <stdio.h>
+#include <string.h>
+#include <uconv.h>
+#include "cliparena.h"
+#include "clipconv.h"
+#include "clipfmt.h"
+#include "clippar.h"
+#include "cliptrace.h"
+
+
+// TYPES
+//
+
+// A CLIP_SOURCE being read a chunk at a time (see ReadChunk)
+typedef struct _CLIP_READER {
+    PCLIP_SOURCE pSource;                   // the text being read
+    ULONG       ulOffset;                   // bytes read from it so far
+    ULONG       cbHeld;                     // bytes in achChunk
+    ULONG       cbChunk;                    // bytes of whole characters in achChunk
+    CHAR        chSaved;                    // the byte replaced by the chunk's NUL
+    CHAR        achChunk[ CLIP_CHUNK + 1 ]; // the current chunk
+} CLIP_READER, *PCLIP_READER;
+
+
+// FUNCTION DECLARATIONS
+//
+BOOL RenderUnicode( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError );
+BOOL RenderUtf8( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError );
+BOOL RenderPlainText( PCLIP_BACKEND pBackend, ULONG flFormat, PCLIP_SOURCE pSource, PULONG pcbOut, PSZ pszError );
+BOOL StreamUnicode( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError );
+BOOL StreamUtf8( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError );
+PCLIP_READER OpenReader( PCLIP_SOURCE pSource, PARENA pArena );
+void RewindReader( PCLIP_READER pReader );
+BOOL ReadChunk( PCLIP_READER pReader );
+
+
+/* ------------------------------------------------------------------------- *
+ * ClipQueryText                                                             *
+ *                                                                           *
+ * Chooses the format to paste from the clipboard into the given codepage    *
+ * (see QueryPasteFormat), and returns the text in that format.  The         *
+ * clipboard must be open; the text belongs to it, and is only valid until   *
+ * the clipboard is closed.                                                  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCLIP_BACKEND pBackend: The clipboard.                                  *
+ *   ULONG ulCP            : The codepage being pasted into.                 *
+ *   PVOID *ppvText        : Receives the text (NULL if none).               *
+ *   PULONG pcbText        : Receives its size in bytes, including the NUL.  *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The format chosen (CCF_*), or 0 if there is no text on the clipboard.   *
+ * ------------------------------------------------------------------------- */
+ULONG ClipQueryText( PCLIP_BACKEND pBackend, ULONG ulCP, PVOID *ppvText, PULONG pcbText )
+{
+    ULONG ulFormat;                     // format chosen
+
+    *ppvText = NULL;
+    *pcbText = 0;
+
+    ulFormat = QueryPasteFormat( pBackend->pfnQueryFormats( pBackend ), ulCP );
+    if ( ! ulFormat ) return ( 0 );
+    if (( *ppvText = pBackend->pfnQueryData( pBackend, ulFormat )) == NULL ) return ( ulFormat );
+
+    if ( ulFormat == CCF_UNICODE )
+        *pcbText = ( UniStrlen( (UniChar *) *ppvText ) + 1 ) * sizeof(UniChar);
+    else
+        *pcbText = strlen( (PSZ) *ppvText ) + 1;
+    return ( ulFormat );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ClipOfferText                                                             *
+ *                                                                           *
+ * Offers text on the clipboard as Unicode, UTF-8 and plain text, to be      *
+ * rendered (see ClipRenderText) only when some program asks for it.  The    *
+ * clipboard must be open, and emptied by its new owner.                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCLIP_BACKEND pBackend: The clipboard.                                  *
+ *   PULONG pulUniError    : Receives the error offering Unicode text, or 0. *
+ *   PULONG pulTxtError    : Receives the error offering plain text, or 0.   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The formats offered (CCF_*).  A failure to offer UTF-8 is not reported, *
+ *   since that format is not essential.                                     *
+ * ------------------------------------------------------------------------- */
+ULONG ClipOfferText( PCLIP_BACKEND pBackend, PULONG pulUniError, PULONG pulTxtError )
+{
+    ULONG flOffered = 0;                // formats offered
+
+    *pulUniError = 0;
+    *pulTxtError = 0;
+
+    if ( pBackend->pfnSetData( pBackend, CCF_UNICODE, NULL ))
+        flOffered |= CCF_UNICODE;
+    else
+        *pulUniError = pBackend->pfnQueryError( pBackend );
+
+    if ( pBackend->pfnSetData( pBackend, CCF_UTF8, NULL ))
+        flOffered |= CCF_UTF8;
+
+    if ( pBackend->pfnSetData( pBackend, CCF_TEXT, NULL ))
+        flOffered |= CCF_TEXT;
+    else
+        *pulTxtError = pBackend->pfnQueryError( pBackend );
+
+    return ( flOffered );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ClipRenderText                                                            *
+ *                                                                           *
+ * Places copied text on the clipboard in the requested format.  The         *
+ * clipboard must already be open.  Nothing is shown if this fails: the      *
+ * message is returned instead, since the clipboard is usually being held    *
+ * open by another program at this point.                                    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCLIP_BACKEND pBackend: The clipboard.                                  *
+ *   ULONG flFormat        : The format to render (CCF_*).                   *
+ *   PCLIP_SOURCE pSource  : The copied text.                                *
+ *   PARENA pArena         : Arena for temporary buffers.                    *
+ *   PULONG pcbOut         : Receives the size of the data in bytes (not     *
+ *                           counting the NUL).                              *
+ *   PSZ pszError          : Receives the error message, if any (at least    *
+ *                           MAX_CLIP_ERROR bytes).                          *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the data was placed on the clipboard.                           *
+ * ------------------------------------------------------------------------- */
+BOOL ClipRenderText( PCLIP_BACKEND pBackend, ULONG flFormat, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError )
+{
+    *pcbOut     = 0;
+    *pszError   = '\0';
+
+    switch ( flFormat ) {
+        case CCF_UNICODE: return ( RenderUnicode( pBackend, pSource, pArena, pcbOut, pszError ));
+        case CCF_UTF8:    return ( RenderUtf8( pBackend, pSource, pArena, pcbOut, pszError ));
+        case CCF_TEXT:    return ( RenderPlainText( pBackend, CCF_TEXT, pSource, pcbOut, pszError ));
+    }
+    return ( FALSE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RenderUnicode                                                             *
+ *                                                                           *
+ * Renders copied text as UCS-2, converting it straight into the clipboard   *
+ * memory (a large text is divided up, to be converted on every processor).  *
+ * ------------------------------------------------------------------------- */
+BOOL RenderUnicode( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError )
+{
+    UniChar     *psuClipMem;            // Unicode text in clipboard
+    PAR_CONVERT pcUnicode;              // conversion to UCS-2
+    PSZ         pszFailed;              // name of failed function
+    ULONG       ulChars,                // length of Unicode text in UniChars
+                ulRC;                   // return code
+
+
+    if ( ! pSource->pszText )
+        return ( StreamUnicode( pBackend, pSource, pArena, pcbOut, pszError ));
+
+    // Find out exactly how big the UCS-2 string will be
+    if (( ulRC = ParallelOpen( &pcUnicode, pSource->ulCP, TRUE, pSource->pszText, pSource->ulLength,
+                               QueryParallelThreads(), &pszFailed )) != ULS_SUCCESS )
+    {
+        ParallelClose( &pcUnicode );
+        sprintf( pszError, "Error copying Unicode text:\n%s = %08X", pszFailed, ulRC );
+        return ( FALSE );
+    }
+    ulChars = pcUnicode.ulOutLength;
+
+    if (( ulRC = pBackend->pfnAllocData( pBackend, ( ulChars + 1 ) * sizeof(UniChar),
+                                         (PVOID *) &psuClipMem )) != 0 )
+    {
+        ParallelClose( &pcUnicode );
+        sprintf( pszError, "Error copying Unicode text: no clipboard memory for %u bytes.\nError code: 0x%X\n",
+                 (ULONG)(( ulChars + 1 ) * sizeof(UniChar)), ulRC );
+        return ( FALSE );
+    }
+    ulRC = ParallelConvert( &pcUnicode, psuClipMem, &pszFailed );
+    ParallelClose( &pcUnicode );
+    if ( ulRC != ULS_SUCCESS ) {
+        sprintf( pszError, "Error copying Unicode text:\n%s = %08X", pszFailed, ulRC );
+        pBackend->pfnFreeData( pBackend, psuClipMem );
+        return ( FALSE );
+    }
+
+    TraceStage( TST_OUTPUT );
+    if ( ! pBackend->pfnSetData( pBackend, CCF_UNICODE, psuClipMem )) {
+        sprintf( pszError, "Error copying Unicode text: the clipboard did not accept it.\nError code: 0x%X\n",
+                 pBackend->pfnQueryError( pBackend ));
+        pBackend->pfnFreeData( pBackend, psuClipMem );
+        return ( FALSE );
+    }
+    *pcbOut = ulChars * sizeof(UniChar);
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RenderUtf8                                                                *
+ *                                                                           *
+ * Renders copied text as UTF-8: via UTF-16 (in scratch memory from the      *
+ * arena), then straight into the clipboard memory.  Text copied in UTF-8    *
+ * itself is simply placed on the clipboard as it is.                        *
+ * ------------------------------------------------------------------------- */
+BOOL RenderUtf8( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError )
+{
+    UniChar     *psuCopyText = NULL,    // Unicode text to be copied as UTF-8
+                *psuNext;               // UTF-8 conversion pointer
+    PAR_CONVERT pcUnicode;              // conversion to UCS-2
+    PSZ         pszClipMem,             // UTF-8 text in clipboard
+                pszFailed;              // name of failed function
+    ULONG       ulBufLen,               // length of output buffer
+                ulRC;                   // return code
+
+
+    if ( pSource->ulCP == CP_UTF8 )
+        return ( RenderPlainText( pBackend, CCF_UTF8, pSource, pcbOut, pszError ));
+    if ( ! pSource->pszText )
+        return ( StreamUtf8( pBackend, pSource, pArena, pcbOut, pszError ));
+
+    ulRC = ParallelOpen( &pcUnicode, pSource->ulCP, TRUE, pSource->pszText, pSource->ulLength,
+                         QueryParallelThreads(), &pszFailed );
+    if ( ulRC == ULS_SUCCESS ) {
+        ulBufLen = ( pcUnicode.ulOutLength + 1 ) * sizeof(UniChar);
+        if (( psuCopyText = (UniChar *) ArenaAlloc( pArena, ulBufLen )) == NULL ) {
+            ParallelClose( &pcUnicode );
+            sprintf( pszError, "Error copying UTF-8 text: not enough memory for %u bytes.", ulBufLen );
+            return ( FALSE );
+        }
+        ulRC = ParallelConvert( &pcUnicode, psuCopyText, &pszFailed );
+    }
+    ParallelClose( &pcUnicode );
+    if ( ulRC != ULS_SUCCESS ) {
+        sprintf( pszError, "Error copying UTF-8 text:\n%s = %08X", pszFailed, ulRC );
+        return ( FALSE );
+    }
+
+    psuNext  = psuCopyText;
+    ulBufLen = UcsToUtf8( &psuNext, NULL, 0 ) + 1;
+    if (( ulRC = pBackend->pfnAllocData( pBackend, ulBufLen, (PVOID *) &pszClipMem )) != 0 ) {
+        sprintf( pszError, "Error copying UTF-8 text: no clipboard memory for %u bytes.\nError code: 0x%X\n",
+                 ulBufLen, ulRC );
+        return ( FALSE );
+    }
+    psuNext = psuCopyText;
+    UcsToUtf8( &psuNext, pszClipMem, ulBufLen );
+
+    TraceStage( TST_OUTPUT );
+    if ( ! pBackend->pfnSetData( pBackend, CCF_UTF8, pszClipMem )) {
+        sprintf( pszError, "Error copying UTF-8 text: the clipboard did not accept it.\nError code: 0x%X\n",
+                 pBackend->pfnQueryError( pBackend ));
+        pBackend->pfnFreeData( pBackend, pszClipMem );
+        return ( FALSE );
+    }
+    *pcbOut = ulBufLen - 1;
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RenderPlainText                                                           *
+ *                                                                           *
+ * Places copied text on the clipboard unconverted.  Used for plain text,    *
+ * and for UTF-8 when that is the codepage it was copied in.  Text which is  *
+ * not in memory is read straight into the clipboard memory.                 *
+ * ------------------------------------------------------------------------- */
+BOOL RenderPlainText( PCLIP_BACKEND pBackend, ULONG flFormat, PCLIP_SOURCE pSource, PULONG pcbOut, PSZ pszError )
+{
+    PSZ     pszClipMem;                 // plain text in clipboard
+    ULONG   ulLength,                   // length of the text placed there
+            cbRead,                     // bytes read at once
+            ulRC;                       // return code
+
+
+    TraceStage( TST_OUTPUT );
+    if (( ulRC = pBackend->pfnAllocData( pBackend, pSource->ulLength + 1, (PVOID *) &pszClipMem )) != 0 ) {
+        sprintf( pszError, "Error copying plain text: no clipboard memory for %u bytes.\nError code: 0x%X\n",
+                 pSource->ulLength + 1, ulRC );
+        return ( FALSE );
+    }
+
+    if ( pSource->pszText ) {
+        memcpy( pszClipMem, pSource->pszText, pSource->ulLength );
+        ulLength = pSource->ulLength;
+    }
+    else for ( ulLength = 0; ulLength < pSource->ulLength; ulLength += cbRead ) {
+        cbRead = pSource->pfnRead( pSource, ulLength, pszClipMem + ulLength, pSource->ulLength - ulLength );
+        if ( ! cbRead ) break;
+    }
+    pszClipMem[ ulLength ] = '\0';
+    if ( ! pBackend->pfnSetData( pBackend, flFormat, pszClipMem )) {
+        sprintf( pszError, "Error copying plain text: the clipboard did not accept it.\nError code: 0x%X\n",
+                 pBackend->pfnQueryError( pBackend ));
+        pBackend->pfnFreeData( pBackend, pszClipMem );
+        return ( FALSE );
+    }
+    *pcbOut = ulLength;
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * StreamUnicode                                                             *
+ *                                                                           *
+ * Renders copied text which is not in memory as UCS-2.  The text is read    *
+ * once to count the UniChars, then again to convert it a chunk at a time    *
+ * straight into clipboard memory of exactly that size.                      *
+ * ------------------------------------------------------------------------- */
+BOOL StreamUnicode( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError )
+{
+    PCLIP_READER pReader;               // chunks of the text
+    UniChar      *psuClipMem;           // Unicode text in clipboard
+    PSZ          pszFailed;             // name of failed function
+    ULONG        ulChars = 0,           // length of Unicode text in UniChars
+                 ulCount,               // UniChars in one chunk
+                 ulDone,                // UniChars converted so far
+                 ulRC = ULS_SUCCESS;    // return code
+
+
+    if (( pReader = OpenReader( pSource, pArena )) == NULL ) {
+        sprintf( pszError, "Error copying Unicode text: not enough memory for %u bytes.", (ULONG) sizeof(CLIP_READER) );
+        return ( FALSE );
+    }
+
+    // Find out exactly how big the UCS-2 string will be
+    while (( ulRC == ULS_SUCCESS ) && ReadChunk( pReader )) {
+        ulRC = QueryUcsLength( pSource->ulCP, pReader->achChunk, pReader->cbChunk, &ulCount, &pszFailed );
+        ulChars += ulCount;
+    }
+    if ( ulRC != ULS_SUCCESS ) {
+        sprintf( pszError, "Error copying Unicode text:\n%s = %08X", pszFailed, ulRC );
+        return ( FALSE );
+    }
+
+    if (( ulRC = pBackend->pfnAllocData( pBackend, ( ulChars + 1 ) * sizeof(UniChar),
+                                         (PVOID *) &psuClipMem )) != 0 )
+    {
+        sprintf( pszError, "Error copying Unicode text: no clipboard memory for %u bytes.\nError code: 0x%X\n",
+                 (ULONG)(( ulChars + 1 ) * sizeof(UniChar)), ulRC );
+        return ( FALSE );
+    }
+
+    // Convert each chunk into place (each one ends with a NUL, which the next
+    // one overwrites)
+    RewindReader( pReader );
+    psuClipMem[ 0 ] = 0;
+    for ( ulDone = 0; ( ulDone < ulChars ) && ReadChunk( pReader ); ulDone += UniStrlen( psuClipMem + ulDone )) {
+        ulRC = ConvertToUcsBuf( pSource->ulCP, pReader->achChunk, psuClipMem + ulDone,
+                                ulChars - ulDone + 1, &pszFailed );
+        if ( ulRC != ULS_SUCCESS ) {
+            sprintf( pszError, "Error copying Unicode text:\n%s = %08X", pszFailed, ulRC );
+            pBackend->pfnFreeData( pBackend, psuClipMem );
+            return ( FALSE );
+        }
+    }
+
+    TraceStage( TST_OUTPUT );
+    if ( ! pBackend->pfnSetData( pBackend, CCF_UNICODE, psuClipMem )) {
+        sprintf( pszError, "Error copying Unicode text: the clipboard did not accept it.\nError code: 0x%X\n",
+                 pBackend->pfnQueryError( pBackend ));
+        pBackend->pfnFreeData( pBackend, psuClipMem );
+        return ( FALSE );
+    }
+    *pcbOut = ulDone * sizeof(UniChar);
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * StreamUtf8                                                                *
+ *                                                                           *
+ * Renders copied text which is not in memory as UTF-8.  Each chunk is       *
+ * converted to UTF-16 in scratch memory from the arena, once to count the   *
+ * UTF-8 bytes and again to write them straight into the clipboard memory.   *
+ * ------------------------------------------------------------------------- */
+BOOL StreamUtf8( PCLIP_BACKEND pBackend, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError )
+{
+    PCLIP_READER pReader;               // chunks of the text
+    UniChar      *psuChunk,             // one chunk as UCS-2
+                 *psuNext;              // UTF-8 conversion pointer
+    PSZ          pszClipMem = NULL,     // UTF-8 text in clipboard
+                 pszFailed;             // name of failed function
+    ULONG        ulBufLen = 1,          // length of UTF-8 text, with the NUL
+                 ulDone,                // UTF-8 bytes written so far
+                 ulPass,                // 0 = counting, 1 = converting
+                 ulRC;                  // return code
+
+
+    pReader  = OpenReader( pSource, pArena );
+    psuChunk = (UniChar *) ArenaAlloc( pArena, ( CLIP_CHUNK + 1 ) * sizeof(UniChar) );
+    if (( pReader == NULL ) || ( psuChunk == NULL )) {
+        sprintf( pszError, "Error copying UTF-8 text: not enough memory for %u bytes.",
+                 (ULONG)( sizeof(CLIP_READER) + ( CLIP_CHUNK + 1 ) * sizeof(UniChar) ));
+        return ( FALSE );
+    }
+
+    // (no chunk produces more UniChars than it has bytes)
+    for ( ulPass = 0; ulPass < 2; ulPass++ ) {
+        RewindReader( pReader );
+        for ( ulDone = 0; ReadChunk( pReader ); ) {
+            ulRC = ConvertToUcsBuf( pSource->ulCP, pReader->achChunk, psuChunk, CLIP_CHUNK + 1, &pszFailed );
+            if ( ulRC != ULS_SUCCESS ) {
+                sprintf( pszError, "Error copying UTF-8 text:\n%s = %08X", pszFailed, ulRC );
+                if ( pszClipMem ) pBackend->pfnFreeData( pBackend, pszClipMem );
+                return ( FALSE );
+            }
+            psuNext = psuChunk;
+            if ( pszClipMem ) {
+                ulDone += UcsToUtf8( &psuNext, pszClipMem + ulDone, ulBufLen - ulDone );
+                if ( *psuNext ) break;
+            }
+            else ulDone += UcsToUtf8( &psuNext, NULL, 0 );
+        }
+        if ( pszClipMem ) break;
+
+        ulBufLen = ulDone + 1;
+        if (( ulRC = pBackend->pfnAllocData( pBackend, ulBufLen, (PVOID *) &pszClipMem )) != 0 ) {
+            sprintf( pszError, "Error copying UTF-8 text: no clipboard memory for %u bytes.\nError code: 0x%X\n",
+                     ulBufLen, ulRC );
+            return ( FALSE );
+        }
+        *pszClipMem = '\0';
+    }
+
+    TraceStage( TST_OUTPUT );
+    if ( ! pBackend->pfnSetData( pBackend, CCF_UTF8, pszClipMem )) {
+        sprintf( pszError, "Error copying UTF-8 text: the clipboard did not accept it.\nError code: 0x%X\n",
+                 pBackend->pfnQueryError( pBackend ));
+        pBackend->pfnFreeData( pBackend, pszClipMem );
+        return ( FALSE );
+    }
+    *pcbOut = ulDone;
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * OpenReader                                                                *
+ *                                                                           *
+ * Sets up to read a CLIP_SOURCE a chunk at a time, with memory for the      *
+ * chunks from the arena.  Returns NULL if there is not enough memory.       *
+ * ------------------------------------------------------------------------- */
+PCLIP_READER OpenReader( PCLIP_SOURCE pSource, PARENA pArena )
+{
+    PCLIP_READER pReader;               // the new reader
+
+
+    if (( pReader = (PCLIP_READER) ArenaAlloc( pArena, sizeof(CLIP_READER) )) == NULL ) return ( NULL );
+    pReader->pSource = pSource;
+    RewindReader( pReader );
+    return ( pReader );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RewindReader                                                              *
+ *                                                                           *
+ * Goes back to the start of the text, so that it can be read again.         *
+ * ------------------------------------------------------------------------- */
+void RewindReader( PCLIP_READER pReader )
+{
+    pReader->ulOffset       = 0;
+    pReader->cbHeld         = 0;
+    pReader->cbChunk        = 0;
+    pReader->chSaved        = '\0';
+    pReader->achChunk[ 0 ]  = '\0';
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ReadChunk                                                                 *
+ *                                                                           *
+ * Reads the next chunk of the text into achChunk, and NUL-terminates it     *
+ * after the last whole character (cbChunk bytes).  Any part of a            *
+ * character after that is kept, to start the next chunk.                    *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   FALSE at the end of the text.                                           *
+ * ------------------------------------------------------------------------- */
+BOOL ReadChunk( PCLIP_READER pReader )
+{
+    PCLIP_SOURCE pSource = pReader->pSource;    // the text being read
+    ULONG        cbRead;                        // bytes read this time
+
+
+    pReader->achChunk[ pReader->cbChunk ] = pReader->chSaved;
+    pReader->cbHeld -= pReader->cbChunk;
+    memmove( pReader->achChunk, pReader->achChunk + pReader->cbChunk, pReader->cbHeld );
+
+    // Read until there is at least one whole character (at the end, whatever
+    // is left over is converted as it is)
+    do {
+        cbRead = 0;
+        if ( pReader->ulOffset < pSource->ulLength )
+            cbRead = pSource->pfnRead( pSource, pReader->ulOffset, pReader->achChunk + pReader->cbHeld,
+                                       min( CLIP_CHUNK - pReader->cbHeld, pSource->ulLength - pReader->ulOffset ));
+        pReader->ulOffset += cbRead;
+        pReader->cbHeld   += cbRead;
+        if ( cbRead && ( pReader->ulOffset < pSource->ulLength ))
+            pReader->cbChunk = ChunkBoundary( pSource->ulCP, pReader->achChunk, pReader->cbHeld );
+        else
+            pReader->cbChunk = pReader->cbHeld;
+    } while ( ! pReader->cbChunk && cbRead );
+    pReader->chSaved = pReader->achChunk[ pReader->cbChunk ];
+    pReader->achChunk[ pReader->cbChunk ] = '\0';
+    return ( pReader->cbChunk != 0 );
+}
@@ -0,0 +1,66 @@
+/*****************************************************************************
+ * clipfmt.h                                                                 *
+ *                                                                           *
+ * Declarations for the clipboard format routines (clipfmt.c), and for the   *
+ * interface through which they reach a clipboard.  These do not depend on   *
+ * Presentation Manager; os2.h, uconv.h, clipconv.h and cliparena.h must be  *
+ * included before this file.                                                *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPFMT_H
+#define CLIPFMT_H
+
+
+// CONSTANTS
+//
+#define MAX_CLIP_ERROR  256     // size of the buffer for a rendering error message
+#define CLIP_CHUNK      65536   // bytes of text read from a CLIP_SOURCE reader at once
+
+
+// TYPES
+//
+
+// A clipboard, as seen by the format routines.  Every function is passed the
+// backend itself; pvClip is for the clipboard's own use.
+typedef struct _CLIP_BACKEND {
+    PVOID   pvClip;                                                     // the clipboard's own state
+    BOOL    (*pfnOpen)( struct _CLIP_BACKEND *pBackend );               // open it (waiting if need be)
+    BOOL    (*pfnClose)( struct _CLIP_BACKEND *pBackend );              // close it again
+    BOOL    (*pfnEmpty)( struct _CLIP_BACKEND *pBackend );              // empty it, and become its owner
+    ULONG   (*pfnQueryFormats)( struct _CLIP_BACKEND *pBackend );       // formats available (CCF_*)
+    PVOID   (*pfnQueryData)( struct _CLIP_BACKEND *pBackend, ULONG flFormat );
+                                                                        // data in one format (NULL = none)
+    ULONG   (*pfnAllocData)( struct _CLIP_BACKEND *pBackend, ULONG cb, PVOID *ppvData );
+                                                                        // allocate memory for data (0 = OK)
+    void    (*pfnFreeData)( struct _CLIP_BACKEND *pBackend, PVOID pvData );
+                                                                        // free memory not given to it
+    BOOL    (*pfnSetData)( struct _CLIP_BACKEND *pBackend, ULONG flFormat, PVOID pvData );
+                                                                        // set data (NULL = render on request)
+    ULONG   (*pfnQueryError)( struct _CLIP_BACKEND *pBackend );         // error code of the last failure
+} CLIP_BACKEND, *PCLIP_BACKEND;
+
+// Copied text, to be rendered into the clipboard formats.  The text is either
+// in memory, or (if pszText is NULL) read from wherever it is kept, a piece at
+// a time: each call to pfnRead carries on from where the last one stopped, or
+// starts again from the beginning when ulOffset is 0, and returns the number
+// of bytes read (0 at the end).
+typedef struct _CLIP_SOURCE {
+    PSZ         pszText;                    // the text (NULL = read with pfnRead)
+    ULONG       ulLength;                   // its length in bytes
+    ULONG       ulCP;                       // its codepage
+    PVOID       pvReader;                   // the reader's own state
+    ULONG       (*pfnRead)( struct _CLIP_SOURCE *pSource, ULONG ulOffset, PCHAR pchBuf, ULONG cbBuf );
+                                            // reads the next piece of the text
+} CLIP_SOURCE, *PCLIP_SOURCE;
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG ClipQueryText( PCLIP_BACKEND pBackend, ULONG ulCP, PVOID *ppvText, PULONG pcbText );
+ULONG ClipOfferText( PCLIP_BACKEND pBackend, PULONG pulUniError, PULONG pulTxtError );
+BOOL  ClipRenderText( PCLIP_BACKEND pBackend, ULONG flFormat, PCLIP_SOURCE pSource, PARENA pArena, PULONG pcbOut, PSZ pszError );
+
+
+#endif
@@ -0,0 +1,221 @@
+/*****************************************************************************
+ * cliphist.c                                                                *
+ *                                                                           *
+ * Clipboard history for CLIPUNI.  Every piece of text copied is kept (once) *
+ * in the codepage it was copied in, so that it can be recalled later; it    *
+ * is only converted to Unicode again if the recalled text is pasted as      *
+ * such.  The history is limited both in entries (HIST_ENTRIES) and in the   *
+ * total size of the text (HIST_BUDGET); when it is full, the entry that was *
+ * least recently copied or recalled is dropped.                             *
+ *                                                                           *
+ * A history must only be used by one thread.  Initialize it to all zeroes.  *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#include <os2.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uconv.h>
+#include "clipconv.h"
+#include "cliphist.h"
+
+
+// FUNCTION DECLARATIONS
+//
+void        LinkNewest( PHISTORY pHist, PHIST_ENTRY pEntry );
+void        Unlink( PHISTORY pHist, PHIST_ENTRY pEntry );
+PHIST_ENTRY LeastRecentlyUsed( PHISTORY pHist );
+void        DropEntry( PHISTORY pHist, PHIST_ENTRY pEntry );
+
+
+/* ------------------------------------------------------------------------- *
+ * HistoryAdd                                                                *
+ *                                                                           *
+ * Records copied text in the history.  If the same text is already there,   *
+ * that entry simply becomes the newest one; otherwise a copy of the text    *
+ * is added, dropping the least recently used entries to make room.  Any     *
+ * recall in progress (see HistoryRecall) starts again from the newest.      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PHISTORY pHist: The history.                                            *
+ *   PSZ pszText   : The copied text.                                        *
+ *   ULONG cbText  : Its length in bytes.                                    *
+ *   ULONG ulCP    : Its codepage.                                           *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the text is in the history, FALSE if it is empty or too big,    *
+ *   or there is not enough memory.                                          *
+ * ------------------------------------------------------------------------- */
+BOOL HistoryAdd( PHISTORY pHist, PSZ pszText, ULONG cbText, ULONG ulCP )
+{
+    PHIST_ENTRY pEntry;                 // entry for the text
+    ULONG       ulHash,                 // hash of the text
+                i;
+
+
+    pHist->pRecall = NULL;
+    if ( ! cbText ) return ( FALSE );
+    if ( cbText > HIST_BUDGET ) return ( FALSE );
+    ulHash = HashText( pszText, cbText );
+
+    // Text that is already in the history just becomes the newest entry
+    for ( i = 0; i < HIST_ENTRIES; i++ ) {
+        pEntry = &(pHist->aEntry[ i ]);
+        if ( pEntry->pszText && ( pEntry->ulHash == ulHash ) && ( pEntry->cbText == cbText ) &&
+             ( pEntry->ulCP == ulCP ) && ( memcmp( pEntry->pszText, pszText, cbText ) == 0 ))
+        {
+            Unlink( pHist, pEntry );
+            LinkNewest( pHist, pEntry );
+            pEntry->ulLastUse = ++(pHist->ulUseSeq);
+            pHist->ulDuplicates++;
+            return ( TRUE );
+        }
+    }
+
+    // Make room, dropping whichever entries were used least recently
+    while (( pHist->ulEntries == HIST_ENTRIES ) || ( pHist->cbHeld + cbText > HIST_BUDGET )) {
+        DropEntry( pHist, LeastRecentlyUsed( pHist ));
+        pHist->ulEvictions++;
+    }
+
+    for ( i = 0; pHist->aEntry[ i ].pszText; i++ ) ;
+    pEntry = &(pHist->aEntry[ i ]);
+    if (( pEntry->pszText = (PSZ) malloc( cbText + 1 )) == NULL ) return ( FALSE );
+    memcpy( pEntry->pszText, pszText, cbText );
+    pEntry->pszText[ cbText ] = '\0';
+    pEntry->cbText    = cbText;
+    pEntry->ulCP      = ulCP;
+    pEntry->ulHash    = ulHash;
+    pEntry->ulLastUse = ++(pHist->ulUseSeq);
+    LinkNewest( pHist, pEntry );
+    pHist->ulEntries++;
+    pHist->cbHeld += cbText;
+
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * HistoryRecall                                                             *
+ *                                                                           *
+ * Returns the next entry to be recalled: the one copied before the entry    *
+ * last recalled (or before the newest, the first time).  After the oldest   *
+ * entry, it goes round to the newest again.                                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PHISTORY pHist: The history.                                            *
+ *                                                                           *
+ * RETURNS: PHIST_ENTRY                                                      *
+ *   The entry, or NULL if the history is empty.  It is only valid until     *
+ *   the next call to HistoryAdd.                                            *
+ * ------------------------------------------------------------------------- */
+PHIST_ENTRY HistoryRecall( PHISTORY pHist )
+{
+    PHIST_ENTRY pEntry;
+
+    if ( ! pHist->pNewest ) return ( NULL );
+
+    pEntry = ( pHist->pRecall ? pHist->pRecall : pHist->pNewest )->pOlder;
+    if ( ! pEntry ) pEntry = pHist->pNewest;
+
+    pHist->pRecall    = pEntry;
+    pEntry->ulLastUse = ++(pHist->ulUseSeq);
+    pHist->ulRecalls++;
+    return ( pEntry );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * HistoryFree                                                               *
+ *                                                                           *
+ * Drops every entry in the history.  (The counters are kept.)               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PHISTORY pHist: The history.                                            *
+ * ------------------------------------------------------------------------- */
+void HistoryFree( PHISTORY pHist )
+{
+    while ( pHist->pOldest ) DropEntry( pHist, pHist->pOldest );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LinkNewest                                                                *
+ *                                                                           *
+ * Adds an entry to the history list as the newest entry.                    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PHISTORY pHist    : The history.                                        *
+ *   PHIST_ENTRY pEntry: The entry (which must not be in the list).          *
+ * ------------------------------------------------------------------------- */
+void LinkNewest( PHISTORY pHist, PHIST_ENTRY pEntry )
+{
+    pEntry->pNewer = NULL;
+    pEntry->pOlder = pHist->pNewest;
+    if ( pHist->pNewest ) pHist->pNewest->pNewer = pEntry;
+    else                  pHist->pOldest = pEntry;
+    pHist->pNewest = pEntry;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Unlink                                                                    *
+ *                                                                           *
+ * Removes an entry from the history list.                                   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PHISTORY pHist    : The history.                                        *
+ *   PHIST_ENTRY pEntry: The entry.                                          *
+ * ------------------------------------------------------------------------- */
+void Unlink( PHISTORY pHist, PHIST_ENTRY pEntry )
+{
+    if ( pEntry->pNewer ) pEntry->pNewer->pOlder = pEntry->pOlder;
+    else                  pHist->pNewest = pEntry->pOlder;
+    if ( pEntry->pOlder ) pEntry->pOlder->pNewer = pEntry->pNewer;
+    else                  pHist->pOldest = pEntry->pNewer;
+    pEntry->pNewer = pEntry->pOlder = NULL;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LeastRecentlyUsed                                                         *
+ *                                                                           *
+ * Finds the entry that was least recently copied or recalled.               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PHISTORY pHist: The history (which must not be empty).                  *
+ *                                                                           *
+ * RETURNS: PHIST_ENTRY                                                      *
+ *   The entry.                                                              *
+ * ------------------------------------------------------------------------- */
+PHIST_ENTRY LeastRecentlyUsed( PHISTORY pHist )
+{
+    PHIST_ENTRY pEntry,
+                pLRU;
+
+    for ( pLRU = pEntry = pHist->pOldest; pEntry; pEntry = pEntry->pNewer )
+        if ( pEntry->ulLastUse < pLRU->ulLastUse ) pLRU = pEntry;
+    return ( pLRU );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DropEntry                                                                 *
+ *                                                                           *
+ * Removes an entry from the history and frees its text.                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PHISTORY pHist    : The history.                                        *
+ *   PHIST_ENTRY pEntry: The entry.                                          *
+ * ------------------------------------------------------------------------- */
+void DropEntry( PHISTORY pHist, PHIST_ENTRY pEntry )
+{
+    if ( pHist->pRecall == pEntry ) pHist->pRecall = NULL;
+    Unlink( pHist, pEntry );
+    pHist->ulEntries--;
+    pHist->cbHeld -= pEntry->cbText;
+    free( pEntry->pszText );
+    pEntry->pszText = NULL;
+    pEntry->cbText  = 0;
+}
@@ -0,0 +1,53 @@
+/*****************************************************************************
+ * cliphist.h                                                                *
+ *                                                                           *
+ * Declarations for the clipboard history (cliphist.c).  These do not depend *
+ * on Presentation Manager; os2.h must be included before this file.         *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPHIST_H
+#define CLIPHIST_H
+
+
+// CONSTANTS
+//
+#define HIST_ENTRIES    32      // maximum number of copies kept in the history
+#define HIST_BUDGET     1048576 // maximum bytes of text kept in the history
+
+
+// TYPES
+//
+typedef struct _HIST_ENTRY {
+    struct _HIST_ENTRY *pNewer,             // next newer entry (NULL = newest)
+                       *pOlder;             // next older entry (NULL = oldest)
+    PSZ         pszText;                    // the copied text (NULL = slot unused)
+    ULONG       cbText;                     // its length in bytes
+    ULONG       ulCP;                       // codepage of the text
+    ULONG       ulHash;                     // hash of the text (see HashText)
+    ULONG       ulLastUse;                  // use sequence number (for LRU)
+} HIST_ENTRY, *PHIST_ENTRY;
+
+typedef struct _HISTORY {
+    HIST_ENTRY  aEntry[ HIST_ENTRIES ];     // the entries (in no particular order)
+    PHIST_ENTRY pNewest,                    // most recently copied entry
+                pOldest,                    // least recently copied entry
+                pRecall;                    // entry last recalled (NULL = none)
+    ULONG       ulEntries;                  // number of entries in use
+    ULONG       cbHeld;                     // bytes of text held
+    ULONG       ulUseSeq;                   // last use sequence number
+    ULONG       ulDuplicates,               // copies already in the history
+                ulEvictions,                // entries dropped to make room
+                ulRecalls;                  // entries recalled
+} HISTORY, *PHISTORY;
+
+
+// FUNCTION DECLARATIONS
+//
+BOOL        HistoryAdd( PHISTORY pHist, PSZ pszText, ULONG cbText, ULONG ulCP );
+PHIST_ENTRY HistoryRecall( PHISTORY pHist );
+void        HistoryFree( PHISTORY pHist );
+
+
+#endif
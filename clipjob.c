@@ -0,0 +1,309 @@
+/*****************************************************************************
+ * clipjob.c                                                                 *
+ *                                                                           *
+ * Background conversion worker for CLIPUNI.  Large pastes are queued here   *
+ * as jobs rather than converted inside the window procedure, so that the    *
+ * message queue keeps running while they are processed.                     *
+ *                                                                           *
+ * The worker converts each job a piece at a time and posts every piece      *
+ * back to the job's window, which imports it into the MLE and releases it.  *
+ * No more than JOB_INFLIGHT pieces are ever waiting to be imported, so the  *
+ * memory used does not depend on the size of the text, and the worker can   *
+ * never flood the message queue.  The only PM function used by the worker   *
+ * is WinPostMsg(); it has no message queue of its own.                      *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#define INCL_DOSPROCESS
+#define INCL_DOSSEMAPHORES
+#define INCL_WINMESSAGEMGR
+#include <os2.h>
+#include <process.h>
+#include <stdlib.h>
+#include <uconv.h>
+#include "clipconv.h"
+#include "clipjob.h"
+
+
+// FUNCTION DECLARATIONS
+//
+void WorkerThread( void *pArg );
+void ConvertJob( PPASTE_JOB pJob );
+BOOL WaitForPiece( void );
+
+
+// GLOBAL VARIABLES
+//
+HMTX       hmtxJobs;                    // protects the job queue and piece count
+HEV        hevJobs,                     // posted when a job is queued
+           hevPieces;                   // posted when a piece is released
+TID        tidWorker   = 0;             // the worker thread (0 = not running)
+PPASTE_JOB pJobFirst   = NULL,          // next job to be converted
+           pJobLast    = NULL;          // last job in the queue
+ULONG      ulPiecesOut = 0;             // pieces posted but not yet released
+
+volatile BOOL fJobsCancelled = FALSE,   // abandon all queued and current jobs
+              fWorkerQuit    = FALSE;   // end the worker once the queue is empty
+
+
+/* ------------------------------------------------------------------------- *
+ * StartWorker                                                               *
+ *                                                                           *
+ * Creates the worker thread and the semaphores it uses.                     *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the worker is running.  If not, the caller should convert       *
+ *   everything itself.                                                      *
+ * ------------------------------------------------------------------------- */
+BOOL StartWorker( void )
+{
+    int iTid;
+
+    if ( DosCreateMutexSem( NULL, &hmtxJobs, 0, FALSE )) return ( FALSE );
+    if ( DosCreateEventSem( NULL, &hevJobs, 0, FALSE )) {
+        DosCloseMutexSem( hmtxJobs );
+        return ( FALSE );
+    }
+    if ( DosCreateEventSem( NULL, &hevPieces, 0, FALSE )) {
+        DosCloseEventSem( hevJobs );
+        DosCloseMutexSem( hmtxJobs );
+        return ( FALSE );
+    }
+
+    if (( iTid = _beginthread( WorkerThread, NULL, JOB_STACK, NULL )) == -1 ) {
+        DosCloseEventSem( hevPieces );
+        DosCloseEventSem( hevJobs );
+        DosCloseMutexSem( hmtxJobs );
+        return ( FALSE );
+    }
+    tidWorker = (TID) iTid;
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * StopWorker                                                                *
+ *                                                                           *
+ * Cancels any outstanding jobs and waits for the worker thread to end.      *
+ * Pieces and completion messages already posted are not retrieved, so this  *
+ * should only be called when the program is about to exit.                  *
+ * ------------------------------------------------------------------------- */
+void StopWorker( void )
+{
+    if ( ! tidWorker ) return;
+
+    fWorkerQuit    = TRUE;
+    fJobsCancelled = TRUE;
+    DosPostEventSem( hevJobs );
+    DosPostEventSem( hevPieces );
+    DosWaitThread( &tidWorker, DCWW_WAIT );
+    tidWorker = 0;
+
+    DosCloseEventSem( hevPieces );
+    DosCloseEventSem( hevJobs );
+    DosCloseMutexSem( hmtxJobs );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * QueueJob                                                                  *
+ *                                                                           *
+ * Adds a paste job to the end of the worker's queue.  The job must remain   *
+ * valid until WM_JOBDONE is received for it.                                *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPASTE_JOB pJob: The job to queue.                                      *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the job was queued; FALSE if the worker is not running.         *
+ * ------------------------------------------------------------------------- */
+BOOL QueueJob( PPASTE_JOB pJob )
+{
+    if ( ! tidWorker ) return ( FALSE );
+
+    pJob->pNext      = NULL;
+    pJob->ulRC       = ULS_SUCCESS;
+    pJob->pszFailed  = NULL;
+    pJob->fCancelled = FALSE;
+
+    DosRequestMutexSem( hmtxJobs, SEM_INDEFINITE_WAIT );
+    if ( pJobLast ) pJobLast->pNext = pJob;
+    else            pJobFirst       = pJob;
+    pJobLast = pJob;
+    DosPostEventSem( hevJobs );
+    DosReleaseMutexSem( hmtxJobs );
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * CancelJobs                                                                *
+ *                                                                           *
+ * Tells the worker to abandon the current job and any queued ones as soon   *
+ * as possible.  Each job is still completed with WM_JOBDONE (with its       *
+ * fCancelled flag set).  Call ResumeJobs once they have all been completed. *
+ * ------------------------------------------------------------------------- */
+void CancelJobs( void )
+{
+    fJobsCancelled = TRUE;
+    DosPostEventSem( hevPieces );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ResumeJobs                                                                *
+ *                                                                           *
+ * Allows jobs to be converted again after CancelJobs.                       *
+ * ------------------------------------------------------------------------- */
+void ResumeJobs( void )
+{
+    fJobsCancelled = FALSE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ReleasePiece                                                              *
+ *                                                                           *
+ * Frees a piece received with WM_JOBPIECE, allowing the worker to convert   *
+ * another one.  Every piece received must be released.                      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPASTE_PIECE pPiece: The piece to release.                              *
+ * ------------------------------------------------------------------------- */
+void ReleasePiece( PPASTE_PIECE pPiece )
+{
+    free( pPiece );
+
+    DosRequestMutexSem( hmtxJobs, SEM_INDEFINITE_WAIT );
+    ulPiecesOut--;
+    DosReleaseMutexSem( hmtxJobs );
+    DosPostEventSem( hevPieces );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * WorkerThread                                                              *
+ *                                                                           *
+ * Main procedure of the worker thread: takes jobs off the queue one at a    *
+ * time and converts them, until told to quit.                               *
+ * ------------------------------------------------------------------------- */
+void WorkerThread( void *pArg )
+{
+    PPASTE_JOB pJob;
+    ULONG      ulPosts;
+
+    for ( ;; ) {
+        DosRequestMutexSem( hmtxJobs, SEM_INDEFINITE_WAIT );
+        if (( pJob = pJobFirst ) != NULL ) {
+            pJobFirst = pJob->pNext;
+            if ( ! pJobFirst ) pJobLast = NULL;
+        }
+        else
+            DosResetEventSem( hevJobs, &ulPosts );
+        DosReleaseMutexSem( hmtxJobs );
+
+        if ( pJob ) {
+            ConvertJob( pJob );
+            // (the job belongs to its window again once this is posted)
+            WinPostMsg( pJob->hwndNotify, WM_JOBDONE, MPFROMP(pJob), 0 );
+        }
+        else if ( fWorkerQuit )
+            break;
+        else
+            DosWaitEventSem( hevJobs, SEM_INDEFINITE_WAIT );
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertJob                                                                *
+ *                                                                           *
+ * Converts a paste job into the target codepage, posting each piece of the  *
+ * result to the job's window as WM_JOBPIECE.  A trailing CR is held back to *
+ * the next piece, so that a CR-LF pair is never split.                      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPASTE_JOB pJob: The job to convert.                                    *
+ * ------------------------------------------------------------------------- */
+void ConvertJob( PPASTE_JOB pJob )
+{
+    PPASTE_PIECE pPiece;                // piece being converted
+    ULONG        ulLength,              // bytes converted into the piece
+                 ulCarry = 0,           // CR carried over to the next piece
+                 ulRC;                  // return code
+
+
+    if ( fJobsCancelled ) {
+        pJob->fCancelled = TRUE;
+        return;
+    }
+
+    // The conversion cache belongs to the main thread, so use our own object
+    ulRC = StreamFromUcsOpen( &(pJob->cs), pJob->ulCP, pJob->psuText, TRUE, &(pJob->pszFailed) );
+    while (( ulRC == ULS_SUCCESS ) && *(pJob->cs.psuNext) ) {
+
+        if ( ! WaitForPiece() ) {
+            pJob->fCancelled = TRUE;
+            break;
+        }
+        if (( pPiece = (PPASTE_PIECE) malloc( sizeof(PASTE_PIECE) )) == NULL ) {
+            pJob->pszFailed = "malloc()";
+            ulRC = ULS_NOMEMORY;
+            break;
+        }
+
+        if ( ulCarry ) pPiece->ach[ 0 ] = '\r';
+        ulRC = StreamFromUcs( &(pJob->cs), pPiece->ach + ulCarry, sizeof(pPiece->ach) - ulCarry,
+                              &ulLength, &(pJob->pszFailed) );
+        if ( ulRC != ULS_SUCCESS ) {
+            free( pPiece );
+            break;
+        }
+        ulLength += ulCarry;
+        ulCarry   = 0;
+        if (( pPiece->ach[ ulLength - 1 ] == '\r' ) && ( *(pJob->cs.psuNext) != 0 )) {
+            ulLength--;
+            ulCarry = 1;
+        }
+        pPiece->cb     = ulLength;
+        pPiece->ulDone = pJob->cs.psuNext - pJob->psuText;
+
+        DosRequestMutexSem( hmtxJobs, SEM_INDEFINITE_WAIT );
+        ulPiecesOut++;
+        DosReleaseMutexSem( hmtxJobs );
+        if ( ! WinPostMsg( pJob->hwndNotify, WM_JOBPIECE, MPFROMP(pJob), MPFROMP(pPiece) )) {
+            ReleasePiece( pPiece );
+            pJob->fCancelled = TRUE;
+            break;
+        }
+    }
+    StreamFromUcsClose( &(pJob->cs) );
+
+    pJob->ulRC = ulRC;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * WaitForPiece                                                              *
+ *                                                                           *
+ * Waits until fewer than JOB_INFLIGHT pieces are outstanding.               *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if another piece may be posted; FALSE if the jobs were cancelled.  *
+ * ------------------------------------------------------------------------- */
+BOOL WaitForPiece( void )
+{
+    ULONG ulPosts;
+    BOOL  fRoom;                        // fewer than JOB_INFLIGHT outstanding
+
+    for ( ;; ) {
+        DosResetEventSem( hevPieces, &ulPosts );
+        if ( fJobsCancelled ) return ( FALSE );
+        DosRequestMutexSem( hmtxJobs, SEM_INDEFINITE_WAIT );
+        fRoom = ( ulPiecesOut < JOB_INFLIGHT );
+        DosReleaseMutexSem( hmtxJobs );
+        if ( fRoom ) return ( TRUE );
+        DosWaitEventSem( hevPieces, SEM_INDEFINITE_WAIT );
+    }
+}
@@ -0,0 +1,63 @@
+/*****************************************************************************
+ * clipjob.h                                                                 *
+ *                                                                           *
+ * Declarations for the background conversion worker (clipjob.c).  os2.h     *
+ * (with INCL_WIN), uconv.h and clipconv.h must be included before this      *
+ * file.                                                                     *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPJOB_H
+#define CLIPJOB_H
+
+
+// CONSTANTS
+//
+#define JOB_CHUNK       32768   // maximum bytes of converted text in one piece
+#define JOB_INFLIGHT    4       // maximum pieces posted but not yet imported
+#define JOB_STACK       65536   // stack size of the worker thread
+
+// Messages posted by the worker to the job's notification window
+#define WM_JOBPIECE     ( WM_USER + 1 )     // mp1 = PPASTE_JOB, mp2 = PPASTE_PIECE
+#define WM_JOBDONE      ( WM_USER + 2 )     // mp1 = PPASTE_JOB
+
+
+// TYPES
+//
+typedef struct _PASTE_JOB {
+    struct _PASTE_JOB *pNext;               // next job in the queue
+    HWND        hwndNotify;                 // window that receives WM_JOB* messages
+    HWND        hwndMLE;                    // MLE being pasted into
+    ULONG       ulCP;                       // codepage to convert into
+    UniChar     *psuText;                   // text to convert (owned by the job)
+    ULONG       ulChars;                    // length of psuText in UniChars
+    ULONG       ulRC;                       // result of the conversion
+    PSZ         pszFailed;                  // name of failed function (if any)
+    BOOL        fCancelled;                 // the conversion was cancelled
+    // (the following are only used by the thread that queued the job)
+    BOOL        fStopped;                   // no more pieces are to be imported
+    IPT         ipt;                        // MLE import point
+    ULONG       ulCopied;                   // bytes imported so far
+    ULONG       ulPercent;                  // progress last reported
+    CONV_STREAM cs;                         // conversion state (worker only)
+} PASTE_JOB, *PPASTE_JOB;
+
+typedef struct _PASTE_PIECE {
+    ULONG       cb;                         // bytes of converted text
+    ULONG       ulDone;                     // source UniChars converted so far
+    CHAR        ach[ JOB_CHUNK + 1 ];       // the converted text
+} PASTE_PIECE, *PPASTE_PIECE;
+
+
+// FUNCTION DECLARATIONS
+//
+BOOL StartWorker( void );
+void StopWorker( void );
+BOOL QueueJob( PPASTE_JOB pJob );
+void CancelJobs( void );
+void ResumeJobs( void );
+void ReleasePiece( PPASTE_PIECE pPiece );
+
+
+#endif
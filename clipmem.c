@@ -0,0 +1,287 @@
+/*****************************************************************************
+ * clipmem.c                                                                 *
+ *                                                                           *
+ * An in-memory clipboard, reached through the same CLIP_BACKEND interface   *
+ * as the PM clipboard, so that the clipboard format code can be tested and  *
+ * measured without Presentation Manager.                                    *
+ *                                                                           *
+ * It behaves like the PM clipboard where that matters: a format set with    *
+ * no data is rendered by the owner (pfnRender) when it is first asked for,  *
+ * setting data replaces (and frees) what was there, and emptying it frees   *
+ * everything.  Every data block records its exact size and is followed by   *
+ * guard bytes, so that tests can check that data was sized exactly and      *
+ * written within bounds (see MemQueryBlock).                                *
+ *                                                                           *
+ * A clipboard must only be used by one thread.                              *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#include <os2.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uconv.h>
+#include "cliparena.h"
+#include "clipconv.h"
+#include "clipfmt.h"
+#include "clipmem.h"
+
+
+// TYPES
+//
+typedef struct _MEM_BLOCK {
+    ULONG       ulMagic;                    // MEM_MAGIC
+    ULONG       cbData;                     // size of the data that follows
+} MEM_BLOCK, *PMEM_BLOCK;
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG MemFormatIndex( ULONG flFormat );
+void  MemFreeFormat( PMEM_CLIPBOARD pClip, ULONG i );
+BOOL  MemOpen( PCLIP_BACKEND pBackend );
+BOOL  MemClose( PCLIP_BACKEND pBackend );
+BOOL  MemEmpty( PCLIP_BACKEND pBackend );
+ULONG MemQueryFormats( PCLIP_BACKEND pBackend );
+PVOID MemQueryData( PCLIP_BACKEND pBackend, ULONG flFormat );
+ULONG MemAllocData( PCLIP_BACKEND pBackend, ULONG cb, PVOID *ppvData );
+void  MemFreeData( PCLIP_BACKEND pBackend, PVOID pvData );
+BOOL  MemSetData( PCLIP_BACKEND pBackend, ULONG flFormat, PVOID pvData );
+ULONG MemQueryError( PCLIP_BACKEND pBackend );
+
+
+/* ------------------------------------------------------------------------- *
+ * MemClipInit                                                               *
+ *                                                                           *
+ * Sets up an empty in-memory clipboard, and the backend that reaches it.    *
+ * The owner's renderer (pfnRender) may then be filled in.                   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PMEM_CLIPBOARD pClip  : The clipboard.                                  *
+ *   PCLIP_BACKEND pBackend: The backend to set up for it.                   *
+ * ------------------------------------------------------------------------- */
+void MemClipInit( PMEM_CLIPBOARD pClip, PCLIP_BACKEND pBackend )
+{
+    memset( pClip, 0, sizeof( MEM_CLIPBOARD ));
+    pClip->pBackend = pBackend;
+
+    pBackend->pvClip          = pClip;
+    pBackend->pfnOpen         = MemOpen;
+    pBackend->pfnClose        = MemClose;
+    pBackend->pfnEmpty        = MemEmpty;
+    pBackend->pfnQueryFormats = MemQueryFormats;
+    pBackend->pfnQueryData    = MemQueryData;
+    pBackend->pfnAllocData    = MemAllocData;
+    pBackend->pfnFreeData     = MemFreeData;
+    pBackend->pfnSetData      = MemSetData;
+    pBackend->pfnQueryError   = MemQueryError;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MemClipFree                                                               *
+ *                                                                           *
+ * Frees all the data on an in-memory clipboard.  (The counters are kept.)   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PMEM_CLIPBOARD pClip: The clipboard.                                    *
+ * ------------------------------------------------------------------------- */
+void MemClipFree( PMEM_CLIPBOARD pClip )
+{
+    ULONG i;
+
+    for ( i = 0; i < MEM_FORMATS; i++ ) MemFreeFormat( pClip, i );
+    pClip->flDelayed = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MemQueryBlock                                                             *
+ *                                                                           *
+ * Checks a data block allocated by the in-memory clipboard.                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PVOID pvData  : The data.                                               *
+ *   PULONG pcbData: Receives the size it was allocated with (bytes).        *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if it is such a block and its guard bytes are intact.              *
+ * ------------------------------------------------------------------------- */
+BOOL MemQueryBlock( PVOID pvData, PULONG pcbData )
+{
+    PMEM_BLOCK pBlock = (PMEM_BLOCK) pvData - 1;
+    PUCHAR     pbGuard;
+    ULONG      i;
+
+    *pcbData = 0;
+    if ( pBlock->ulMagic != MEM_MAGIC ) return ( FALSE );
+    *pcbData = pBlock->cbData;
+    pbGuard  = (PUCHAR) pvData + pBlock->cbData;
+    for ( i = 0; i < MEM_GUARD; i++ )
+        if ( pbGuard[ i ] != MEM_GUARD_BYTE ) return ( FALSE );
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MemFormatIndex                                                            *
+ *                                                                           *
+ * Returns the index in apvData of a format, or MEM_FORMATS if the format    *
+ * is not one the clipboard holds.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG MemFormatIndex( ULONG flFormat )
+{
+    switch ( flFormat ) {
+        case CCF_TEXT:    return ( 0 );
+        case CCF_UNICODE: return ( 1 );
+        case CCF_UTF8:    return ( 2 );
+    }
+    return ( MEM_FORMATS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MemFreeFormat                                                             *
+ *                                                                           *
+ * Frees the data held in one format, if any.                                *
+ * ------------------------------------------------------------------------- */
+void MemFreeFormat( PMEM_CLIPBOARD pClip, ULONG i )
+{
+    if ( pClip->apvData[ i ] ) {
+        MemFreeData( pClip->pBackend, pClip->apvData[ i ] );
+        pClip->apvData[ i ] = NULL;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Backend functions (see CLIP_BACKEND).                                     *
+ * ------------------------------------------------------------------------- */
+BOOL MemOpen( PCLIP_BACKEND pBackend )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+
+    if ( pClip->fOpen ) return ( FALSE );
+    pClip->fOpen = TRUE;
+    return ( TRUE );
+}
+
+BOOL MemClose( PCLIP_BACKEND pBackend )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+
+    if ( ! pClip->fOpen ) {
+        pClip->ulLastError = MEMERR_NOTOPEN;
+        return ( FALSE );
+    }
+    pClip->fOpen = FALSE;
+    return ( TRUE );
+}
+
+BOOL MemEmpty( PCLIP_BACKEND pBackend )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+
+    if ( ! pClip->fOpen ) {
+        pClip->ulLastError = MEMERR_NOTOPEN;
+        return ( FALSE );
+    }
+    MemClipFree( pClip );
+    return ( TRUE );
+}
+
+ULONG MemQueryFormats( PCLIP_BACKEND pBackend )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+    ULONG          flFormats = pClip->flDelayed;
+
+    if ( pClip->apvData[ MemFormatIndex( CCF_TEXT )])    flFormats |= CCF_TEXT;
+    if ( pClip->apvData[ MemFormatIndex( CCF_UNICODE )]) flFormats |= CCF_UNICODE;
+    if ( pClip->apvData[ MemFormatIndex( CCF_UTF8 )])    flFormats |= CCF_UTF8;
+    return ( flFormats );
+}
+
+// A format to be rendered on request is rendered now, once, by the owner
+PVOID MemQueryData( PCLIP_BACKEND pBackend, ULONG flFormat )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+    ULONG          i     = MemFormatIndex( flFormat );
+
+    if ( ! pClip->fOpen ) {
+        pClip->ulLastError = MEMERR_NOTOPEN;
+        return ( NULL );
+    }
+    if ( i == MEM_FORMATS ) {
+        pClip->ulLastError = MEMERR_BADFMT;
+        return ( NULL );
+    }
+    if ( pClip->flDelayed & flFormat ) {
+        pClip->flDelayed &= ~flFormat;
+        if ( pClip->pfnRender ) {
+            pClip->ulRenders++;
+            pClip->pfnRender( pClip, flFormat );
+        }
+    }
+    return ( pClip->apvData[ i ] );
+}
+
+ULONG MemAllocData( PCLIP_BACKEND pBackend, ULONG cb, PVOID *ppvData )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+    PMEM_BLOCK     pBlock;
+
+    *ppvData = NULL;
+    if (( pBlock = (PMEM_BLOCK) malloc( sizeof( MEM_BLOCK ) + cb + MEM_GUARD )) == NULL ) {
+        pClip->ulLastError = MEMERR_NOMEMORY;
+        return ( MEMERR_NOMEMORY );
+    }
+    pBlock->ulMagic = MEM_MAGIC;
+    pBlock->cbData  = cb;
+    memset( pBlock + 1, 0, cb );
+    memset( (PUCHAR)( pBlock + 1 ) + cb, MEM_GUARD_BYTE, MEM_GUARD );
+
+    pClip->ulBlocks++;
+    pClip->ulAllocs++;
+    pClip->cbBlocks += cb;
+    *ppvData = pBlock + 1;
+    return ( NO_ERROR );
+}
+
+void MemFreeData( PCLIP_BACKEND pBackend, PVOID pvData )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+    ULONG          cbData;
+
+    if ( ! MemQueryBlock( pvData, &cbData )) pClip->ulBadGuards++;
+    pClip->ulBlocks--;
+    pClip->cbBlocks -= cbData;
+    ((PMEM_BLOCK) pvData - 1)->ulMagic = 0;
+    free( (PMEM_BLOCK) pvData - 1 );
+}
+
+BOOL MemSetData( PCLIP_BACKEND pBackend, ULONG flFormat, PVOID pvData )
+{
+    PMEM_CLIPBOARD pClip = (PMEM_CLIPBOARD) pBackend->pvClip;
+    ULONG          i     = MemFormatIndex( flFormat );
+
+    if ( ! pClip->fOpen ) {
+        pClip->ulLastError = MEMERR_NOTOPEN;
+        return ( FALSE );
+    }
+    if ( i == MEM_FORMATS ) {
+        pClip->ulLastError = MEMERR_BADFMT;
+        return ( FALSE );
+    }
+    MemFreeFormat( pClip, i );
+    if ( pvData ) {
+        pClip->flDelayed &= ~flFormat;
+        pClip->apvData[ i ] = pvData;
+    }
+    else pClip->flDelayed |= flFormat;
+    return ( TRUE );
+}
+
+ULONG MemQueryError( PCLIP_BACKEND pBackend )
+{
+    return ( ((PMEM_CLIPBOARD) pBackend->pvClip)->ulLastError );
+}
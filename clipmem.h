@@ -0,0 +1,54 @@
+/*****************************************************************************
+ * clipmem.h                                                                 *
+ *                                                                           *
+ * Declarations for the in-memory clipboard (clipmem.c), a CLIP_BACKEND used *
+ * by the tests and benchmarks.  os2.h, uconv.h, clipconv.h, cliparena.h and *
+ * clipfmt.h must be included before this file.                              *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPMEM_H
+#define CLIPMEM_H
+
+
+// CONSTANTS
+//
+#define MEM_FORMATS     3       // number of formats held (see MemFormatIndex)
+#define MEM_GUARD       16      // guard bytes after every data block
+#define MEM_GUARD_BYTE  0xFD    // value of the guard bytes
+#define MEM_MAGIC       0x4D454D43  // marks a data block header
+
+// Error codes (see pfnQueryError)
+#define MEMERR_NOTOPEN  1       // the clipboard is not open
+#define MEMERR_BADFMT   2       // not a format the clipboard holds
+#define MEMERR_NOMEMORY 8       // not enough memory for the data
+
+
+// TYPES
+//
+typedef struct _MEM_CLIPBOARD {
+    PVOID       apvData[ MEM_FORMATS ];     // data in each format (NULL = none)
+    ULONG       flDelayed;                  // formats to be rendered on request (CCF_*)
+    BOOL        fOpen;                      // the clipboard is open
+    BOOL        (*pfnRender)( struct _MEM_CLIPBOARD *pClip, ULONG flFormat );
+                                            // owner's renderer (like WM_RENDERFMT)
+    PVOID       pvOwner;                    // owner's own data (for pfnRender)
+    ULONG       ulLastError;                // error code of the last failure (MEMERR_*)
+    ULONG       ulBlocks,                   // data blocks allocated and not yet freed
+                cbBlocks,                   // total size of those blocks (bytes)
+                ulAllocs,                   // data blocks ever allocated
+                ulRenders,                  // formats rendered on request
+                ulBadGuards;                // blocks found with damaged guard bytes
+    PCLIP_BACKEND pBackend;                 // the backend this clipboard is reached by
+} MEM_CLIPBOARD, *PMEM_CLIPBOARD;
+
+
+// FUNCTION DECLARATIONS
+//
+void  MemClipInit( PMEM_CLIPBOARD pClip, PCLIP_BACKEND pBackend );
+void  MemClipFree( PMEM_CLIPBOARD pClip );
+BOOL  MemQueryBlock( PVOID pvData, PULONG pcbData );
+
+
+#endif
@@ -0,0 +1,545 @@
+/*****************************************************************************
+ * clippar.c                                                                 *
+ *                                                                           *
+ * Parallel text conversion.  A large text is divided into segments, which   *
+ * are converted at the same time by separate threads, each with its own     *
+ * conversion object.                                                        *
+ *                                                                           *
+ * A conversion is done in two passes.  ParallelOpen measures how much       *
+ * output each segment will produce, which gives the offset of every         *
+ * segment in the output; the caller then allocates a buffer of exactly the  *
+ * right size (which may be the clipboard's shared memory) and               *
+ * ParallelConvert converts each segment straight into its place in it, so   *
+ * the result never has to be copied.                                        *
+ *                                                                           *
+ * Segments are only divided at points where the conversion can safely be    *
+ * restarted: never inside a UTF-8 sequence or a surrogate pair, and (for    *
+ * DBCS codepages) only after a line feed, which is never the second byte of *
+ * a double-byte character.  The result is exactly the same as converting    *
+ * the whole text in one go with the routines in clipconv.c, fixups and all. *
+ * Each thread writes only inside its own segment's part of the output; the  *
+ * NUL at the end is added once they have all finished.                      *
+ *                                                                           *
+ * NOTE: converting UCS-2 text to a DBCS codepage modifies the source text   *
+ * in place (see ParallelOpen).                                              *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#define INCL_DOSMISC
+#define INCL_DOSPROCESS
+#include <os2.h>
+#include <process.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uconv.h>
+#include "clipconv.h"
+#include "clippar.h"
+
+
+// CONSTANTS
+//
+#ifndef QSV_NUMPROCESSORS
+#define QSV_NUMPROCESSORS   26
+#endif
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG SplitPoint( PPAR_CONVERT pConv, ULONG ulSplit, ULONG ulLength );
+ULONG RunSegments( PPAR_CONVERT pConv, PSZ *ppszFailed );
+void  SegmentThread( void *pArg );
+ULONG CountSegment( PPAR_SEGMENT pSeg );
+ULONG ConvertSegment( PPAR_SEGMENT pSeg );
+ULONG LastCharacter( PPAR_SEGMENT pSeg );
+
+
+/* ------------------------------------------------------------------------- *
+ * QueryParallelThreads                                                      *
+ *                                                                           *
+ * Returns the number of threads worth using for a parallel conversion: one  *
+ * per processor, up to MAX_PAR_THREADS.                                     *
+ * ------------------------------------------------------------------------- */
+ULONG QueryParallelThreads( void )
+{
+    ULONG ulCPUs;
+
+    if ( DosQuerySysInfo( QSV_NUMPROCESSORS, QSV_NUMPROCESSORS, &ulCPUs, sizeof(ULONG) ) != NO_ERROR )
+        return ( 1 );
+    return ( max( 1, min( ulCPUs, MAX_PAR_THREADS )));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ParallelOpen                                                              *
+ *                                                                           *
+ * Divides a text into segments and measures the converted length of each    *
+ * one.  Text too short to be worth dividing is kept in one segment, which   *
+ * is converted by the calling thread with the cached conversion object (so  *
+ * the usual rules about which thread may use it apply); each segment of a   *
+ * divided text has its own conversion object.  Conversion tables are        *
+ * created if necessary, so this must be called by the main thread unless    *
+ * they already exist.                                                       *
+ *                                                                           *
+ * NOTE: when converting from UCS-2 to a DBCS codepage, the source text is   *
+ * MODIFIED IN PLACE, as with ConvertFromUcs: surrogate pairs are collapsed  *
+ * and the UCS fixups applied, which may shorten it (pConv->pvText then      *
+ * holds the shortened text).  The caller must pass text it owns and no      *
+ * longer needs as it was; never the clipboard's own data.                   *
+ *                                                                           *
+ * ParallelClose must be called afterwards, even if this fails.              *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_CONVERT pConv : The conversion state to initialize.                *
+ *   ULONG ulCP         : The codepage to convert from or to.                *
+ *   BOOL fToUcs        : TRUE to convert from the codepage to UCS-2; FALSE  *
+ *                        to convert from UCS-2 to the codepage.             *
+ *   PVOID pvText       : The NUL-terminated text to convert.                *
+ *   ULONG ulLength     : Length of the text in bytes or UniChars.           *
+ *   ULONG ulThreads    : The maximum number of threads to use.              *
+ *   PSZ *ppszFailed    : Receives the name of the failing function.         *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.  On success, pConv->ulOutLength is the    *
+ *   length of the converted text in UniChars or bytes (not counting NUL).   *
+ * ------------------------------------------------------------------------- */
+ULONG ParallelOpen( PPAR_CONVERT pConv, ULONG ulCP, BOOL fToUcs, PVOID pvText, ULONG ulLength, ULONG ulThreads, PSZ *ppszFailed )
+{
+    PPAR_SEGMENT pSeg;                  // segment being set up
+    ULONG        ulWanted,              // number of segments wanted
+                 ulStart,               // start of the next segment
+                 ulEnd,                 // end of the next segment
+                 ulRC,                  // return code
+                 i;
+
+
+    memset( pConv, 0, sizeof(PAR_CONVERT) );
+    pConv->ulCP   = ulCP;
+    pConv->fToUcs = fToUcs;
+    pConv->pvText = pvText;
+    if ( ulCP != CP_UTF8 ) pConv->pTable = GetSbcsTable( ulCP, TRUE );
+
+    // Text for a DBCS codepage is fixed up beforehand, as ConvertFromUcs does
+    if ( ! fToUcs && ( ulCP != CP_UTF8 ) && ! pConv->pTable ) {
+        CollapseSurrogates( (UniChar *) pvText );
+        ulLength = FixupUcsText( (UniChar *) pvText, ulCP );
+    }
+
+    // Divide the text into roughly equal segments
+    ulWanted = min( min( ulThreads, MAX_PAR_THREADS ), ulLength / PAR_MIN_SEGMENT );
+    if ( ! ulWanted ) ulWanted = 1;
+    for ( ulStart = 0, i = 0; i < ulWanted; i++ ) {
+        ulEnd = ( i == ulWanted - 1 ) ? ulLength :
+                SplitPoint( pConv, ( ulLength / ulWanted ) * ( i + 1 ), ulLength );
+        if ( ulEnd <= ulStart ) continue;
+        pSeg = &(pConv->aSeg[ pConv->ulSegments++ ]);
+        pSeg->pConv    = pConv;
+        pSeg->ulStart  = ulStart;
+        pSeg->ulLength = ulEnd - ulStart;
+        ulStart = ulEnd;
+    }
+
+    // Each segment of a divided text needs its own conversion object
+    if (( ulCP != CP_UTF8 ) && ! pConv->pTable ) {
+        for ( i = 0; i < pConv->ulSegments; i++ ) {
+            pSeg = &(pConv->aSeg[ i ]);
+            if ( pConv->ulSegments == 1 )
+                ulRC = GetUconvObject( ulCP, &(pSeg->uconv) );
+            else if (( ulRC = CreateUconvObject( ulCP, &(pSeg->uconv) )) == ULS_SUCCESS )
+                pSeg->fPrivate = TRUE;
+            if ( ulRC != ULS_SUCCESS ) {
+                *ppszFailed = "UniCreateUconvObject()";
+                return ( ulRC );
+            }
+        }
+    }
+
+    // Measure every segment, and work out where each one goes
+    if (( ulRC = RunSegments( pConv, ppszFailed )) != ULS_SUCCESS ) return ( ulRC );
+    for ( i = 0; i < pConv->ulSegments; i++ ) {
+        pConv->aSeg[ i ].ulOffset = pConv->ulOutLength;
+        pConv->ulOutLength += pConv->aSeg[ i ].ulOutLength;
+    }
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ParallelConvert                                                           *
+ *                                                                           *
+ * Converts the text measured by ParallelOpen into the caller's buffer,      *
+ * which must have room for pConv->ulOutLength UniChars or bytes plus a NUL. *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_CONVERT pConv: The conversion state.                               *
+ *   PVOID pvOut       : The output buffer.                                  *
+ *   PSZ *ppszFailed   : Receives the name of the failing function.          *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG ParallelConvert( PPAR_CONVERT pConv, PVOID pvOut, PSZ *ppszFailed )
+{
+    ULONG ulRC;
+
+    pConv->pvOut = pvOut;
+    if (( ulRC = RunSegments( pConv, ppszFailed )) == ULS_SUCCESS ) {
+        if ( pConv->fToUcs ) ((UniChar *) pvOut )[ pConv->ulOutLength ] = 0;
+        else                 ((PCHAR) pvOut )[ pConv->ulOutLength ]    = '\0';
+
+        // (the DBCS fixups are few and cheap, so they are done in one go)
+        if ( pConv->fToUcs && ( pConv->ulCP != CP_UTF8 ) && ! pConv->pTable )
+            FixupUcsText( (UniChar *) pvOut, pConv->ulCP );
+    }
+    pConv->pvOut = NULL;
+    return ( ulRC );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ParallelClose                                                             *
+ *                                                                           *
+ * Frees the conversion objects used by a parallel conversion.               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_CONVERT pConv: The conversion state.                               *
+ * ------------------------------------------------------------------------- */
+void ParallelClose( PPAR_CONVERT pConv )
+{
+    ULONG i;
+
+    for ( i = 0; i < pConv->ulSegments; i++ ) {
+        if ( pConv->aSeg[ i ].fPrivate ) UniFreeUconvObject( pConv->aSeg[ i ].uconv );
+        pConv->aSeg[ i ].fPrivate = FALSE;
+    }
+    pConv->ulSegments = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * SplitPoint                                                                *
+ *                                                                           *
+ * Moves a proposed segment boundary forward to the nearest point where the  *
+ * conversion can safely be restarted.                                       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_CONVERT pConv: The conversion state.                               *
+ *   ULONG ulSplit     : The proposed boundary (start of the next segment).  *
+ *   ULONG ulLength    : Length of the text.                                 *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The boundary to use (ulLength if there is none).                        *
+ * ------------------------------------------------------------------------- */
+ULONG SplitPoint( PPAR_CONVERT pConv, ULONG ulSplit, ULONG ulLength )
+{
+    PUCHAR  pb  = (PUCHAR) pConv->pvText;
+    UniChar *psu = (UniChar *) pConv->pvText;
+
+    if ( ! pConv->fToUcs ) {
+        if (( ulSplit < ulLength ) && IS_LOW_SURROGATE( psu[ ulSplit ] ) &&
+            IS_HIGH_SURROGATE( psu[ ulSplit - 1 ] ))
+            ulSplit++;
+    }
+    else if ( pConv->ulCP == CP_UTF8 ) {
+        while (( ulSplit < ulLength ) && (( pb[ ulSplit ] & 0xC0 ) == 0x80 )) ulSplit++;
+    }
+    else if ( ! pConv->pTable ) {
+        while (( ulSplit < ulLength ) && ( pb[ ulSplit - 1 ] != '\n' )) ulSplit++;
+    }
+    return ( ulSplit );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RunSegments                                                               *
+ *                                                                           *
+ * Measures (if pConv->pvOut is NULL) or converts every segment, one per     *
+ * thread.  The calling thread does the first segment itself, and any that   *
+ * a thread could not be started for.                                        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_CONVERT pConv: The conversion state.                               *
+ *   PSZ *ppszFailed   : Receives the name of the failing function.          *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS, or the error code from the first segment that failed.      *
+ * ------------------------------------------------------------------------- */
+ULONG RunSegments( PPAR_CONVERT pConv, PSZ *ppszFailed )
+{
+    TID   atid[ MAX_PAR_THREADS ];      // threads started for each segment
+    ULONG i;
+    int   iTid;
+
+
+    for ( i = 1; i < pConv->ulSegments; i++ ) {
+        if (( iTid = _beginthread( SegmentThread, NULL, PAR_STACK, &(pConv->aSeg[ i ]) )) == -1 ) {
+            atid[ i ] = 0;
+            SegmentThread( &(pConv->aSeg[ i ]) );
+        }
+        else
+            atid[ i ] = (TID) iTid;
+    }
+    if ( pConv->ulSegments ) SegmentThread( &(pConv->aSeg[ 0 ]) );
+    for ( i = 1; i < pConv->ulSegments; i++ ) {
+        if ( atid[ i ] ) DosWaitThread( &atid[ i ], DCWW_WAIT );
+    }
+
+    for ( i = 0; i < pConv->ulSegments; i++ ) {
+        if ( pConv->aSeg[ i ].ulRC != ULS_SUCCESS ) {
+            *ppszFailed = pConv->aSeg[ i ].pszFailed;
+            return ( pConv->aSeg[ i ].ulRC );
+        }
+    }
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * SegmentThread                                                             *
+ *                                                                           *
+ * Measures or converts one segment (see RunSegments).                       *
+ * ------------------------------------------------------------------------- */
+void SegmentThread( void *pArg )
+{
+    PPAR_SEGMENT pSeg = (PPAR_SEGMENT) pArg;
+
+    pSeg->pszFailed = NULL;
+    pSeg->ulRC = pSeg->pConv->pvOut ? ConvertSegment( pSeg ) : CountSegment( pSeg );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * CountSegment                                                              *
+ *                                                                           *
+ * Works out the length of a segment once converted, in UniChars or bytes.   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_SEGMENT pSeg: The segment; its ulOutLength is set.                 *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG CountSegment( PPAR_SEGMENT pSeg )
+{
+    PPAR_CONVERT pConv = pSeg->pConv;
+    UniChar      asuCount[ COUNT_CHARS ],   // scratch buffer for UCS-2 output
+                 *psu, *psuEnd,             // UCS-2 pointers
+                 *psuOut;                   // UCS-2 output pointer
+    CHAR         achCount[ COUNT_CHARS ];   // scratch buffer for codepage output
+    PVOID        pIn, pOut;                 // conversion pointers
+    size_t       stInLeft,                  // input left to convert
+                 stOutLeft,                 // room left in the scratch buffer
+                 stSubst;                   // number of substitutions made
+    ULONG        ulCount = 0,               // length of the converted segment
+                 ulRC;                      // return code
+
+
+    pSeg->ulOutLength = 0;
+
+    if ( pConv->fToUcs ) {
+        if ( pConv->ulCP == CP_UTF8 )
+            ulCount = Utf8ToUcs( (PCHAR) pConv->pvText + pSeg->ulStart, pSeg->ulLength, NULL, 0 );
+        else if ( pConv->pTable )
+            ulCount = pSeg->ulLength;
+        else {
+            pIn      = (PVOID)( (PCHAR) pConv->pvText + pSeg->ulStart );
+            stInLeft = pSeg->ulLength;
+            while ( stInLeft ) {
+                psuOut    = asuCount;
+                stOutLeft = COUNT_CHARS;
+                ulRC = UniUconvToUcs( pSeg->uconv, &pIn, &stInLeft, &psuOut, &stOutLeft, &stSubst );
+                ulCount += psuOut - asuCount;
+                if ( ulRC == ULS_BUFFERFULL ) continue;
+                if ( ulRC != ULS_SUCCESS ) {
+                    pSeg->pszFailed = "UniUconvToUcs()";
+                    return ( ulRC );
+                }
+                break;
+            }
+        }
+    }
+    else {
+        psu    = (UniChar *) pConv->pvText + pSeg->ulStart;
+        psuEnd = psu + pSeg->ulLength;
+        if (( pConv->ulCP == CP_UTF8 ) || pConv->pTable ) {
+            // (as UcsToUtf8 and SbcsFromUcs would produce)
+            for ( ; psu < psuEnd; psu++ ) {
+                if ( IS_HIGH_SURROGATE( *psu ) && IS_LOW_SURROGATE( psu[ 1 ] )) {
+                    ulCount += ( pConv->ulCP == CP_UTF8 ) ? 4 : 1;
+                    psu++;
+                }
+                else if ( pConv->ulCP != CP_UTF8 ) ulCount++;
+                else if ( *psu < 0x80 )            ulCount++;
+                else if ( *psu < 0x800 )           ulCount += 2;
+                else                               ulCount += 3;
+            }
+        }
+        else {
+            stInLeft = pSeg->ulLength;
+            while ( stInLeft ) {
+                pOut      = (PVOID) achCount;
+                stOutLeft = COUNT_CHARS;
+                ulRC = UniUconvFromUcs( pSeg->uconv, &psu, &stInLeft, &pOut, &stOutLeft, &stSubst );
+                ulCount += (PCHAR) pOut - achCount;
+                if ( ulRC == ULS_BUFFERFULL ) continue;
+                if ( ulRC != ULS_SUCCESS ) {
+                    pSeg->pszFailed = "UniUconvFromUcs()";
+                    return ( ulRC );
+                }
+                break;
+            }
+        }
+    }
+
+    pSeg->ulOutLength = ulCount;
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ConvertSegment                                                            *
+ *                                                                           *
+ * Converts a segment into its place in the output buffer, without writing   *
+ * outside it.  The routines used for SBCS and UTF-8 text always add a NUL,  *
+ * which would land on the first character of the next segment (while that   *
+ * is being converted by another thread), so the last character of the       *
+ * segment is converted separately (see LastCharacter): everything before it *
+ * is converted into place, and the character is then copied over the NUL.   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_SEGMENT pSeg: The segment.                                         *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG ConvertSegment( PPAR_SEGMENT pSeg )
+{
+    PPAR_CONVERT pConv = pSeg->pConv;
+    UniChar      *psuIn,                    // UCS-2 input pointer
+                 *psuOut,                   // UCS-2 output pointer
+                 asuLast[ 5 ],              // last character as UCS-2
+                 *psuLast;                  // pointer to it
+    PCHAR        pchIn,                     // codepage input pointer
+                 pchOut;                    // codepage output pointer
+    CHAR         achLast[ 5 ];              // last character in the codepage
+    UCHAR        achXlate[ 256 ];           // codepage fixups
+    PVOID        pIn, pOut;                 // conversion pointers
+    size_t       stInLeft,                  // input left to convert
+                 stOutLeft,                 // room left for output
+                 stSubst;                   // number of substitutions made
+    ULONG        ulLast,                    // start of the last source character
+                 ulTail,                    // output units of the last character
+                 ulRC,                      // return code
+                 i;
+
+
+    if ( ! pSeg->ulOutLength ) return ( ULS_SUCCESS );
+
+    if ( pConv->fToUcs ) {
+        pchIn  = (PCHAR) pConv->pvText + pSeg->ulStart;
+        psuOut = (UniChar *) pConv->pvOut + pSeg->ulOffset;
+        if (( pConv->ulCP == CP_UTF8 ) || pConv->pTable ) {
+            ulLast = LastCharacter( pSeg );
+            if ( pConv->pTable ) {
+                asuLast[ 0 ] = pConv->pTable->asuToUcs[ (UCHAR) pchIn[ ulLast ]];
+                ulTail = 1;
+                SbcsToUcs( pConv->pTable, pchIn, psuOut, pSeg->ulOutLength - ulTail + 1 );
+            }
+            else {
+                ulTail = Utf8ToUcs( pchIn + ulLast, pSeg->ulLength - ulLast, asuLast, 5 );
+                Utf8ToUcs( pchIn, ulLast, psuOut, pSeg->ulOutLength - ulTail + 1 );
+            }
+            memcpy( psuOut + pSeg->ulOutLength - ulTail, asuLast, ulTail * sizeof(UniChar) );
+        }
+        else {
+            pIn       = (PVOID) pchIn;
+            stInLeft  = pSeg->ulLength;
+            stOutLeft = pSeg->ulOutLength;
+            ulRC = UniUconvToUcs( pSeg->uconv, &pIn, &stInLeft, &psuOut, &stOutLeft, &stSubst );
+            if (( ulRC == ULS_SUCCESS ) && stInLeft ) ulRC = ULS_BUFFERFULL;
+            if ( ulRC != ULS_SUCCESS ) {
+                pSeg->pszFailed = "UniUconvToUcs()";
+                return ( ulRC );
+            }
+        }
+        return ( ULS_SUCCESS );
+    }
+
+    psuIn  = (UniChar *) pConv->pvText + pSeg->ulStart;
+    pchOut = (PCHAR) pConv->pvOut + pSeg->ulOffset;
+    if (( pConv->ulCP == CP_UTF8 ) || pConv->pTable ) {
+        // (the last character is copied out, as the text goes on after it)
+        ulLast = LastCharacter( pSeg );
+        memcpy( asuLast, psuIn + ulLast, ( pSeg->ulLength - ulLast ) * sizeof(UniChar) );
+        asuLast[ pSeg->ulLength - ulLast ] = 0;
+        psuLast = asuLast;
+        if ( pConv->pTable ) {
+            ulTail = SbcsFromUcs( pConv->pTable, &psuLast, achLast, sizeof(achLast) );
+            SbcsFromUcs( pConv->pTable, &psuIn, pchOut, pSeg->ulOutLength - ulTail + 1 );
+        }
+        else {
+            ulTail = UcsToUtf8( &psuLast, achLast, sizeof(achLast) );
+            UcsToUtf8( &psuIn, pchOut, pSeg->ulOutLength - ulTail + 1 );
+        }
+        memcpy( pchOut + pSeg->ulOutLength - ulTail, achLast, ulTail );
+        return ( ULS_SUCCESS );
+    }
+    else {
+        stInLeft  = pSeg->ulLength;
+        pOut      = (PVOID) pchOut;
+        stOutLeft = pSeg->ulOutLength;
+        ulRC = UniUconvFromUcs( pSeg->uconv, &psuIn, &stInLeft, &pOut, &stOutLeft, &stSubst );
+        if (( ulRC == ULS_SUCCESS ) && stInLeft ) ulRC = ULS_BUFFERFULL;
+        if ( ulRC != ULS_SUCCESS ) {
+            pSeg->pszFailed = "UniUconvFromUcs()";
+            return ( ulRC );
+        }
+    }
+
+    // Clean up substitution characters, as FixupLocalText does (the tables
+    // include the fixups already, and UTF-8 has none)
+    QueryTextXlate( achXlate, pConv->ulCP );
+    for ( i = 0; i < pSeg->ulOutLength; i++ )
+        pchOut[ i ] = achXlate[ (UCHAR) pchOut[ i ]];
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LastCharacter                                                             *
+ *                                                                           *
+ * Finds where the last character of an SBCS or UTF-8 segment starts, for    *
+ * ConvertSegment.  Converting the text before that point and the character  *
+ * on its own gives the same result as converting the whole segment: a       *
+ * surrogate pair is kept together, and in UTF-8 the character starts at a   *
+ * byte that is not a continuation byte (or, failing that, is the last byte, *
+ * which can then only be a stray continuation byte of its own).             *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPAR_SEGMENT pSeg: The segment (which must not be empty).               *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Offset of the last character from the start of the segment, in source   *
+ *   units; the character is at most 2 UniChars or 4 bytes long.             *
+ * ------------------------------------------------------------------------- */
+ULONG LastCharacter( PPAR_SEGMENT pSeg )
+{
+    PPAR_CONVERT pConv = pSeg->pConv;
+    PUCHAR       pb    = (PUCHAR) pConv->pvText + pSeg->ulStart;
+    UniChar      *psu  = (UniChar *) pConv->pvText + pSeg->ulStart;
+    ULONG        ulLast = pSeg->ulLength - 1,
+                 ulLead;
+
+    if ( ! pConv->fToUcs ) {
+        if (( ulLast > 0 ) && IS_HIGH_SURROGATE( psu[ ulLast - 1 ] ) && IS_LOW_SURROGATE( psu[ ulLast ] ))
+            ulLast--;
+    }
+    else if ( pConv->ulCP == CP_UTF8 ) {
+        for ( ulLead = ulLast;
+              ( ulLead > 0 ) && ( ulLast - ulLead < 3 ) && (( pb[ ulLead ] & 0xC0 ) == 0x80 );
+              ulLead-- )
+            ;
+        if ((( pb[ ulLead ] & 0xC0 ) != 0x80 ) || ( ulLead == 0 )) ulLast = ulLead;
+    }
+    return ( ulLast );
+}
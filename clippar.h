@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * clippar.h                                                                 *
+ *                                                                           *
+ * Declarations for the parallel text conversion routines (clippar.c).       *
+ * os2.h, uconv.h and clipconv.h must be included before this file.          *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPPAR_H
+#define CLIPPAR_H
+
+
+// CONSTANTS
+//
+#define MAX_PAR_THREADS 8       // maximum number of segments converted at once
+#define PAR_MIN_SEGMENT 65536   // minimum size of a segment (bytes or UniChars)
+#define PAR_STACK       65536   // stack size of each conversion thread
+
+
+// TYPES
+//
+typedef struct _PAR_SEGMENT {
+    struct _PAR_CONVERT *pConv;             // the conversion this is part of
+    ULONG       ulStart,                    // first source unit (byte or UniChar)
+                ulLength;                   // number of source units
+    ULONG       ulOffset,                   // first output unit
+                ulOutLength;                // number of output units
+    UconvObject uconv;                      // conversion object (if not SBCS/UTF-8)
+    BOOL        fPrivate;                   // uconv belongs to this segment
+    ULONG       ulRC;                       // result of the last phase
+    PSZ         pszFailed;                  // name of failed function (if any)
+} PAR_SEGMENT, *PPAR_SEGMENT;
+
+typedef struct _PAR_CONVERT {
+    ULONG       ulCP;                       // codepage converted from or to
+    BOOL        fToUcs;                     // converting from the codepage to UCS-2
+    PVOID       pvText;                     // source text
+    PSBCS_TABLE pTable;                     // conversion tables (if SBCS)
+    PVOID       pvOut;                      // output buffer (NULL while counting)
+    ULONG       ulOutLength;                // total output units (not counting NUL)
+    ULONG       ulSegments;                 // number of segments
+    PAR_SEGMENT aSeg[ MAX_PAR_THREADS ];    // the segments
+} PAR_CONVERT, *PPAR_CONVERT;
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG QueryParallelThreads( void );
+ULONG ParallelOpen( PPAR_CONVERT pConv, ULONG ulCP, BOOL fToUcs, PVOID pvText, ULONG ulLength, ULONG ulThreads, PSZ *ppszFailed );
+ULONG ParallelConvert( PPAR_CONVERT pConv, PVOID pvOut, PSZ *ppszFailed );
+void  ParallelClose( PPAR_CONVERT pConv );
+
+
+#endif
@@ -0,0 +1,484 @@
+/*****************************************************************************
+ * cliptest.c                                                                *
+ *                                                                           *
+ * Tests for the portable parts of CLIPUNI, run against the in-memory        *
+ * clipboard (clipmem.c).  Text is copied in several codepages, offered in   *
+ * every format, rendered on request and pasted back; each result is         *
+ * compared with a straightforward conversion by the routines in clipconv.c  *
+ * and checked for exact sizing, at sizes up to that of a full MLE.          *
+ *                                                                           *
+ * Prints one line per check that fails, and a summary; the exit code is     *
+ * the number of failures.                                                   *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#include <os2.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uconv.h>
+#include "cliparena.h"
+#include "clipconv.h"
+#include "clipfmt.h"
+#include "cliphist.h"
+#include "clipmem.h"
+
+
+// CONSTANTS
+//
+#define TEST_LINE       70      // characters per line of test text
+
+
+// TYPES
+//
+
+// Test text read a piece at a time, as a CLIP_SOURCE (see TestRead)
+typedef struct _TEST_READER {
+    PSZ         pszText;                    // the text
+    ULONG       ulPos;                      // bytes read so far
+    ULONG       ulPiece;                    // most bytes returned by one read
+    ULONG       ulBadOffsets;               // reads not from where the last one ended
+} TEST_READER, *PTEST_READER;
+
+
+// FUNCTION DECLARATIONS
+//
+void  Check( BOOL fOK, PSZ pszFormat, ... );
+PSZ   MakeText( ULONG ulCP, ULONG ulLength );
+BOOL  TestRender( PMEM_CLIPBOARD pClip, ULONG flFormat );
+ULONG TestRead( PCLIP_SOURCE pSource, ULONG ulOffset, PCHAR pchBuf, ULONG cbBuf );
+void  TestRoundTrip( ULONG ulCP, ULONG ulLength, ULONG ulPiece );
+void  TestSizing( ULONG ulCP );
+void  TestFormatChoice( void );
+void  TestSbcsAscii( ULONG ulCP );
+void  TestUtf8Control( void );
+void  TestHistory( void );
+
+
+// GLOBAL VARIABLES
+//
+ULONG ulChecks   = 0,           // checks made
+      ulFailures = 0;           // checks that failed
+ARENA arScratch;                // temporary buffers for rendering
+
+// Text sizes for TestSizing (in bytes), and the pieces it is read in (0 = in
+// memory); all odd, so that chunks and segments end in odd places
+ULONG aulSizes[]  = { 32769, 65537, 1048573, 4194301 };
+ULONG aulPieces[] = { 0, 4093, 65537 };
+
+// Double-byte characters (IBM-943) and UTF-8 sequences used in test text
+UCHAR abDbcs[]  = { 0x93, 0xFA, 0x96, 0x7B, 0x8C, 0xEA, 0x82, 0xA0, 0x83, 0x41 };
+UCHAR abUtf8[]  = { 0xC3, 0xA9, 0xE2, 0x82, 0xAC, 0xF0, 0x9F, 0x98, 0x80, 0xC4, 0xB1 };
+
+
+/* ------------------------------------------------------------------------- *
+ * Main program.                                                             *
+ * ------------------------------------------------------------------------- */
+int main( void )
+{
+    TestFormatChoice();
+
+    TestSbcsAscii( 850 );
+    TestSbcsAscii( 1252 );
+    TestUtf8Control();
+    TestHistory();
+
+    TestRoundTrip( 850,  1000, 0 );
+    TestRoundTrip( 1252, 1000, 0 );
+    TestRoundTrip( 1208, 1000, 0 );
+    TestRoundTrip( 943,  1000, 0 );
+    TestRoundTrip( 850,  0,    0 );
+
+    // The same, read a piece at a time (across several chunks, and a byte
+    // at a time so that every character is split)
+    TestRoundTrip( 1252, 200000, 4093 );
+    TestRoundTrip( 1208, 200000, 4093 );
+    TestRoundTrip( 943,  200000, 4093 );
+    TestRoundTrip( 1208, 1000,   1 );
+    TestRoundTrip( 943,  1000,   1 );
+    TestRoundTrip( 850,  0,      1 );
+
+    TestSizing( 850 );
+    TestSizing( 1252 );
+    TestSizing( 1208 );
+    TestSizing( 943 );
+
+    printf("cliptest: %u checks, %u failed\n", ulChecks, ulFailures );
+    ArenaFree( &arScratch );
+    FreeSbcsTables();
+    FreeUconvCache();
+    return ( (int) ulFailures );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Check                                                                     *
+ *                                                                           *
+ * Records the result of a check, describing it if it failed.                *
+ * ------------------------------------------------------------------------- */
+void Check( BOOL fOK, PSZ pszFormat, ... )
+{
+    va_list vl;
+
+    ulChecks++;
+    if ( fOK ) return;
+    ulFailures++;
+    printf("FAILED: ");
+    va_start( vl, pszFormat );
+    vprintf( pszFormat, vl );
+    va_end( vl );
+    printf("\n");
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MakeText                                                                  *
+ *                                                                           *
+ * Makes test text of the given length in a codepage: lines of every         *
+ * printable character (including those that need fixups), with multi-byte   *
+ * characters mixed in for DBCS codepages and UTF-8.  The result must be     *
+ * freed by the caller.                                                      *
+ * ------------------------------------------------------------------------- */
+PSZ MakeText( ULONG ulCP, ULONG ulLength )
+{
+    PSZ   pszText;
+    PCHAR pch;
+    ULONG ulColumn = 0,
+          ulNext   = 0x20,
+          ulSeq    = 0;
+
+    if (( pszText = (PSZ) malloc( ulLength + 1 )) == NULL ) return ( NULL );
+
+    for ( pch = pszText; pch < pszText + ulLength; ) {
+        if ( ulColumn == TEST_LINE ) {
+            *pch++ = '\r';
+            if ( pch < pszText + ulLength ) *pch++ = '\n';
+            ulColumn = 0;
+            continue;
+        }
+        ulColumn++;
+        if (( ulCP == 943 ) && ( ulColumn % 3 == 0 ) && ( pch + 2 <= pszText + ulLength )) {
+            memcpy( pch, abDbcs + ( ulSeq++ % 5 ) * 2, 2 );
+            pch += 2;
+        }
+        else if (( ulCP == CP_UTF8 ) && ( ulColumn % 3 == 0 ) && ( pch + 4 <= pszText + ulLength )) {
+            switch ( ulSeq++ % 4 ) {
+                case 0: memcpy( pch, abUtf8, 2 );     pch += 2; break;
+                case 1: memcpy( pch, abUtf8 + 2, 3 ); pch += 3; break;
+                case 2: memcpy( pch, abUtf8 + 5, 4 ); pch += 4; break;
+                case 3: memcpy( pch, abUtf8 + 9, 2 ); pch += 2; break;
+            }
+        }
+        else {
+            *pch++ = (CHAR) ulNext;
+            if ( ++ulNext > (( ulCP == 943 || ulCP == CP_UTF8 ) ? 0x7E : 0xFF )) ulNext = 0x20;
+        }
+    }
+    *pch = '\0';
+    return ( pszText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestRender                                                                *
+ *                                                                           *
+ * Renders a format on request, as the clipboard owner.                      *
+ * ------------------------------------------------------------------------- */
+BOOL TestRender( PMEM_CLIPBOARD pClip, ULONG flFormat )
+{
+    CHAR  szError[ MAX_CLIP_ERROR ];
+    ULONG cbOut;
+    BOOL  fRC;
+
+    ArenaBegin( &arScratch );
+    fRC = ClipRenderText( pClip->pBackend, flFormat, (PCLIP_SOURCE) pClip->pvOwner,
+                          &arScratch, &cbOut, szError );
+    ArenaEnd( &arScratch );
+    Check( fRC, "render format %u: %s", flFormat, szError );
+    return ( fRC );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestRead                                                                  *
+ *                                                                           *
+ * Reads test text for a CLIP_SOURCE, no more than ulPiece bytes at a time.  *
+ * ------------------------------------------------------------------------- */
+ULONG TestRead( PCLIP_SOURCE pSource, ULONG ulOffset, PCHAR pchBuf, ULONG cbBuf )
+{
+    PTEST_READER pReader = (PTEST_READER) pSource->pvReader;
+    ULONG        cbRead;
+
+    if ( ulOffset && ( ulOffset != pReader->ulPos )) pReader->ulBadOffsets++;
+    pReader->ulPos = ulOffset;
+    cbRead = min( min( cbBuf, pReader->ulPiece ), pSource->ulLength - pReader->ulPos );
+    memcpy( pchBuf, pReader->pszText + pReader->ulPos, cbRead );
+    pReader->ulPos += cbRead;
+    return ( cbRead );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestRoundTrip                                                             *
+ *                                                                           *
+ * Copies text in a codepage to the in-memory clipboard, then pastes it      *
+ * back in each format, comparing every result with a direct conversion.     *
+ * If ulPiece is not 0, the copied text is read ulPiece bytes at a time      *
+ * rather than being in memory.                                              *
+ * ------------------------------------------------------------------------- */
+void TestRoundTrip( ULONG ulCP, ULONG ulLength, ULONG ulPiece )
+{
+    CLIP_BACKEND  cbMem;
+    MEM_CLIPBOARD mcClip;
+    CLIP_SOURCE   csCopied;
+    TEST_READER   trCopied;
+    UniChar       *psuRef = NULL,       // reference conversion to UCS-2
+                  *psuNext;
+    PSZ           pszUtf8Ref = NULL,    // reference conversion to UTF-8
+                  pszFailed;
+    PVOID         pvData;
+    ULONG         flOffered,
+                  ulUniError,
+                  ulTxtError,
+                  ulFormat,
+                  ulChars,
+                  cbData,
+                  cbBlock,
+                  cbUtf8,
+                  ulRC;
+
+
+    MemClipInit( &mcClip, &cbMem );
+    mcClip.pfnRender   = TestRender;
+    mcClip.pvOwner     = &csCopied;
+    trCopied.pszText   = MakeText( ulCP, ulLength );
+    trCopied.ulPos     = 0;
+    trCopied.ulPiece   = ulPiece;
+    trCopied.ulBadOffsets = 0;
+    csCopied.pszText   = ulPiece ? NULL : trCopied.pszText;
+    csCopied.ulLength  = ulLength;
+    csCopied.ulCP      = ulCP;
+    csCopied.pvReader  = &trCopied;
+    csCopied.pfnRead   = TestRead;
+
+    ulRC = ConvertToUcs( ulCP, trCopied.pszText, ulLength, &psuRef, &pszFailed );
+    Check( ulRC == ULS_SUCCESS, "cp %u: reference conversion: %s = %08X", ulCP, pszFailed, ulRC );
+    if ( ulRC != ULS_SUCCESS ) goto done;
+    ulChars = UniStrlen( psuRef );
+    psuNext = psuRef;
+    cbUtf8  = UcsToUtf8( &psuNext, NULL, 0 );
+    if (( pszUtf8Ref = (PSZ) malloc( cbUtf8 + 1 )) == NULL ) goto done;
+    psuNext = psuRef;
+    UcsToUtf8( &psuNext, pszUtf8Ref, cbUtf8 + 1 );
+
+    // Copy
+    cbMem.pfnOpen( &cbMem );
+    cbMem.pfnEmpty( &cbMem );
+    flOffered = ClipOfferText( &cbMem, &ulUniError, &ulTxtError );
+    cbMem.pfnClose( &cbMem );
+    Check( flOffered == ( CCF_UNICODE | CCF_UTF8 | CCF_TEXT ), "cp %u: offered %X", ulCP, flOffered );
+    Check( mcClip.ulAllocs == 0, "cp %u: %u formats rendered before being asked for", ulCP, mcClip.ulAllocs );
+
+    // Paste in the codepage (as Unicode, unless it is UTF-8)
+    cbMem.pfnOpen( &cbMem );
+    ulFormat = ClipQueryText( &cbMem, ulCP, &pvData, &cbData );
+    if ( ulCP == CP_UTF8 ) {
+        Check( ulFormat == CCF_UTF8, "cp %u: pasted format %X", ulCP, ulFormat );
+        Check( pvData && ( cbData == ulLength + 1 ) && ! memcmp( pvData, trCopied.pszText, ulLength + 1 ),
+               "cp %u: UTF-8 text pasted as it is", ulCP );
+    }
+    else {
+        Check( ulFormat == CCF_UNICODE, "cp %u: pasted format %X", ulCP, ulFormat );
+        Check( pvData && ( cbData == ( ulChars + 1 ) * sizeof(UniChar) ) &&
+               ! memcmp( pvData, psuRef, cbData ), "cp %u: Unicode text (%u UniChars)", ulCP, ulChars );
+        Check( pvData && MemQueryBlock( pvData, &cbBlock ) && ( cbBlock == cbData ),
+               "cp %u: Unicode data sized %u bytes for %u", ulCP, cbBlock, cbData );
+    }
+
+    // Every other format
+    pvData = cbMem.pfnQueryData( &cbMem, CCF_UNICODE );
+    Check( pvData && MemQueryBlock( pvData, &cbBlock ) && ( cbBlock == ( ulChars + 1 ) * sizeof(UniChar) ) &&
+           ! memcmp( pvData, psuRef, cbBlock ), "cp %u: Unicode format", ulCP );
+    pvData = cbMem.pfnQueryData( &cbMem, CCF_UTF8 );
+    Check( pvData && MemQueryBlock( pvData, &cbBlock ) && ( cbBlock == cbUtf8 + 1 ) &&
+           ! memcmp( pvData, pszUtf8Ref, cbBlock ), "cp %u: UTF-8 format", ulCP );
+    pvData = cbMem.pfnQueryData( &cbMem, CCF_TEXT );
+    Check( pvData && MemQueryBlock( pvData, &cbBlock ) && ( cbBlock == ulLength + 1 ) &&
+           ! memcmp( pvData, trCopied.pszText, cbBlock ), "cp %u: plain text format", ulCP );
+    cbMem.pfnClose( &cbMem );
+    Check( mcClip.ulRenders == 3, "cp %u: %u formats rendered", ulCP, mcClip.ulRenders );
+    Check( trCopied.ulBadOffsets == 0, "cp %u: %u reads out of order", ulCP, trCopied.ulBadOffsets );
+
+    MemClipFree( &mcClip );
+    Check( mcClip.ulBlocks == 0, "cp %u: %u data blocks not freed", ulCP, mcClip.ulBlocks );
+    Check( mcClip.ulBadGuards == 0, "cp %u: %u data blocks overrun", ulCP, mcClip.ulBadGuards );
+
+done:
+    free( pszUtf8Ref );
+    free( psuRef );
+    free( trCopied.pszText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestSizing                                                                *
+ *                                                                           *
+ * Stress test of exact sizing: copies text of every size in aulSizes (up    *
+ * to the size of a full MLE), read in every way in aulPieces, and checks    *
+ * that each format is rendered into a block of exactly its size plus the    *
+ * NUL, without overrunning it, and matches a serial conversion (see         *
+ * TestRoundTrip).  Only the smaller sizes are read a piece at a time.       *
+ * ------------------------------------------------------------------------- */
+void TestSizing( ULONG ulCP )
+{
+    ULONG ulSize,
+          ulPiece;
+
+    for ( ulSize = 0; ulSize < sizeof(aulSizes) / sizeof(ULONG); ulSize++ )
+        for ( ulPiece = 0; ulPiece < sizeof(aulPieces) / sizeof(ULONG); ulPiece++ )
+            if ( ! aulPieces[ ulPiece ] || ( aulSizes[ ulSize ] <= 1048576 ))
+                TestRoundTrip( ulCP, aulSizes[ ulSize ], aulPieces[ ulPiece ] );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestFormatChoice                                                          *
+ *                                                                           *
+ * Checks which format is pasted from whatever the clipboard offers.         *
+ * ------------------------------------------------------------------------- */
+void TestFormatChoice( void )
+{
+    CLIP_BACKEND  cbMem;
+    MEM_CLIPBOARD mcClip;
+    PVOID         pvData,
+                  pvText;
+    ULONG         ulFormat,
+                  cbData;
+
+    MemClipInit( &mcClip, &cbMem );
+    cbMem.pfnOpen( &cbMem );
+    ulFormat = ClipQueryText( &cbMem, 850, &pvData, &cbData );
+    Check( ulFormat == 0 && pvData == NULL, "empty clipboard pasted as format %X", ulFormat );
+
+    cbMem.pfnAllocData( &cbMem, 6, &pvText );
+    memcpy( pvText, "hello", 6 );
+    cbMem.pfnSetData( &cbMem, CCF_TEXT, pvText );
+    ulFormat = ClipQueryText( &cbMem, 850, &pvData, &cbData );
+    Check( ulFormat == CCF_TEXT && pvData == pvText && cbData == 6,
+           "plain text only: pasted format %X (%u bytes)", ulFormat, cbData );
+
+    // A format set for rendering with no owner to render it has no data
+    cbMem.pfnSetData( &cbMem, CCF_UTF8, NULL );
+    ulFormat = ClipQueryText( &cbMem, 850, &pvData, &cbData );
+    Check( ulFormat == CCF_UTF8 && pvData == NULL, "unrendered UTF-8: pasted format %X", ulFormat );
+    Check( cbMem.pfnQueryFormats( &cbMem ) == CCF_TEXT, "unrendered format still offered" );
+
+    cbMem.pfnClose( &cbMem );
+    Check( ! cbMem.pfnSetData( &cbMem, CCF_TEXT, NULL ), "data set while the clipboard was closed" );
+    MemClipFree( &mcClip );
+    Check( mcClip.ulBlocks == 0, "%u data blocks not freed", mcClip.ulBlocks );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestSbcsAscii                                                             *
+ *                                                                           *
+ * Checks that a single-byte codepage's tables allow the ASCII fast paths,   *
+ * and that those give the same results as looking up each character, with   *
+ * 0x1A (which the fixups change) placed at every position of a word.        *
+ * ------------------------------------------------------------------------- */
+void TestSbcsAscii( ULONG ulCP )
+{
+    PSBCS_TABLE pTable;
+    ULONG       aulText[ 33 ];          // (ULONGs, to keep the text aligned)
+    PUCHAR      pbText = (PUCHAR) aulText;
+    UniChar     asuOut[ 132 ],
+                asuIn[ 132 ],
+                *psu;
+    CHAR        achOut[ 132 ];
+    ULONG       i, ulLen;
+    BOOL        fSame;
+
+    pTable = GetSbcsTable( ulCP, TRUE );
+    Check( pTable != NULL, "cp %u: no SBCS tables", ulCP );
+    if ( ! pTable ) return;
+    Check( pTable->fAscii, "cp %u: ASCII fast path not enabled", ulCP );
+
+    for ( i = 0; i < 128; i++ ) pbText[ i ] = (UCHAR)( 'A' + ( i % 26 ));
+    for ( i = 0; i < 128; i += 9 ) pbText[ i ] = 0x1A;
+    pbText[ 128 ] = '\0';
+
+    ulLen = SbcsToUcs( pTable, (PSZ) pbText, asuOut, 132 );
+    fSame = ( ulLen == 128 );
+    for ( i = 0; fSame && ( i < 128 ); i++ )
+        if ( asuOut[ i ] != pTable->asuToUcs[ pbText[ i ]] ) fSame = FALSE;
+    Check( fSame, "cp %u: SbcsToUcs differs from the table", ulCP );
+
+    for ( i = 0; i < 128; i++ ) asuIn[ i ] = (UniChar)( 'a' + ( i % 26 ));
+    for ( i = 0; i < 128; i += 7 ) asuIn[ i ] = 0x1A;
+    asuIn[ 128 ] = 0;
+    psu   = asuIn;
+    ulLen = SbcsFromUcs( pTable, &psu, achOut, sizeof( achOut ));
+    fSame = ( ulLen == 128 ) && ( psu == asuIn + 128 );
+    for ( i = 0; fSame && ( i < 128 ); i++ )
+        if ((UCHAR) achOut[ i ] != pTable->apbFromUcs[ 0 ][ asuIn[ i ]] ) fSame = FALSE;
+    Check( fSame, "cp %u: SbcsFromUcs differs from the table", ulCP );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestUtf8Control                                                           *
+ *                                                                           *
+ * Checks that U+001A is kept as it is in UTF-8, where (unlike in the        *
+ * codepages) 0x1A is not a substitution character.                          *
+ * ------------------------------------------------------------------------- */
+void TestUtf8Control( void )
+{
+    UniChar     asuText[] = { 'a', 0x1A, 'b', 0 };
+    CONV_STREAM csTest;
+    PSZ         pszText,
+                pszFailed;
+    CHAR        achBuf[ 8 ];
+    ULONG       ulLength,
+                ulRC;
+
+    ulRC = ConvertFromUcs( CP_UTF8, asuText, &pszText, &ulLength, &pszFailed );
+    Check(( ulRC == ULS_SUCCESS ) && ( ulLength == 3 ) && ! memcmp( pszText, "a\032b", 4 ),
+          "UTF-8: U+001A changed by ConvertFromUcs");
+    if ( ulRC == ULS_SUCCESS ) free( pszText );
+
+    ulRC = StreamFromUcsOpen( &csTest, CP_UTF8, asuText, FALSE, &pszFailed );
+    if ( ulRC == ULS_SUCCESS ) {
+        ulRC = StreamFromUcs( &csTest, achBuf, sizeof(achBuf), &ulLength, &pszFailed );
+        StreamFromUcsClose( &csTest );
+    }
+    Check(( ulRC == ULS_SUCCESS ) && ( ulLength == 3 ) && ! memcmp( achBuf, "a\032b", 4 ),
+          "UTF-8: U+001A changed by StreamFromUcs");
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TestHistory                                                               *
+ *                                                                           *
+ * Checks that the clipboard history keeps copied text, counts copies of     *
+ * text it already holds, and refuses empty text.                            *
+ * ------------------------------------------------------------------------- */
+void TestHistory( void )
+{
+    HISTORY     hsTest;
+    PHIST_ENTRY pEntry;
+    CHAR        szText[] = "history";
+
+    memset( &hsTest, 0, sizeof(hsTest) );
+    Check( HistoryAdd( &hsTest, szText, 7, 850 ), "history: text not added");
+    Check( HistoryAdd( &hsTest, szText, 7, 850 ) && ( hsTest.ulDuplicates == 1 ),
+           "history: duplicate not recognized");
+    Check( ! HistoryAdd( &hsTest, szText, 0, 850 ), "history: empty text added");
+    Check( hsTest.ulEntries == 1, "history: %u entries instead of 1", hsTest.ulEntries );
+    pEntry = HistoryRecall( &hsTest );
+    Check( pEntry && ( pEntry->cbText == 7 ) && ! memcmp( pEntry->pszText, szText, 7 ),
+           "history: recalled the wrong text");
+    HistoryFree( &hsTest );
+}
@@ -0,0 +1,327 @@
+/*****************************************************************************
+ * cliptrace.c                                                               *
+ *                                                                           *
+ * Lightweight tracing of clipboard operations for CLIPUNI.  Each operation  *
+ * (paste, copy, render) is timed stage by stage using the high-resolution   *
+ * timer, and the result is stored in a fixed-size ring of recent records    *
+ * along with a per-operation latency histogram.  Nothing is allocated or    *
+ * written to disk while tracing; the data is only formatted on request.     *
+ *                                                                           *
+ * Operations may nest (e.g. rendering our own clipboard data while pasting  *
+ * it); a nested operation is simply counted as part of the outer one.       *
+ * The time each operation holds the clipboard open is recorded separately.  *
+ * Only the thread that starts the first operation (normally the PM thread)  *
+ * is traced; calls made from any other thread are ignored.                  *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#define INCL_DOSPROCESS
+#define INCL_DOSPROFILE
+#include <os2.h>
+#include <stdio.h>
+#include <string.h>
+#include "cliptrace.h"
+
+
+// FUNCTION DECLARATIONS
+//
+ULONG TraceTicksToUsec( ULONG ulTicks );
+TID   TraceQueryThread( void );
+
+
+// GLOBAL VARIABLES
+//
+TRACE_RECORD aTraceRing[ TRACE_RING ];          // the most recent operations
+TRACE_RECORD trCurrent;                         // the operation in progress
+QWORD        qwTraceStart,                      // timer value at start of operation
+             qwTraceMark,                       // timer value at last stage change
+             qwHoldStart;                       // timer value when clipboard was opened
+ULONG        ulTraceSeq   = 0,                  // number of operations recorded
+             ulTraceDepth = 0,                  // nesting level of TraceBegin calls
+             ulTraceStage = TST_NONE,           // stage currently being timed
+             ulHoldTicks  = 0,                  // clipboard hold time (ticks)
+             ulTmrFreq    = 0;                  // timer frequency (ticks per second)
+TID          tidTrace     = 0;                  // the thread being traced
+BOOL         fHolding     = FALSE;              // the clipboard is open
+
+ULONG aulTraceHist[ TOP_COUNT ][ TRACE_BUCKETS ],   // latency histograms
+      aulTraceCount[ TOP_COUNT ],                   // number of operations
+      aulTraceMax[ TOP_COUNT ],                     // slowest operation (usec)
+      aulHoldMax[ TOP_COUNT ];                      // longest clipboard hold (usec)
+double adTraceTotal[ TOP_COUNT ],                   // total time (usec)
+       adHoldTotal[ TOP_COUNT ];                    // total clipboard hold time (usec)
+
+PSZ apszTraceOps[ TOP_COUNT ]    = { "paste", "copy", "render", "import",
+                                     "recall" };
+PSZ apszTraceStages[ TST_COUNT ] = { "other", "open", "query", "convert",
+                                     "fixup", "output", "close", "history" };
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceBegin                                                                *
+ *                                                                           *
+ * Starts timing a new operation.  If an operation is already in progress,   *
+ * the new one is treated as part of it.                                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulOp: The operation being started (TOP_*).                        *
+ * ------------------------------------------------------------------------- */
+void TraceBegin( ULONG ulOp )
+{
+    if ( ! tidTrace ) tidTrace = TraceQueryThread();
+    else if ( TraceQueryThread() != tidTrace ) return;
+    if ( ulTraceDepth++ ) return;
+
+    if ( ! ulTmrFreq ) DosTmrQueryFreq( &ulTmrFreq );
+    memset( &trCurrent, 0, sizeof(trCurrent) );
+    trCurrent.ulOp = ulOp;
+    ulTraceStage   = TST_NONE;
+    ulHoldTicks    = 0;
+    fHolding       = FALSE;
+    DosTmrQueryTime( &qwTraceStart );
+    qwTraceMark = qwTraceStart;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceStage                                                                *
+ *                                                                           *
+ * Switches the current operation to a new stage; the time since the last    *
+ * switch is added to the stage that was current until now.                  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulStage: The stage being entered (TST_*).                         *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The previous stage, so that the caller can return to it.                *
+ * ------------------------------------------------------------------------- */
+ULONG TraceStage( ULONG ulStage )
+{
+    QWORD qwNow;
+    ULONG ulPrev;
+
+    if ( ! ulTraceDepth || ( TraceQueryThread() != tidTrace )) return ( TST_NONE );
+
+    DosTmrQueryTime( &qwNow );
+    trCurrent.aulStage[ ulTraceStage ] += qwNow.ulLo - qwTraceMark.ulLo;
+    qwTraceMark  = qwNow;
+    ulPrev       = ulTraceStage;
+    ulTraceStage = ulStage;
+    return ( ulPrev );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceClipboard                                                            *
+ *                                                                           *
+ * Records that the current operation has opened or closed the clipboard;    *
+ * the time in between is added to the operation's clipboard hold time.      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   BOOL fOpen: TRUE if the clipboard was opened, FALSE if it was closed.   *
+ * ------------------------------------------------------------------------- */
+void TraceClipboard( BOOL fOpen )
+{
+    QWORD qwNow;
+
+    if ( ! ulTraceDepth || ( TraceQueryThread() != tidTrace )) return;
+
+    DosTmrQueryTime( &qwNow );
+    if ( fOpen )
+        qwHoldStart = qwNow;
+    else if ( fHolding )
+        ulHoldTicks += qwNow.ulLo - qwHoldStart.ulLo;
+    fHolding = fOpen;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceInfo                                                                 *
+ *                                                                           *
+ * Records the codepage and clipboard format used by the current operation.  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulCP    : The codepage.                                           *
+ *   ULONG ulFormat: The clipboard format(s) involved (CCF_*).               *
+ * ------------------------------------------------------------------------- */
+void TraceInfo( ULONG ulCP, ULONG ulFormat )
+{
+    if (( ulTraceDepth != 1 ) || ( TraceQueryThread() != tidTrace )) return;
+    trCurrent.ulCP     = ulCP;
+    trCurrent.ulFormat = ulFormat;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceBytes                                                                *
+ *                                                                           *
+ * Records the amount of text handled by the current operation.              *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG cbIn : Bytes of source text.                                      *
+ *   ULONG cbOut: Bytes of resulting text.                                   *
+ * ------------------------------------------------------------------------- */
+void TraceBytes( ULONG cbIn, ULONG cbOut )
+{
+    if (( ulTraceDepth != 1 ) || ( TraceQueryThread() != tidTrace )) return;
+    trCurrent.cbIn  = cbIn;
+    trCurrent.cbOut = cbOut;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceEnd                                                                  *
+ *                                                                           *
+ * Finishes timing the current operation, and adds it to the trace ring and  *
+ * the latency histogram.                                                    *
+ * ------------------------------------------------------------------------- */
+void TraceEnd( void )
+{
+    PTRACE_RECORD pRecord;
+    ULONG         ulOp,
+                  ulTime,
+                  i;
+
+    if ( ! ulTraceDepth || ( TraceQueryThread() != tidTrace )) return;
+    if ( --ulTraceDepth ) return;
+
+    TraceStage( TST_NONE );
+    if ( fHolding ) ulHoldTicks += qwTraceMark.ulLo - qwHoldStart.ulLo;
+    fHolding = FALSE;
+    for ( i = 0; i < TST_COUNT; i++ )
+        trCurrent.aulStage[ i ] = TraceTicksToUsec( trCurrent.aulStage[ i ] );
+    trCurrent.ulTotal = TraceTicksToUsec( qwTraceMark.ulLo - qwTraceStart.ulLo );
+    trCurrent.ulHold  = TraceTicksToUsec( ulHoldTicks );
+    trCurrent.ulSeq   = ++ulTraceSeq;
+
+    pRecord  = &aTraceRing[ ulTraceSeq % TRACE_RING ];
+    *pRecord = trCurrent;
+
+    // Bucket n of the histogram counts operations taking < 2^n microseconds
+    ulOp = trCurrent.ulOp;
+    for ( i = 0, ulTime = trCurrent.ulTotal; ulTime && ( i < TRACE_BUCKETS - 1 ); i++ )
+        ulTime >>= 1;
+    aulTraceHist[ ulOp ][ i ]++;
+    aulTraceCount[ ulOp ]++;
+    adTraceTotal[ ulOp ] += trCurrent.ulTotal;
+    if ( trCurrent.ulTotal > aulTraceMax[ ulOp ] )
+        aulTraceMax[ ulOp ] = trCurrent.ulTotal;
+    adHoldTotal[ ulOp ] += trCurrent.ulHold;
+    if ( trCurrent.ulHold > aulHoldMax[ ulOp ] )
+        aulHoldMax[ ulOp ] = trCurrent.ulHold;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceSummary                                                              *
+ *                                                                           *
+ * Formats a short summary of the traced operations (count, average and      *
+ * maximum latency, and clipboard hold time, for each type of operation).    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PSZ pszBuf  : Buffer to receive the summary.                            *
+ *   ULONG cbBuf : Size of the buffer.                                       *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Length of the summary.                                                  *
+ * ------------------------------------------------------------------------- */
+ULONG TraceSummary( PSZ pszBuf, ULONG cbBuf )
+{
+    CHAR  szLine[ 160 ];
+    ULONG ulLen = 0,
+          i;
+
+    if ( ! cbBuf ) return ( 0 );
+    *pszBuf = '\0';
+
+    for ( i = 0; i < TOP_COUNT; i++ ) {
+        if ( ! aulTraceCount[ i ] ) continue;
+        sprintf( szLine, "%s: %u, avg %u us, max %u us; clipboard held avg %u us, max %u us\n",
+                 apszTraceOps[ i ], aulTraceCount[ i ],
+                 (ULONG)( adTraceTotal[ i ] / aulTraceCount[ i ] ), aulTraceMax[ i ],
+                 (ULONG)( adHoldTotal[ i ] / aulTraceCount[ i ] ), aulHoldMax[ i ] );
+        if ( ulLen + strlen( szLine ) >= cbBuf ) break;
+        strcpy( pszBuf + ulLen, szLine );
+        ulLen += strlen( szLine );
+    }
+    return ( ulLen );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceDump                                                                 *
+ *                                                                           *
+ * Writes the trace ring (oldest record first) and the latency histograms    *
+ * to a text file.                                                           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PSZ pszFile: Name of the file to write.                                 *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the file was written.                                           *
+ * ------------------------------------------------------------------------- */
+BOOL TraceDump( PSZ pszFile )
+{
+    PTRACE_RECORD pRecord;
+    FILE          *pf;
+    ULONG         ulSeq,
+                  i, j;
+
+    if (( pf = fopen( pszFile, "w")) == NULL ) return ( FALSE );
+
+    fprintf( pf, "%-6s %-6s %5s %3s %9s %9s %9s %9s", "seq", "op", "cp", "fmt",
+             "bytes-in", "bytes-out", "total-us", "hold-us");
+    for ( j = 0; j < TST_COUNT; j++ ) fprintf( pf, " %9s", apszTraceStages[ j ] );
+    fprintf( pf, "\n");
+
+    ulSeq = ( ulTraceSeq > TRACE_RING ) ? ulTraceSeq - TRACE_RING + 1 : 1;
+    for ( ; ulSeq <= ulTraceSeq; ulSeq++ ) {
+        pRecord = &aTraceRing[ ulSeq % TRACE_RING ];
+        fprintf( pf, "%-6u %-6s %5u %3X %9u %9u %9u %9u", pRecord->ulSeq,
+                 apszTraceOps[ pRecord->ulOp ], pRecord->ulCP, pRecord->ulFormat,
+                 pRecord->cbIn, pRecord->cbOut, pRecord->ulTotal, pRecord->ulHold );
+        for ( j = 0; j < TST_COUNT; j++ ) fprintf( pf, " %9u", pRecord->aulStage[ j ] );
+        fprintf( pf, "\n");
+    }
+
+    for ( i = 0; i < TOP_COUNT; i++ ) {
+        if ( ! aulTraceCount[ i ] ) continue;
+        fprintf( pf, "\n%s latency histogram (%u operations):\n",
+                 apszTraceOps[ i ], aulTraceCount[ i ] );
+        for ( j = 0; j < TRACE_BUCKETS; j++ ) {
+            if ( aulTraceHist[ i ][ j ] )
+                fprintf( pf, "  < %10u us: %u\n", 1U << j, aulTraceHist[ i ][ j ] );
+        }
+    }
+
+    fclose( pf );
+    return ( TRUE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceTicksToUsec                                                          *
+ *                                                                           *
+ * Converts a high-resolution timer interval into microseconds.              *
+ * ------------------------------------------------------------------------- */
+ULONG TraceTicksToUsec( ULONG ulTicks )
+{
+    if ( ! ulTmrFreq ) return ( 0 );
+    return (ULONG)(( (double) ulTicks * 1000000.0 ) / ulTmrFreq );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TraceQueryThread                                                          *
+ *                                                                           *
+ * Returns the ID of the calling thread.                                     *
+ * ------------------------------------------------------------------------- */
+TID TraceQueryThread( void )
+{
+    PTIB ptib;
+    PPIB ppib;
+
+    DosGetInfoBlocks( &ptib, &ppib );
+    return ( ptib->tib_ptib2->tib2_ultid );
+}
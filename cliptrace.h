@@ -0,0 +1,67 @@
+/*****************************************************************************
+ * cliptrace.h                                                               *
+ *                                                                           *
+ * Declarations for the clipboard operation tracing routines (cliptrace.c).  *
+ * These do not depend on Presentation Manager; os2.h must be included       *
+ * before this file.                                                         *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef CLIPTRACE_H
+#define CLIPTRACE_H
+
+
+// CONSTANTS
+//
+#define TRACE_RING      128     // number of operations kept in the trace ring
+#define TRACE_BUCKETS   24      // number of latency histogram buckets
+
+// Traced operations
+#define TOP_PASTE       0       // paste into the MLE
+#define TOP_COPY        1       // copy or cut from the MLE
+#define TOP_RENDER      2       // render a clipboard format on request
+#define TOP_IMPORT      3       // import one piece of an asynchronous paste
+#define TOP_RECALL      4       // put an earlier copy back on the clipboard
+#define TOP_COUNT       5
+
+// Stages of an operation
+#define TST_NONE        0       // (not in any stage)
+#define TST_OPEN        1       // opening the clipboard
+#define TST_QUERY       2       // querying clipboard or MLE data
+#define TST_CONVERT     3       // converting text
+#define TST_FIXUP       4       // applying fixups to converted text
+#define TST_OUTPUT      5       // inserting into the MLE or setting clipboard data
+#define TST_CLOSE       6       // closing the clipboard
+#define TST_HISTORY     7       // recording copied text in the history
+#define TST_COUNT       8
+
+
+// TYPES
+//
+typedef struct _TRACE_RECORD {
+    ULONG       ulSeq;                      // operation sequence number
+    ULONG       ulOp;                       // operation (TOP_*)
+    ULONG       ulCP;                       // codepage used
+    ULONG       ulFormat;                   // clipboard format(s) involved (CCF_*)
+    ULONG       cbIn,                       // bytes of source text
+                cbOut;                      // bytes of resulting text
+    ULONG       aulStage[ TST_COUNT ];      // time spent in each stage (usec)
+    ULONG       ulTotal;                    // total time taken (usec)
+    ULONG       ulHold;                     // time the clipboard was held open (usec)
+} TRACE_RECORD, *PTRACE_RECORD;
+
+
+// FUNCTION DECLARATIONS
+//
+void  TraceBegin( ULONG ulOp );
+ULONG TraceStage( ULONG ulStage );
+void  TraceClipboard( BOOL fOpen );
+void  TraceInfo( ULONG ulCP, ULONG ulFormat );
+void  TraceBytes( ULONG cbIn, ULONG cbOut );
+void  TraceEnd( void );
+ULONG TraceSummary( PSZ pszBuf, ULONG cbBuf );
+BOOL  TraceDump( PSZ pszFile );
+
+
+#endif
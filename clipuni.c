@@ -9,12 +9,17 @@
  *     clipboard format, it will be converted into the current codepage.     *
  *   - When copying text, it will be converted from the current codepage     *
  *     into UCS-2 (Unicode).                                                 *
+ * UTF-8 text ("text/plain;charset=utf-8") is supported in the same way.     *
+ * Large pastes are converted by a background thread (see clipjob.c), and    *
+ * can be cancelled with Esc while in progress.                              *
  * No other functionality (such as loading, saving or printing) is provided. *
  *                                                                           *
  * CLIPUNI, along with its source code, is hereby placed into the public     *
  * domain.  It may freely be used for any purpose, commercial or otherwise.  *
  *****************************************************************************/
 
+#define INCL_DOSPROCESS
+#define INCL_DOSSEMAPHORES
 #define INCL_GPI
 #define INCL_WIN
 #include <os2.h>
@@ -23,13 +28,30 @@
 #include <string.h>
 #include <uconv.h>
 #include "ids.h"
+#include "cliparena.h"
+#include "clipconv.h"
+#include "clipfmt.h"
+#include "cliphist.h"
+#include "clipjob.h"
+#include "clippar.h"
+#include "cliptrace.h"
 
 
 // CONSTANTS
 //
-#define MAX_CP_NAME     12      // maximum length of a codepage name
-#define MAX_CP_SPEC     64      // maximum length of a UconvObject codepage specifier
 #define MAX_ERROR       256     // maximum length of an error popup message
+#define MAX_TITLE       128     // maximum length of the window title
+#define APP_TITLE       "Unicode Clipboard Demonstration"
+#define PASTE_CHUNK     32768   // size of the buffer used to import pasted text
+#define EXPORT_CHUNK    65536   // maximum bytes exported from the MLE at once
+#define MAX_DIAG        1024    // maximum length of the diagnostics popup message
+#define TRACE_FILE      "clipuni.trc"   // file that the operation trace is written to
+#define ASYNC_CHARS     262144  // pastes of at least this many UniChars use the worker
+#define WM_SHOWERROR    ( WM_USER + 10 )    // show the deferred error message
+#define WM_CAPTURE      ( WM_USER + 11 )    // record the copied text in the history
+#define TID_ARENA       1       // timer for shrinking idle scratch memory
+#define ARENA_IDLE      10000   // scratch memory is shrunk after this long unused (ms)
+#define PASTE_CACHE_MAX 8388608 // largest converted paste kept for reuse (bytes)
 
 // MACROS
 //
@@ -37,6 +59,31 @@
     WinMessageBox( HWND_DESKTOP, HWND_DESKTOP, text, "Error", 0, MB_OK | MB_ERROR )
 
 
+// TYPES
+//
+typedef struct _PASTE_CACHE {
+    ULONG       ulFormat;                   // clipboard format pasted (CCF_*, 0 = empty)
+    ULONG       ulCP;                       // codepage it was converted into
+    ULONG       cbSource;                   // size of the clipboard data
+    ULONG       ulHash;                     // hash of the clipboard data (see HashText)
+    PVOID       pvSource;                   // copy of the clipboard data (cbSource bytes)
+    PSZ         pszText;                    // the converted text
+    ULONG       cbText,                     // length of pszText
+                cbAlloc;                    // size of the pszText buffer
+    BOOL        fComplete;                  // pszText holds all of the converted text
+    PVOID       pvFiller;                   // paste job filling it (NULL = DoPaste)
+} PASTE_CACHE, *PPASTE_CACHE;
+
+typedef struct _MLE_SELECTION {
+    HWND        hwndMLE;                    // the MLE (NULLHANDLE = none)
+    IPT         iptStart,                   // start of the selected text
+                iptEnd;                     // end of the selected text
+    ULONG       ulLength;                   // its length in bytes, as exported
+    IPT         iptNext;                    // next character to be read
+    LONG        lLeft;                      // characters left to be read
+} MLE_SELECTION, *PMLE_SELECTION;
+
+
 // FUNCTION DECLARATIONS
 //
 MRESULT EXPENTRY ClientWndProc( HWND, ULONG, MPARAM, MPARAM );
@@ -44,6 +91,39 @@ MRESULT EXPENTRY SubMLEProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 );
 MRESULT          PaintClient( HWND );
 ULONG            DoPaste( HWND hwndMLE );
 ULONG            DoCopyCut( HWND hwndMLE, BOOL fCut );
+ULONG            RecallHistory( HWND hwndMLE );
+ULONG            OfferText( HWND hwndMLE, PSZ pszText, PMLE_SELECTION pSel, ULONG ulLength, ULONG ulCP, BOOL fCut );
+void             QuerySelection( HWND hwndMLE, PMLE_SELECTION pSel );
+PSZ              ExportSelection( PMLE_SELECTION pSel, PARENA pArena, PULONG pulLength );
+ULONG            ReadSelection( PCLIP_SOURCE pSource, ULONG ulOffset, PCHAR pchBuf, ULONG cbBuf );
+void             HoldPendingText( void );
+BOOL             IsMoveKey( USHORT usVK );
+BOOL             RenderClipFormat( ULONG flFormat );
+void             DiscardPending( void );
+void             CapturePending( void );
+ULONG            PasteUcsText( HWND hwndMLE, ULONG ulCP, UniChar *psuText );
+ULONG            ImportUcsText( HWND hwndMLE, ULONG ulLength, PULONG pulCopied, PSZ *ppszFailed );
+ULONG            QueryActiveCp( void );
+ULONG            QueuePaste( HWND hwndMLE, ULONG ulCP, UniChar *psuText, ULONG ulChars );
+void             ImportPiece( PPASTE_JOB pJob, PPASTE_PIECE pPiece );
+void             FinishPaste( PPASTE_JOB pJob );
+void             DeferError( PSZ pszError );
+BOOL             FindCachedPaste( ULONG ulFormat, ULONG ulCP, PVOID pvSource, ULONG cbSource, ULONG ulHash );
+ULONG            PasteCachedText( HWND hwndMLE );
+void             StartPasteCache( ULONG ulFormat, ULONG ulCP, PVOID pvSource, ULONG cbSource, ULONG ulHash );
+void             AddToPasteCache( PVOID pvFiller, PCHAR pchText, ULONG cb );
+void             EndPasteCache( PVOID pvFiller, BOOL fComplete );
+void             FreePasteCache( void );
+ULONG            PmFormat( ULONG flFormat );
+BOOL             PmOpenClipbrd( PCLIP_BACKEND pBackend );
+BOOL             PmCloseClipbrd( PCLIP_BACKEND pBackend );
+BOOL             PmEmptyClipbrd( PCLIP_BACKEND pBackend );
+ULONG            PmQueryFormats( PCLIP_BACKEND pBackend );
+PVOID            PmQueryData( PCLIP_BACKEND pBackend, ULONG flFormat );
+ULONG            PmAllocData( PCLIP_BACKEND pBackend, ULONG cb, PVOID *ppvData );
+void             PmFreeData( PCLIP_BACKEND pBackend, PVOID pvData );
+BOOL             PmSetData( PCLIP_BACKEND pBackend, ULONG flFormat, PVOID pvData );
+ULONG            PmQueryError( PCLIP_BACKEND pBackend );
 
 
 // GLOBAL VARIABLES
@@ -51,7 +131,37 @@ ULONG            DoCopyCut( HWND hwndMLE, BOOL fCut );
 HAB   hab;                      // anchor-block handle
 HMQ   hmq;                      // message queue handle
 ATOM  cf_Unicode;               // atom for "text/unicode" clipboard format
+ATOM  cf_UTF8;                  // atom for "text/plain;charset=utf-8" clipboard format
 PFNWP pfnMLE;                   // default MLE window procedure
+ULONG ulLastCP = 0;             // queue codepage at the last clipboard operation
+BOOL  fWorker = FALSE;          // the conversion worker is running
+HWND  hwndApp = NULLHANDLE;     // client window (receives WM_SHOWERROR, WM_CAPTURE)
+CHAR  szDeferred[ MAX_ERROR ] = "";     // error message waiting to be shown
+PPASTE_JOB pJobActive = NULL;   // paste currently being done by the worker
+
+CONV_STREAM csPaste;                            // state for converting pasted text
+CHAR        achPasteBuf[ PASTE_CHUNK + 1 ];     // buffer for converted pasted text
+PASTE_CACHE pcPaste;                            // converted text of the last paste
+ULONG       ulPasteHits   = 0,                  // pastes served from pcPaste
+            ulPasteMisses = 0;                  // pastes that had to be converted
+
+ARENA arScratch;                // temporary buffers for one clipboard operation
+ARENA arCopy[ 2 ];              // copied text: one pending, one being exported
+ULONG ulCopyArena = 0;          // arCopy holding pszPending
+HISTORY hsCopies;               // clipboard history (see RecallHistory)
+
+PSZ   pszPending = NULL;        // copied text awaiting rendering (see DoCopyCut)
+BOOL  fCapture = FALSE;         // pszPending is still to be put in the history
+MLE_SELECTION msPending;        // where it is read from, if pszPending is NULL
+ULONG ulPendingLen = 0,         // length of the pending text in bytes
+      ulPendingCP  = 0,         // codepage of the pending text
+      flPending    = 0,         // formats not yet rendered (CCF_*)
+      ulRenders    = 0,         // number of formats rendered on request
+      ulRendersAvoided = 0;     // number of formats never requested
+
+// The PM clipboard, as used by the clipboard format routines (see clipfmt.c)
+CLIP_BACKEND cbPM = { NULL, PmOpenClipbrd, PmCloseClipbrd, PmEmptyClipbrd, PmQueryFormats,
+                      PmQueryData, PmAllocData, PmFreeData, PmSetData, PmQueryError };
 
 
 /* ------------------------------------------------------------------------- *
@@ -73,9 +183,10 @@ int main( void )
     // Create the UI controls
     if ( ! WinRegisterClass( hab, szClass, ClientWndProc, CS_SIZEREDRAW, 0 )) return ( 1 );
     hwndFrame = WinCreateStdWindow( HWND_DESKTOP, WS_VISIBLE, &flStyle,
-                                    szClass, "Unicode Clipboard Demonstration",
+                                    szClass, APP_TITLE,
                                     0L, NULLHANDLE, ID_MAIN, &hwndClient       );
     if ( ! hwndFrame ) return ( 1 );
+    hwndApp = hwndClient;
 
     hwndMLE = WinCreateWindow( hwndClient, WC_MLE, "",
                                MLS_BORDER | MLS_VSCROLL | MLS_WORDWRAP | WS_VISIBLE,
@@ -86,18 +197,40 @@ int main( void )
                      strlen("10.Monotype Sans Duospace WT J"),
                      (PVOID) "10.Monotype Sans Duospace WT J");
 
-    // Register the Unicode clipboard format
+    // Register the Unicode clipboard formats
     hSATbl     = WinQuerySystemAtomTable();
     cf_Unicode = WinAddAtom( hSATbl, "text/unicode");
+    cf_UTF8    = WinAddAtom( hSATbl, "text/plain;charset=utf-8");
+
+    // Start the conversion worker (if this fails, everything is done in-line)
+    fWorker = StartWorker();
 
     // Main program loop
     while ( WinGetMsg( hab, &qmsg, 0, 0, 0 )) WinDispatchMsg( hab, &qmsg );
 
-    // Deregister the Unicode clipboard format
+    // Abandon any paste still in progress
+    StopWorker();
+
+    // Copied text still in the MLE must be rendered while the MLE exists
+    if ( flPending && ! pszPending ) WinSendMsg( hwndClient, WM_RENDERALLFMTS, 0, 0 );
+
+    // Destroy the window first, so it can render any outstanding clipboard data
+    WinDestroyWindow( hwndFrame );
+
+    // Deregister the Unicode clipboard formats
     WinDeleteAtom( hSATbl, cf_Unicode );
+    WinDeleteAtom( hSATbl, cf_UTF8 );
+
+    // Release any cached conversion objects and tables, and scratch memory
+    FreeUconvCache();
+    FreeSbcsTables();
+    FreePasteCache();
+    HistoryFree( &hsCopies );
+    ArenaFree( &arScratch );
+    ArenaFree( &arCopy[ 0 ] );
+    ArenaFree( &arCopy[ 1 ] );
 
     // Final clean-up
-    WinDestroyWindow( hwndFrame );
     WinDestroyMsgQueue( hmq );
     WinTerminate( hab );
 
@@ -113,6 +246,9 @@ int main( void )
  * ------------------------------------------------------------------------- */
 MRESULT EXPENTRY ClientWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
 {
+    CHAR  szDiag[ MAX_DIAG ];           // diagnostics message
+    ULONG ulLen;                        // length of diagnostics message
+
     switch( msg ) {
 
         case WM_CREATE:
@@ -122,6 +258,64 @@ MRESULT EXPENTRY ClientWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
             PaintClient( hwnd );
             break;
 
+        // Delayed rendering of the clipboard data we own (see DoCopyCut)
+        //
+        case WM_RENDERFMT:
+            if ( LONGFROMMP( mp1 ) == cf_Unicode )
+                RenderClipFormat( CCF_UNICODE );
+            else if ( LONGFROMMP( mp1 ) == cf_UTF8 )
+                RenderClipFormat( CCF_UTF8 );
+            else if ( LONGFROMMP( mp1 ) == CF_TEXT )
+                RenderClipFormat( CCF_TEXT );
+            return (MRESULT) 0;
+
+        case WM_RENDERALLFMTS:
+            if ( WinOpenClipbrd(hab) ) {
+                RenderClipFormat( CCF_UNICODE );
+                RenderClipFormat( CCF_UTF8 );
+                RenderClipFormat( CCF_TEXT );
+                WinCloseClipbrd( hab );
+            }
+            return (MRESULT) 0;
+
+        case WM_DESTROYCLIPBOARD:
+            DiscardPending();
+            return (MRESULT) 0;
+
+        // Scratch memory has not been used for a while, so give it back
+        //
+        case WM_TIMER:
+            if ( SHORT1FROMMP( mp1 ) != TID_ARENA ) break;
+            WinStopTimer( hab, hwnd, TID_ARENA );
+            ArenaShrink( &arScratch );
+            ArenaShrink( &arCopy[ 1 - ulCopyArena ] );
+            if ( ! pszPending ) ArenaShrink( &arCopy[ ulCopyArena ] );
+            return (MRESULT) 0;
+
+        // An error that happened while another program had the clipboard open
+        //
+        case WM_SHOWERROR:
+            strcpy( szDiag, szDeferred );
+            szDeferred[ 0 ] = '\0';
+            if ( szDiag[ 0 ] ) ErrorPopup( szDiag );
+            return (MRESULT) 0;
+
+        // A copy has finished, and its text can go in the history
+        //
+        case WM_CAPTURE:
+            CapturePending();
+            return (MRESULT) 0;
+
+        // Progress of a paste being converted by the worker (see QueuePaste)
+        //
+        case WM_JOBPIECE:
+            ImportPiece( (PPASTE_JOB) PVOIDFROMMP( mp1 ), (PPASTE_PIECE) PVOIDFROMMP( mp2 ));
+            return (MRESULT) 0;
+
+        case WM_JOBDONE:
+            FinishPaste( (PPASTE_JOB) PVOIDFROMMP( mp1 ));
+            return (MRESULT) 0;
+
         case WM_COMMAND:
             switch( SHORT1FROMMP( mp1 )) {
 
@@ -139,6 +333,10 @@ MRESULT EXPENTRY ClientWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
                     WinSendDlgItemMsg( hwnd, IDD_MLE, MLM_COPY, 0, 0 );
                     return (MRESULT) 0;
 
+                case IDM_RECALL:
+                    RecallHistory( WinWindowFromID( hwnd, IDD_MLE ));
+                    return (MRESULT) 0;
+
 
                 // "File" menu commands...
                 //
@@ -149,6 +347,26 @@ MRESULT EXPENTRY ClientWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
 
                 // "Help" menu commands...
                 //
+                case IDM_DIAG:
+                    if (( ulLen = TraceSummary( szDiag, MAX_DIAG / 2 )) == 0 )
+                        ulLen = sprintf( szDiag, "No clipboard operations yet.\n");
+                    sprintf( szDiag + ulLen,
+                             "\nConverter cache: %u hits, %u misses\nFormats rendered: %u, never requested: %u\n"
+                             "Scratch memory: %u allocations, %u from the heap, %u KB held\n"
+                             "Paste cache: %u hits, %u misses, %u KB held\n"
+                             "History: %u entries, %u KB held, %u duplicates, %u dropped, %u recalled\n\n%s %s",
+                             ulUconvHits, ulUconvMisses, ulRenders, ulRendersAvoided,
+                             arScratch.ulAllocs + arCopy[ 0 ].ulAllocs + arCopy[ 1 ].ulAllocs,
+                             arScratch.ulHeapAllocs + arCopy[ 0 ].ulHeapAllocs + arCopy[ 1 ].ulHeapAllocs,
+                             ( arScratch.cbHeld + arCopy[ 0 ].cbHeld + arCopy[ 1 ].cbHeld ) / 1024,
+                             ulPasteHits, ulPasteMisses, pcPaste.cbAlloc / 1024,
+                             hsCopies.ulEntries, hsCopies.cbHeld / 1024, hsCopies.ulDuplicates,
+                             hsCopies.ulEvictions, hsCopies.ulRecalls,
+                             TraceDump( TRACE_FILE ) ? "Trace written to" : "Could not write", TRACE_FILE );
+                    WinMessageBox( HWND_DESKTOP, hwnd, szDiag,
+                                   "Diagnostics", 0, MB_OK | MB_MOVEABLE | MB_INFORMATION );
+                    return (MRESULT) 0;
+
                 case IDM_ABOUT:
                     WinMessageBox( HWND_DESKTOP, hwnd,
                                    "Unicode Clipboard Demonstration (v1.01)\n\n 2007 Alex Taylor\nReleased to the public domain.",
@@ -188,6 +406,15 @@ MRESULT EXPENTRY SubMLEProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
         case WM_CHAR:
             usFlags = SHORT1FROMMP( mp1 );
             usVK    = SHORT2FROMMP( mp2 );
+            // While a paste is in progress the text must not change, so only
+            // Esc (cancel) is accepted
+            if ( pJobActive ) {
+                if (( usFlags & KC_VIRTUALKEY ) && ( usVK == VK_ESC ) && ( ! (usFlags & KC_KEYUP) )) {
+                    pJobActive->fStopped = TRUE;
+                    CancelJobs();
+                }
+                return (MRESULT) TRUE;
+            }
             if (( usFlags & KC_VIRTUALKEY ) && ( ! (usFlags & KC_KEYUP) )) {
                 // Shift+Ins (paste)
                 if (( usFlags & KC_SHIFT ) && ( usVK == VK_INSERT )) {
@@ -205,9 +432,47 @@ MRESULT EXPENTRY SubMLEProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
                     return (MRESULT) TRUE;
                 }
             }
+            // Any other key but one that moves about may change the text, so
+            // copied text still being read from it must be kept first
+            if ( ! (usFlags & KC_KEYUP) && ! (( usFlags & KC_VIRTUALKEY ) && IsMoveKey( usVK )))
+                HoldPendingText();
+            break;
+
+        // (likewise for any other change to the text)
+        case MLM_INSERT:
+        case MLM_CLEAR:
+        case MLM_IMPORT:
+        case MLM_DELETE:
+        case MLM_UNDO:
+        case WM_SETWINDOWPARAMS:
+            HoldPendingText();
+            break;
+
+        // Nor may the mouse move the cursor or the selection
+        case WM_MOUSEMOVE:
+            if ( pJobActive ) {
+                WinSetPointer( HWND_DESKTOP, WinQuerySysPointer( HWND_DESKTOP, SPTR_WAIT, FALSE ));
+                return (MRESULT) TRUE;
+            }
+            break;
+
+        case WM_BUTTON1DOWN:        case WM_BUTTON1UP:          case WM_BUTTON1DBLCLK:
+        case WM_BUTTON2DOWN:        case WM_BUTTON2UP:          case WM_BUTTON2DBLCLK:
+        case WM_BUTTON3DOWN:        case WM_BUTTON3UP:          case WM_BUTTON3DBLCLK:
+        case WM_BUTTON1MOTIONSTART: case WM_BUTTON1MOTIONEND:   case WM_BUTTON1CLICK:
+        case WM_BUTTON2MOTIONSTART: case WM_BUTTON2MOTIONEND:   case WM_BUTTON2CLICK:
+        case WM_BUTTON3MOTIONSTART: case WM_BUTTON3MOTIONEND:   case WM_BUTTON3CLICK:
+        case WM_CHORD:              case WM_BEGINSELECT:        case WM_ENDSELECT:
+        case WM_SINGLESELECT:       case WM_BEGINDRAG:          case WM_ENDDRAG:
+        case WM_CONTEXTMENU:
+            if ( pJobActive ) return (MRESULT) TRUE;
             break;
 
         case MLM_CUT:
+            if ( pJobActive ) {
+                WinAlarm( HWND_DESKTOP, WA_WARNING );
+                return (MRESULT) 0;
+            }
             ulCopied = DoCopyCut( hwnd, TRUE );
             return (MRESULT) ulCopied;
 
@@ -216,6 +481,10 @@ MRESULT EXPENTRY SubMLEProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
             return (MRESULT) ulCopied;
 
         case MLM_PASTE:
+            if ( pJobActive ) {
+                WinAlarm( HWND_DESKTOP, WA_WARNING );
+                return (MRESULT) 0;
+            }
             ulCopied = DoPaste( hwnd );
             return (MRESULT) ulCopied;
 
@@ -258,87 +527,159 @@ MRESULT PaintClient( HWND hwnd )
  * DoPaste                                                                   *
  *                                                                           *
  * Pastes text from the clipboard into the MLE.  Preference is given to      *
- * clipboard data in the "text/unicode" format; if not available, we use     *
- * plain text (CF_TEXT) instead.                                             *
+ * clipboard data in the "text/unicode" format, then UTF-8 (which is used    *
+ * directly if the current codepage is UTF-8); if neither is available, we   *
+ * use plain text (CF_TEXT) instead.  (See QueryPasteFormat.)                *
+ *                                                                           *
+ * Unicode text of ASYNC_CHARS or more is copied out of the clipboard and    *
+ * handed to the conversion worker (see QueuePaste).                         *
+ *                                                                           *
+ * Text that has to be converted is kept once converted, so that pasting     *
+ * the same clipboard contents again needs no conversion at all (see         *
+ * FindCachedPaste).                                                         *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   HWND hwndMLE: Handle of the MLE that text is being pasted into.         *
  *                                                                           *
  * RETURNS: ULONG                                                            *
- *   Number of bytes pasted.                                                 *
+ *   Number of bytes pasted (0 if the paste is being done by the worker).    *
  * ------------------------------------------------------------------------- */
 ULONG DoPaste( HWND hwndMLE )
 {
-    UconvObject uconv;                      // conversion object
-    UniChar     suCodepage[ MAX_CP_SPEC ],  // conversion specifier
-                *psuClipText,               // Unicode text in clipboard
-                *puniC;                     // pointer into psuClipText
+    UniChar     *psuUtfText;                // UTF-8 clipboard text as UTF-16
+    PVOID       pvClipText,                 // text in clipboard
+                pvSnap = NULL;              // copy of the clipboard text
     CHAR        szError[ MAX_ERROR ];       // buffer for error messages
-    PSZ         pszClipText,                // plain text in clipboard
-                pszLocalText,               // imported text
-                s;                          // pointer into pszLocalText
     ULONG       ulCP,                       // codepage to be used
-                ulBufLen,                   // length of output buffer
+                ulFormat = 0,               // clipboard format being pasted
                 ulCopied,                   // number of characters copied
-                ulRC;                       // return code
-    SHORT       sIdx;                       // index of selected list item
+                ulChars,                    // length of psuUtfText
+                cbSnap = 0,                 // size of pvSnap in bytes
+                ulHash = 0;                 // hash of the clipboard text
+    BOOL        fHeapSnap = FALSE,          // pvSnap is on the heap, not in arScratch
+                fAsync,                     // the text is to be pasted by the worker
+                fCacheable,                 // the text needs converting
+                fCached = FALSE;            // the converted text is in pcPaste
 
 
     ulCopied = 0;
-    if ( WinOpenClipbrd(hab) ) {
+    ulCP     = QueryActiveCp();     // Convert text to the active codepage
+
+    TraceBegin( TOP_PASTE );
+    ArenaBegin( &arScratch );
+    TraceStage( TST_OPEN );
+    if ( ! cbPM.pfnOpen( &cbPM )) {
+        ArenaEnd( &arScratch );
+        TraceEnd();
+        return ( 0 );
+    }
+    TraceClipboard( TRUE );
+
+    //
+    // Copy the text out of the clipboard and close it again straight away, so
+    // that other programs are not kept waiting while we convert and insert it
+    // (into scratch memory, unless it is to be handed over to the worker)
+    //
+
+    TraceStage( TST_QUERY );
+    ulFormat = ClipQueryText( &cbPM, ulCP, &pvClipText, &cbSnap );
+    TraceInfo( ulCP, ulFormat );
+    fCacheable = ( ulFormat == CCF_UNICODE ) || (( ulFormat == CCF_UTF8 ) && ( ulCP != CP_UTF8 ));
+
+    if ( pvClipText != NULL ) {
+        if ( fCacheable ) {
+            ulHash  = HashText( pvClipText, cbSnap );
+            fCached = FindCachedPaste( ulFormat, ulCP, pvClipText, cbSnap, ulHash );
+        }
+        if ( ! fCached ) {
+            // (the same test as for UTF-8 below, on the length without the NUL)
+            fHeapSnap = fWorker && ( ulFormat == CCF_UNICODE ) &&
+                        (( cbSnap / sizeof(UniChar) ) - 1 >= ASYNC_CHARS );
+            pvSnap    = fHeapSnap ? malloc( cbSnap ) : ArenaAlloc( &arScratch, cbSnap );
+            if ( pvSnap != NULL ) memcpy( pvSnap, pvClipText, cbSnap );
+        }
+    }
+
+    TraceStage( TST_CLOSE );
+    cbPM.pfnClose( &cbPM );
+    TraceClipboard( FALSE );
+
+    // Pasting the same text as last time: it is already converted
+    if ( fCached ) {
+        ulCopied = PasteCachedText( hwndMLE );
+        TraceBytes( cbSnap - (( ulFormat == CCF_UNICODE ) ? sizeof(UniChar) : 1 ), ulCopied );
+        ArenaEnd( &arScratch );
+        TraceEnd();
+        return ( ulCopied );
+    }
+
+    if ( ! pvSnap ) {
+        ArenaEnd( &arScratch );
+        TraceEnd();
+        if ( cbSnap ) {
+            sprintf( szError, "Error pasting text: not enough memory for %u bytes.", cbSnap );
+            ErrorPopup( szError );
+        }
+        return ( 0 );
+    }
+
+    // (the converted text is kept as it is pasted)
+    if ( fCacheable ) StartPasteCache( ulFormat, ulCP, pvSnap, cbSnap, ulHash );
+
+    switch ( ulFormat ) {
 
         // Paste as Unicode text if available...
-        if (( psuClipText = (UniChar *) WinQueryClipbrdData( hab, cf_Unicode )) != NULL ) {
-
-            ulCP = WinQueryCp( hmq );   // Convert text to the active codepage
-
-            // Create the conversion object
-            UniMapCpToUcsCp( ulCP, suCodepage, MAX_CP_NAME );
-            UniStrcat( suCodepage, (UniChar *) L"@map=cdra,path=no");
-
-            if (( ulRC = UniCreateUconvObject( suCodepage, &uconv )) == ULS_SUCCESS )
-            {
-                // (CP850 erroneously maps U+0131 to the euro sign)
-                if ( ulCP == 850 )
-                    while (( puniC = UniStrchr( psuClipText, 0x0131 )) != NULL ) *puniC = 0xFFFD;
-
-                // Now do the conversion
-                ulBufLen = ( UniStrlen(psuClipText) * 4 ) + 1;
-                pszLocalText = (PSZ) malloc( ulBufLen );
-                if (( ulRC = UniStrFromUcs( uconv, pszLocalText,
-                                            psuClipText, ulBufLen )) == ULS_SUCCESS )
-                {
-                    // (some codepages use 0x1A for substitutions; replace with ?)
-                    while (( s = strchr( pszLocalText, 0x1A )) != NULL ) *s = '?';
-                    // Output the converted text
-                    WinSendMsg( hwndMLE, MLM_INSERT, MPFROMP(pszLocalText), 0 );
-                    ulCopied = strlen( pszLocalText );
-                } else {
-                    sprintf( szError, "Error pasting Unicode text:\nUniStrFromUcs() = %08X", ulRC );
+        case CCF_UNICODE:
+            ulChars = ( cbSnap / sizeof(UniChar) ) - 1;
+            if ( fHeapSnap ) {
+                ulCopied  = QueuePaste( hwndMLE, ulCP, (UniChar *) pvSnap, ulChars );
+                fHeapSnap = FALSE;          // (it now belongs to the worker)
+                break;
+            }
+            ulCopied = PasteUcsText( hwndMLE, ulCP, (UniChar *) pvSnap );
+            break;
+
+        // ...or UTF-8 text...
+        case CCF_UTF8:
+            if ( ulCP != CP_UTF8 ) {
+                TraceStage( TST_CONVERT );
+                ulChars = Utf8ToUcs( (PSZ) pvSnap, cbSnap - 1, NULL, 0 );
+                fAsync  = fWorker && ( ulChars >= ASYNC_CHARS );
+                psuUtfText = (UniChar *)( fAsync ? malloc(( ulChars + 1 ) * sizeof(UniChar) ) :
+                                                   ArenaAlloc( &arScratch, ( ulChars + 1 ) * sizeof(UniChar) ));
+                if ( psuUtfText == NULL ) {
+                    EndPasteCache( NULL, FALSE );
+                    sprintf( szError, "Error pasting text: not enough memory for %u bytes.",
+                             (ULONG)(( ulChars + 1 ) * sizeof(UniChar)) );
                     ErrorPopup( szError );
+                    break;
                 }
-                UniFreeUconvObject( uconv );
-                free( pszLocalText );
-
-            } else {
-                sprintf( szError, "Error pasting Unicode text:\nUniCreateUconvObject() = %08X", ulRC );
-                ErrorPopup( szError );
+                Utf8ToUcs( (PSZ) pvSnap, cbSnap - 1, psuUtfText, ulChars + 1 );
+                if ( fAsync ) {
+                    ulCopied = QueuePaste( hwndMLE, ulCP, psuUtfText, ulChars );
+                    break;
+                }
+                ulCopied = PasteUcsText( hwndMLE, ulCP, psuUtfText );
+                TraceBytes( cbSnap - 1, ulCopied );
+                break;
             }
-        }
+            // (no conversion needed, so insert it as it is)
 
         // ...Plain text otherwise
-        else if (( pszClipText = (PSZ) WinQueryClipbrdData( hab, CF_TEXT )) != NULL ) {
-            ulBufLen = strlen(pszClipText) + 1;
-            pszLocalText = (PSZ) malloc( ulBufLen );
-            strcpy( pszLocalText, pszClipText );
-            WinSendMsg( hwndMLE, MLM_INSERT, MPFROMP(pszLocalText), 0 );
-            ulCopied = strlen( pszLocalText );
-            free( pszLocalText );
-        }
+        case CCF_TEXT:
+            TraceStage( TST_OUTPUT );
+            ulCopied = (ULONG) WinSendMsg( hwndMLE, MLM_INSERT, MPFROMP(pvSnap), 0 );
+            TraceBytes( ulCopied, ulCopied );
+            break;
 
-        WinCloseClipbrd( hab );
+        default: break;
     }
 
+    if ( fHeapSnap ) free( pvSnap );
+    ArenaEnd( &arScratch );
+    WinStartTimer( hab, hwndApp, TID_ARENA, ARENA_IDLE );
+    TraceEnd();
+
     return ( ulCopied );
 }
 
@@ -346,8 +687,13 @@ ULONG DoPaste( HWND hwndMLE )
 /* ------------------------------------------------------------------------- *
  * DoCopyCut                                                                 *
  *                                                                           *
- * Copies or cuts text to the clipboard from the MLE.  The text is copied in *
- * in both plain text (CF_TEXT) and Unicode ("text/unicode") formats.        *
+ * Copies or cuts text to the clipboard from the MLE (see OfferText).  The   *
+ * text is exported from the MLE once, and once the copy is done it is also  *
+ * recorded in the clipboard history (see CapturePending), so that it can be *
+ * put back on the clipboard later (see RecallHistory).                      *
+ * Copied text too big for the history is left where it is instead, and      *
+ * only read from the MLE when some program asks for it (see ReadSelection); *
+ * cut text must always be exported, since it is about to be removed.        *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   HWND hwndMLE: Handle of the MLE that text is being copied from.         *
@@ -358,125 +704,992 @@ ULONG DoPaste( HWND hwndMLE )
  * ------------------------------------------------------------------------- */
 ULONG DoCopyCut( HWND hwndMLE, BOOL fCut )
 {
-    UconvObject uconv;
-    UniChar suCodepage[ MAX_CP_SPEC ],  // conversion specifier
-            *psuCopyText,               // Unicode text to be copied
-            *psuShareMem,               // Unicode text in clipboard
-            *puniC;                     // pointer into psuCopyText
+    CHAR          szError[ MAX_ERROR ]; // buffer for error messages
+    MLE_SELECTION msCopy;               // the selected text
+    PSZ           pszCopyText = NULL;   // exported text
+    PARENA        pArena;               // arena the text is exported into
+    ULONG         ulCopied = 0,         // number of bytes copied
+                  ulCP,                 // codepage of the text
+                  ulRC;                 // bytes put on the clipboard
+
+
+    TraceBegin( TOP_COPY );
+
+    // Get the selected text (into whichever arena is not holding pending
+    // text), unless it is only copied and too big for the history
+    TraceStage( TST_QUERY );
+    QuerySelection( hwndMLE, &msCopy );
+    ulCopied = msCopy.ulLength;
+    if ( fCut || ( ulCopied <= HIST_BUDGET )) {
+        pArena = &arCopy[ 1 - ulCopyArena ];
+        ArenaReset( pArena );
+        if (( pszCopyText = ExportSelection( &msCopy, pArena, &ulCopied )) == NULL ) {
+            TraceEnd();
+            sprintf( szError, "Error copying text: not enough memory for %u bytes.", ulCopied + 1 );
+            ErrorPopup( szError );
+            return ( 0 );
+        }
+    }
+
+    ulCP = QueryActiveCp();
+
+    // (text that was not exported is too big for the history, but the copy
+    // still counts as the latest one when recalling)
+    if ( ! pszCopyText ) {
+        TraceStage( TST_HISTORY );
+        HistoryAdd( &hsCopies, NULL, ulCopied, ulCP );
+    }
+    ulRC = OfferText( hwndMLE, pszCopyText, &msCopy, ulCopied, ulCP, fCut );
+
+    // The exported text is kept as the pending text, so it is put in the
+    // history from there, after this keystroke has been dealt with
+    if ( pszCopyText && ( pszPending == pszCopyText )) {
+        fCapture = TRUE;
+        WinPostMsg( hwndApp, WM_CAPTURE, 0, 0 );
+    }
+    return ( ulRC );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RecallHistory                                                             *
+ *                                                                           *
+ * Puts an earlier copy back on the clipboard from the history: the one      *
+ * before the last one recalled (or before the latest copy, the first time). *
+ * The text is held in its original codepage, and (as with any copy) is      *
+ * only converted if some program asks for it in another format.             *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwndMLE: Handle of the MLE (whose owner will own the clipboard).   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes put on the clipboard.                                   *
+ * ------------------------------------------------------------------------- */
+ULONG RecallHistory( HWND hwndMLE )
+{
+    CHAR        szError[ MAX_ERROR ];   // buffer for error messages
+    PHIST_ENTRY pEntry;                 // history entry recalled
+    PSZ         pszText;                // copy of its text
+    PARENA      pArena;                 // arena the text is copied into
+
+
+    CapturePending();
+    if (( pEntry = HistoryRecall( &hsCopies )) == NULL ) {
+        WinAlarm( HWND_DESKTOP, WA_WARNING );
+        return ( 0 );
+    }
+
+    // The pending text must not be the history's own copy, which may be
+    // dropped from the history before it has been rendered
+    TraceBegin( TOP_RECALL );
+    TraceStage( TST_HISTORY );
+    pArena = &arCopy[ 1 - ulCopyArena ];
+    ArenaReset( pArena );
+    if (( pszText = (PSZ) ArenaAlloc( pArena, pEntry->cbText + 1 )) == NULL ) {
+        TraceEnd();
+        sprintf( szError, "Error recalling text: not enough memory for %u bytes.", pEntry->cbText + 1 );
+        ErrorPopup( szError );
+        return ( 0 );
+    }
+    memcpy( pszText, pEntry->pszText, pEntry->cbText + 1 );
+
+    return ( OfferText( hwndMLE, pszText, NULL, pEntry->cbText, pEntry->ulCP, FALSE ));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * OfferText                                                                 *
+ *                                                                           *
+ * Puts copied text on the clipboard, ending the copy operation (and its     *
+ * trace) begun by the caller.  The text is offered in plain text (CF_TEXT), *
+ * Unicode ("text/unicode") and UTF-8 formats.                               *
+ *                                                                           *
+ * All formats are registered for delayed rendering: the copied text is      *
+ * kept, and the actual clipboard data for each format is only produced      *
+ * (see RenderClipFormat) if some program asks for it.                       *
+ *                                                                           *
+ * The clipboard is only held open while the formats are registered; error   *
+ * messages and the removal of cut text wait until it has been closed.       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwndMLE  : Handle of the MLE that text is being copied from.       *
+ *   PSZ pszText   : The text, allocated from the spare copy arena (see      *
+ *                   arCopy); it is kept there until it has been rendered.   *
+ *                   NULL if it is to be read from the MLE instead.          *
+ *   PMLE_SELECTION pSel: Where in the MLE the text is (if pszText is NULL). *
+ *   ULONG ulLength: Length of the text in bytes.                            *
+ *   ULONG ulCP    : Codepage of the text.                                   *
+ *   BOOL fCut     : The text is to be removed from the MLE.                 *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes copied.                                                 *
+ * ------------------------------------------------------------------------- */
+ULONG OfferText( HWND hwndMLE, PSZ pszText, PMLE_SELECTION pSel, ULONG ulLength, ULONG ulCP, BOOL fCut )
+{
     CHAR    szError[ MAX_ERROR ];       // buffer for error messages
-    PSZ     pszCopyText,                // exported text
-            pszShareMem,                // plain text in clipboard
-            s;                          // pointer into pszLocalText
-    ULONG   ulCP,                       // codepage to be used
-            ulBufLen,                   // length of output buffer
-            ulCopied = 0,               // number of characters copied
-            ulRC;                       // return code
-    SHORT   sSelected;                  // number of selected characters in MLE
-    BOOL    fRC,                        // boolean return code
-            fUniCopyFailed = FALSE,     // Unicode copy failed
-            fTxtCopyFailed = FALSE;     // plain text copy failed
-    IPT     ipt1, ipt2;                 // MLE insertion points (for querying selection)
-
-
-    // Get the selected text
-    ipt1 = (IPT) WinSendMsg( hwndMLE, MLM_QUERYSEL, MPFROMSHORT(MLFQS_MINSEL), 0 );
-    ipt2 = (IPT) WinSendMsg( hwndMLE, MLM_QUERYSEL, MPFROMSHORT(MLFQS_MAXSEL), 0 );
-    sSelected   = (ULONG) WinSendMsg( hwndMLE, MLM_QUERYFORMATTEXTLENGTH, MPFROMLONG(ipt1), MPFROMLONG(ipt2 - ipt1) );
-    pszCopyText = (PSZ) malloc( sSelected + 1 );
-    ulCopied    = (ULONG) WinSendMsg( hwndMLE, MLM_QUERYSELTEXT, MPFROMP(pszCopyText), 0 );
-
-    if ( WinOpenClipbrd(hab) ) {
-
-        ulBufLen = ulCopied + 1;
-        WinEmptyClipbrd( hab );
+    ULONG   ulCopied = ulLength,        // number of bytes copied
+            ulUniError = 0,             // error registering Unicode text
+            ulTxtError = 0;             // error registering plain text
+    BOOL    fUniCopyFailed = FALSE,     // Unicode copy failed
+            fTxtCopyFailed = FALSE,     // plain text copy failed
+            fOpened;                    // the clipboard was opened
+
+
+    TraceStage( TST_OPEN );
+    if (( fOpened = cbPM.pfnOpen( &cbPM )) != FALSE ) {
+        TraceClipboard( TRUE );
+
+        // (if we owned the old contents, this discards our pending text)
+        TraceStage( TST_OUTPUT );
+        cbPM.pfnEmpty( &cbPM );
+        DiscardPending();
+
+        // Keep the text until it is rendered or the clipboard is emptied
+        pszPending   = pszText;
+        if ( ! pszText ) msPending = *pSel;
+        ulPendingLen = ulCopied;
+        ulPendingCP  = ulCP;
+        ulCopyArena  = 1 - ulCopyArena;
+
+        // Offer the text as Unicode (to be converted from its codepage),
+        // UTF-8 and plain text
+        flPending      = ClipOfferText( &cbPM, &ulUniError, &ulTxtError );
+        fUniCopyFailed = !( flPending & CCF_UNICODE );
+        fTxtCopyFailed = !( flPending & CCF_TEXT );
+
+        TraceInfo( ulCP, flPending );
+        TraceStage( TST_CLOSE );
+        cbPM.pfnClose( &cbPM );
+        TraceClipboard( FALSE );
+    }
 
-        //
-        // Copy as Unicode text (converted from the current codepage)
-        //
+    //
+    // Done copying, now finish up
+    //
 
-        ulCP = WinQueryCp( hmq );
-
-        // Create the conversion object
-        UniMapCpToUcsCp( ulCP, suCodepage, MAX_CP_NAME );
-        UniStrcat( suCodepage, (UniChar *) L"@map=cdra,path=no");
-
-        if (( ulRC = UniCreateUconvObject( suCodepage, &uconv )) == ULS_SUCCESS ) {
-
-            // Do the conversion
-            psuCopyText = (UniChar *) calloc( ulBufLen, sizeof(UniChar) );
-            if (( ulRC = UniStrToUcs( uconv, psuCopyText,
-                                      pszCopyText, ulBufLen )) == ULS_SUCCESS )
-            {
-                // (CP850 erroneously maps U+0131 to the euro sign)
-                if ( ulCP == 850 )
-                    while (( puniC = UniStrchr( psuCopyText, 0x0131 )) != NULL ) *puniC = 0xFFFD;
-
-                // Place the UCS-2 string on the clipboard as "text/unicode"
-                ulRC = DosAllocSharedMem( (PVOID) &psuShareMem, NULL, ulBufLen,
-                                          PAG_WRITE | PAG_COMMIT | OBJ_GIVEABLE );
-                if ( ulRC == 0 ) {
-                    UniStrncpy( psuShareMem, psuCopyText, ulBufLen - 1 );
-                    if ( ! WinSetClipbrdData( hab, (ULONG) psuShareMem,
-                                              cf_Unicode, CFI_POINTER  ))
-                    {
-                        sprintf( szError, "Error copying Unicode text: WinSetClipbrdData() failed.\nError code: 0x%X\n", WinGetLastError(hab) );
-                        ErrorPopup( szError );
-                        fUniCopyFailed = TRUE;
-                    }
-                } else {
-                    sprintf( szError, "Error copying Unicode text.\nDosAllocSharedMem: 0x%X\n", ulRC );
-                    ErrorPopup( szError );
-                    fUniCopyFailed = TRUE;
-                }
-            } else {
-                sprintf( szError, "Error copying Unicode text:\nUniStrToUcs() = %08X", ulRC );
-                ErrorPopup( szError );
-                fUniCopyFailed = TRUE;
-            }
+    if ( fOpened && ( fCut ) && ( !fUniCopyFailed ) && ( !fTxtCopyFailed )) {
+        TraceStage( TST_OUTPUT );
+        WinSendMsg( hwndMLE, MLM_CLEAR, 0, 0 );
+    }
+    TraceBytes( ulCopied, 0 );      // (nothing is converted until rendered)
+    TraceEnd();
 
-            UniFreeUconvObject( uconv );
-            free( psuCopyText );
+    if ( fUniCopyFailed ) {
+        sprintf( szError, "Error copying Unicode text: WinSetClipbrdData() failed.\nError code: 0x%X\n", ulUniError );
+        ErrorPopup( szError );
+    }
+    if ( fTxtCopyFailed ) {
+        sprintf( szError, "Error copying plain text: WinSetClipbrdData() failed.\nError code: 0x%X\n", ulTxtError );
+        ErrorPopup( szError );
+    }
 
-        } else {
-            sprintf( szError, "Error copying Unicode text:\nUniCreateUconvObject() = %08X", ulRC );
-            ErrorPopup( szError );
-            fUniCopyFailed = TRUE;
+    // (text that was not kept is simply left in the spare arena)
+    if (( pszPending == pszText ) && ! flPending )
+        DiscardPending();
+    if ( fTxtCopyFailed ) ulCopied = 0;
+    WinStartTimer( hab, hwndApp, TID_ARENA, ARENA_IDLE );
+
+    return ( ulCopied );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * QuerySelection                                                            *
+ *                                                                           *
+ * Finds the text selected in the MLE, and its length as it is exported.     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwndMLE        : Handle of the MLE.                                *
+ *   PMLE_SELECTION pSel : Receives the selection.                           *
+ * ------------------------------------------------------------------------- */
+void QuerySelection( HWND hwndMLE, PMLE_SELECTION pSel )
+{
+    pSel->hwndMLE  = hwndMLE;
+    pSel->iptStart = (IPT) WinSendMsg( hwndMLE, MLM_QUERYSEL, MPFROMSHORT(MLFQS_MINSEL), 0 );
+    pSel->iptEnd   = (IPT) WinSendMsg( hwndMLE, MLM_QUERYSEL, MPFROMSHORT(MLFQS_MAXSEL), 0 );
+    pSel->ulLength = (ULONG) WinSendMsg( hwndMLE, MLM_QUERYFORMATTEXTLENGTH, MPFROMLONG(pSel->iptStart),
+                                         MPFROMLONG(pSel->iptEnd - pSel->iptStart) );
+    pSel->iptNext  = pSel->iptStart;
+    pSel->lLeft    = pSel->iptEnd - pSel->iptStart;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ExportSelection                                                           *
+ *                                                                           *
+ * Returns a copy of text selected in the MLE (see QuerySelection).  The     *
+ * text is exported straight into a buffer of exactly the right size, so     *
+ * the size of the selection is limited only by memory.                      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PMLE_SELECTION pSel : The selection.                                    *
+ *   PARENA pArena       : Arena to allocate the copy from.                  *
+ *   PULONG pulLength    : Receives the length of the text in bytes.         *
+ *                                                                           *
+ * RETURNS: PSZ                                                              *
+ *   The selected text (freed when the arena is reset), or NULL if there is  *
+ *   not enough memory.                                                      *
+ * ------------------------------------------------------------------------- */
+PSZ ExportSelection( PMLE_SELECTION pSel, PARENA pArena, PULONG pulLength )
+{
+    CLIP_SOURCE csSel;                  // the selection, as a reader
+    PSZ         pszText;                // exported text
+
+
+    *pulLength = pSel->ulLength;
+    if (( pszText = (PSZ) ArenaAlloc( pArena, pSel->ulLength + 1 )) == NULL ) return ( NULL );
+
+    csSel.pszText  = NULL;
+    csSel.ulLength = pSel->ulLength;
+    csSel.pvReader = pSel;
+    csSel.pfnRead  = ReadSelection;
+    *pulLength = ReadSelection( &csSel, 0, pszText, pSel->ulLength );
+    pszText[ *pulLength ] = '\0';
+    return ( pszText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ReadSelection                                                             *
+ *                                                                           *
+ * Reads text selected in the MLE, for a CLIP_SOURCE whose pvReader is an    *
+ * MLE_SELECTION.  The text is exported straight into the caller's buffer,   *
+ * EXPORT_CHUNK bytes at a time; each call carries on where the last one     *
+ * stopped, unless ulOffset is 0.                                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PCLIP_SOURCE pSource : The text being read.                             *
+ *   ULONG ulOffset       : Bytes read so far (0 = from the beginning).      *
+ *   PCHAR pchBuf         : Buffer for the text.                             *
+ *   ULONG cbBuf          : Size of the buffer.                              *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes read (0 at the end).                                    *
+ * ------------------------------------------------------------------------- */
+ULONG ReadSelection( PCLIP_SOURCE pSource, ULONG ulOffset, PCHAR pchBuf, ULONG cbBuf )
+{
+    PMLE_SELECTION pSel = (PMLE_SELECTION) pSource->pvReader;   // the selection
+    ULONG          ulDone,              // bytes exported so far
+                   ulChunk;             // bytes exported by one call
+
+
+    if ( ! ulOffset ) {
+        pSel->iptNext = pSel->iptStart;
+        pSel->lLeft   = pSel->iptEnd - pSel->iptStart;
+    }
+
+    // Each MLM_EXPORT fills the transfer buffer and advances iptNext
+    for ( ulDone = 0; ( ulDone < cbBuf ) && ( pSel->lLeft > 0 ); ulDone += ulChunk ) {
+        WinSendMsg( pSel->hwndMLE, MLM_SETIMPORTEXPORT, MPFROMP(pchBuf + ulDone),
+                    MPFROMLONG( min( cbBuf - ulDone, EXPORT_CHUNK )));
+        ulChunk = (ULONG) WinSendMsg( pSel->hwndMLE, MLM_EXPORT, MPFROMP(&pSel->iptNext), MPFROMP(&pSel->lLeft) );
+        if ( ! ulChunk ) break;
+    }
+    return ( ulDone );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * HoldPendingText                                                           *
+ *                                                                           *
+ * Exports the pending copied text, if it is still to be read from the MLE,  *
+ * so that it is kept as it was when copied.  This must be done before any   *
+ * change to the text in the MLE.  If there is not enough memory, the copy   *
+ * is abandoned.                                                             *
+ * ------------------------------------------------------------------------- */
+void HoldPendingText( void )
+{
+    CHAR    szError[ MAX_ERROR ];       // buffer for error messages
+    PARENA  pArena;                     // arena the text is exported into
+    PSZ     pszText;                    // exported text
+    ULONG   ulLength;                   // its length in bytes
+
+
+    if ( pszPending || ! flPending ) return;
+
+    pArena = &arCopy[ 1 - ulCopyArena ];
+    ArenaReset( pArena );
+    if (( pszText = ExportSelection( &msPending, pArena, &ulLength )) == NULL ) {
+        sprintf( szError, "Error copying text: not enough memory to keep %u bytes.", ulLength + 1 );
+        DiscardPending();
+        DeferError( szError );
+        return;
+    }
+    pszPending   = pszText;
+    ulPendingLen = ulLength;
+    ulCopyArena  = 1 - ulCopyArena;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * IsMoveKey                                                                 *
+ *                                                                           *
+ * Tells whether a virtual key only moves about in the MLE (or is a shift    *
+ * key), rather than changing its text.                                      *
+ * ------------------------------------------------------------------------- */
+BOOL IsMoveKey( USHORT usVK )
+{
+    switch ( usVK ) {
+        case VK_LEFT:       case VK_RIGHT:      case VK_UP:         case VK_DOWN:
+        case VK_HOME:       case VK_END:        case VK_PAGEUP:     case VK_PAGEDOWN:
+        case VK_SHIFT:      case VK_CTRL:       case VK_ALT:        case VK_ALTGRAF:
+        case VK_CAPSLOCK:   case VK_NUMLOCK:    case VK_SCRLLOCK:   case VK_ESC:
+            return ( TRUE );
+    }
+    return ( FALSE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * RenderClipFormat                                                          *
+ *                                                                           *
+ * Places the pending copied text (see DoCopyCut) on the clipboard in the    *
+ * requested format (see ClipRenderText).  The clipboard must already be     *
+ * open.  Once all formats have been rendered, the pending text is no        *
+ * longer needed and is freed.                                               *
+ * Since the clipboard is usually being held open by another program at      *
+ * this point, any error message is deferred until later (see DeferError).   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG flFormat: The format to render (CCF_*).                           *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the data was placed on the clipboard.                           *
+ * ------------------------------------------------------------------------- */
+BOOL RenderClipFormat( ULONG flFormat )
+{
+    CHAR        szError[ MAX_ERROR ];   // buffer for error messages
+    CLIP_SOURCE csPending;              // the pending text
+    ULONG       ulOut = 0;              // bytes of clipboard data produced
+    BOOL        fRC;                    // boolean return code
+
+
+    if ( !( flPending & flFormat )) return ( FALSE );
+
+    TraceBegin( TOP_RENDER );
+    TraceInfo( ulPendingCP, flFormat );
+    TraceStage( TST_CONVERT );
+    ArenaBegin( &arScratch );
+
+    csPending.pszText  = pszPending;
+    csPending.ulLength = ulPendingLen;
+    csPending.ulCP     = ulPendingCP;
+    csPending.pvReader = &msPending;
+    csPending.pfnRead  = ReadSelection;
+    if ( ! ( fRC = ClipRenderText( &cbPM, flFormat, &csPending, &arScratch, &ulOut, szError )))
+        DeferError( szError );
+
+    ArenaEnd( &arScratch );
+    WinStartTimer( hab, hwndApp, TID_ARENA, ARENA_IDLE );
+    TraceBytes( ulPendingLen, fRC ? ulOut : 0 );
+    TraceEnd();
+
+    // Each format is only rendered once, whether or not it worked
+    ulRenders++;
+    flPending &= ~flFormat;
+    if ( ! flPending ) DiscardPending();
+
+    return ( fRC );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DiscardPending                                                            *
+ *                                                                           *
+ * Releases the pending copied text (see DoCopyCut), counting any formats    *
+ * that were never rendered.  The text is put in the history first, if that  *
+ * has not been done yet.                                                    *
+ * ------------------------------------------------------------------------- */
+void DiscardPending( void )
+{
+    CapturePending();
+    if ( flPending & CCF_UNICODE ) ulRendersAvoided++;
+    if ( flPending & CCF_UTF8 )    ulRendersAvoided++;
+    if ( flPending & CCF_TEXT )    ulRendersAvoided++;
+    flPending = 0;
+
+    if ( pszPending ) ArenaReset( &arCopy[ ulCopyArena ] );
+    pszPending   = NULL;
+    ulPendingLen = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * CapturePending                                                            *
+ *                                                                           *
+ * Records the pending copied text in the clipboard history, if the copy     *
+ * that made it asked for this (see DoCopyCut).  This is done when the copy  *
+ * has finished (WM_CAPTURE), so that it does not hold the copy up, or       *
+ * earlier if the text is about to be released or the history is used.       *
+ * ------------------------------------------------------------------------- */
+void CapturePending( void )
+{
+    if ( ! fCapture ) return;
+    fCapture = FALSE;
+    if ( pszPending ) HistoryAdd( &hsCopies, pszPending, ulPendingLen, ulPendingCP );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PasteUcsText                                                              *
+ *                                                                           *
+ * Pastes UTF-16 text into the MLE, converting it into the specified         *
+ * codepage.  The text is converted through a fixed-size buffer: if it all   *
+ * fits in one piece it is simply inserted; otherwise it is imported into    *
+ * the MLE a piece at a time (see ImportUcsText).                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwndMLE     : Handle of the MLE that text is being pasted into.    *
+ *   ULONG ulCP       : The codepage to convert the text into.               *
+ *   UniChar *psuText : The text to paste.                                   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes pasted.                                                 *
+ * ------------------------------------------------------------------------- */
+ULONG PasteUcsText( HWND hwndMLE, ULONG ulCP, UniChar *psuText )
+{
+    CHAR  szError[ MAX_ERROR ];         // buffer for error messages
+    PSZ   pszFailed;                    // name of failed function
+    ULONG ulCopied = 0,                 // number of bytes pasted
+          ulChunk,                      // length of converted chunk
+          ulRC;                         // return code
+
+
+    TraceStage( TST_CONVERT );
+    ulRC = StreamFromUcsOpen( &csPaste, ulCP, psuText, FALSE, &pszFailed );
+    if ( ulRC == ULS_SUCCESS )
+        ulRC = StreamFromUcs( &csPaste, achPasteBuf, sizeof(achPasteBuf),
+                              &ulChunk, &pszFailed );
+    if ( ulRC == ULS_SUCCESS ) {
+        // Output the converted text
+        TraceStage( TST_OUTPUT );
+        if ( *(csPaste.psuNext) == 0 ) {
+            WinSendMsg( hwndMLE, MLM_INSERT, MPFROMP(achPasteBuf), 0 );
+            AddToPasteCache( NULL, achPasteBuf, ulChunk );
+            ulCopied = ulChunk;
         }
+        else
+            ulRC = ImportUcsText( hwndMLE, ulChunk, &ulCopied, &pszFailed );
+        TraceBytes(( csPaste.psuNext - psuText ) * sizeof(UniChar), ulCopied );
+    }
+    EndPasteCache( NULL, ulRC == ULS_SUCCESS );
+    if ( ulRC != ULS_SUCCESS ) {
+        TraceStage( TST_NONE );
+        sprintf( szError, "Error pasting Unicode text:\n%s = %08X", pszFailed, ulRC );
+        ErrorPopup( szError );
+    }
 
+    return ( ulCopied );
+}
 
-        //
-        // Copy as plain text
-        //
 
-        ulRC = DosAllocSharedMem( (PVOID) &pszShareMem, NULL, ulBufLen,
-                                  PAG_WRITE | PAG_COMMIT | OBJ_GIVEABLE );
-        if ( ulRC == 0 ) {
-            strncpy( pszShareMem, pszCopyText, ulBufLen - 1 );
-            if ( ! WinSetClipbrdData( hab, (ULONG) pszShareMem, CF_TEXT, CFI_POINTER )) {
-                sprintf( szError, "Error copying plain text: WinSetClipbrdData() failed.\nError code: 0x%X\n", WinGetLastError(hab) );
-                ErrorPopup( szError );
-                fTxtCopyFailed = TRUE;
+/* ------------------------------------------------------------------------- *
+ * ImportUcsText                                                             *
+ *                                                                           *
+ * Imports the Unicode text being pasted (see PasteUcsText) into the MLE one *
+ * chunk at a time, replacing the current selection.  The first chunk must   *
+ * already be converted into achPasteBuf; the remaining text is converted    *
+ * from csPaste as it is imported, so the amount of memory used does not     *
+ * depend on the size of the text.                                           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwndMLE    : Handle of the MLE that text is being pasted into.     *
+ *   ULONG ulLength  : Length of the text already in achPasteBuf.            *
+ *   PULONG pulCopied: Receives the number of bytes imported.                *
+ *   PSZ *ppszFailed : Receives the name of the failing function.            *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   ULS_SUCCESS or an error code.                                           *
+ * ------------------------------------------------------------------------- */
+ULONG ImportUcsText( HWND hwndMLE, ULONG ulLength, PULONG pulCopied, PSZ *ppszFailed )
+{
+    IPT   ipt;                          // MLE insertion point
+    ULONG ulCarry,                      // bytes carried over to the next chunk
+          ulImport,                     // bytes to import from this chunk
+          ulRC = ULS_SUCCESS;           // return code
+
+
+    *pulCopied = 0;
+
+    WinSendMsg( hwndMLE, MLM_CLEAR, 0, 0 );
+    ipt = (IPT) WinSendMsg( hwndMLE, MLM_QUERYSEL, MPFROMSHORT(MLFQS_CURSORSEL), 0 );
+    WinSendMsg( hwndMLE, MLM_DISABLEREFRESH, 0, 0 );
+    WinSendMsg( hwndMLE, MLM_SETIMPORTEXPORT, MPFROMP(achPasteBuf), MPFROMLONG(PASTE_CHUNK) );
+
+    while ( ulLength ) {
+
+        // Hold back a trailing CR so that a CR-LF pair is never split
+        ulImport = ulLength;
+        ulCarry  = 0;
+        if (( achPasteBuf[ ulLength - 1 ] == '\r' ) && ( *(csPaste.psuNext) != 0 )) {
+            ulImport--;
+            ulCarry = 1;
+        }
+        if ( ulImport ) {
+            if ( ! WinSendMsg( hwndMLE, MLM_IMPORT, MPFROMP(&ipt), MPFROMLONG(ulImport) )) {
+                EndPasteCache( NULL, FALSE );
+                break;                  // MLE is full
             }
-        } else {
-            sprintf( szError, "Error copying plain text.\nDosAllocSharedMem: 0x%X\n", ulRC );
-            ErrorPopup( szError );
-            fTxtCopyFailed = TRUE;
+            AddToPasteCache( NULL, achPasteBuf, ulImport );
+            *pulCopied += ulImport;
         }
+        if ( ulCarry ) achPasteBuf[ 0 ] = '\r';
+
+        // Convert the next chunk
+        TraceStage( TST_CONVERT );
+        ulRC = StreamFromUcs( &csPaste, achPasteBuf + ulCarry, sizeof(achPasteBuf) - ulCarry,
+                              &ulLength, ppszFailed );
+        TraceStage( TST_OUTPUT );
+        if ( ulRC != ULS_SUCCESS ) break;
+        ulLength += ulCarry;
+    }
 
+    WinSendMsg( hwndMLE, MLM_ENABLEREFRESH, 0, 0 );
+    WinSendMsg( hwndMLE, MLM_SETSEL, MPFROMLONG(ipt), MPFROMLONG(ipt) );
 
-        //
-        // Done copying, now finish up
-        //
+    return ( ulRC );
+}
 
-        if (( fCut ) && ( !fUniCopyFailed ) && ( !fTxtCopyFailed ))
-            WinSendMsg( hwndMLE, MLM_CLEAR, 0, 0 );
 
-        WinCloseClipbrd( hab );
+/* ------------------------------------------------------------------------- *
+ * QueryActiveCp                                                             *
+ *                                                                           *
+ * Returns the codepage of the message queue.  If it has changed since the   *
+ * last call, the conversion object cache is flushed.                        *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The active codepage.                                                    *
+ * ------------------------------------------------------------------------- */
+ULONG QueryActiveCp( void )
+{
+    ULONG ulCP;
+
+    ulCP = WinQueryCp( hmq );
+    if ( ulCP != ulLastCP ) {
+        FreeUconvCache();
+        ulLastCP = ulCP;
     }
+    return ( ulCP );
+}
 
-    free( pszCopyText );
-    if ( fTxtCopyFailed ) ulCopied = 0;
 
+/* ------------------------------------------------------------------------- *
+ * QueuePaste                                                                *
+ *                                                                           *
+ * Hands Unicode text over to the conversion worker to be pasted into the    *
+ * MLE.  The selection is cleared straight away; the converted text arrives  *
+ * a piece at a time (see ImportPiece), and the window title shows the       *
+ * progress until the job is finished (see FinishPaste).  If the job cannot  *
+ * be queued, the text is pasted at once.                                    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwndMLE     : Handle of the MLE that text is being pasted into.    *
+ *   ULONG ulCP       : The codepage to convert the text into.               *
+ *   UniChar *psuText : The text to paste (malloc'd; this takes ownership).  *
+ *   ULONG ulChars    : Length of the text in UniChars.                      *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes pasted so far.                                          *
+ * ------------------------------------------------------------------------- */
+ULONG QueuePaste( HWND hwndMLE, ULONG ulCP, UniChar *psuText, ULONG ulChars )
+{
+    CHAR       szTitle[ MAX_TITLE ];    // window title
+    PPASTE_JOB pJob;                    // the new job
+    ULONG      ulCopied;                // number of bytes pasted
+
+
+    // (the worker can only use conversion tables that already exist)
+    GetSbcsTable( ulCP, TRUE );
+
+    if (( pJob = (PPASTE_JOB) calloc( 1, sizeof(PASTE_JOB) )) != NULL ) {
+        pJob->hwndNotify = WinQueryWindow( hwndMLE, QW_OWNER );
+        pJob->hwndMLE    = hwndMLE;
+        pJob->ulCP       = ulCP;
+        pJob->psuText    = psuText;
+        pJob->ulChars    = ulChars;
+        if ( QueueJob( pJob )) {
+            pJobActive = pJob;
+            // (the text replaces the selection, even if no piece ever arrives)
+            WinSendMsg( hwndMLE, MLM_CLEAR, 0, 0 );
+            pJob->ipt = (IPT) WinSendMsg( hwndMLE, MLM_QUERYSEL, MPFROMSHORT(MLFQS_CURSORSEL), 0 );
+            // (the converted pieces go into the paste cache, if it is expecting them)
+            if ( pcPaste.ulFormat && ! pcPaste.fComplete ) pcPaste.pvFiller = pJob;
+            sprintf( szTitle, "%s - Pasting 0%% (Esc to cancel)", APP_TITLE );
+            WinSetWindowText( WinQueryWindow( pJob->hwndNotify, QW_PARENT ), szTitle );
+            return ( 0 );
+        }
+        free( pJob );
+    }
+
+    ulCopied = PasteUcsText( hwndMLE, ulCP, psuText );
+    free( psuText );
     return ( ulCopied );
 }
 
+
+/* ------------------------------------------------------------------------- *
+ * ImportPiece                                                               *
+ *                                                                           *
+ * Imports one piece of text converted by the worker (WM_JOBPIECE) into the  *
+ * MLE, following the text imported before it (or at the point where the     *
+ * selection was, for the first piece).                                      *
+ * Each call is traced as an "import" operation, so the trace shows how long *
+ * the message queue is held up at a time during a large paste.              *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPASTE_JOB pJob    : The job the piece belongs to.                      *
+ *   PPASTE_PIECE pPiece: The converted text.                                *
+ * ------------------------------------------------------------------------- */
+void ImportPiece( PPASTE_JOB pJob, PPASTE_PIECE pPiece )
+{
+    CHAR  szTitle[ MAX_TITLE ];         // window title
+    ULONG ulImported = 0,               // bytes imported from this piece
+          ulPercent;                    // progress of the job
+
+
+    TraceBegin( TOP_IMPORT );
+    TraceInfo( pJob->ulCP, CCF_UNICODE );
+    TraceStage( TST_OUTPUT );
+
+    if ( ! pJob->fStopped ) {
+        WinSendMsg( pJob->hwndMLE, MLM_SETIMPORTEXPORT, MPFROMP(pPiece->ach), MPFROMLONG(pPiece->cb) );
+        ulImported = (ULONG) WinSendMsg( pJob->hwndMLE, MLM_IMPORT, MPFROMP(&(pJob->ipt)), MPFROMLONG(pPiece->cb) );
+        if ( ulImported ) {
+            pJob->ulCopied += ulImported;
+            AddToPasteCache( pJob, pPiece->ach, pPiece->cb );
+        }
+        else {
+            // MLE is full
+            pJob->fStopped = TRUE;
+            CancelJobs();
+        }
+    }
+
+    // Show the progress in the window title
+    TraceStage( TST_NONE );
+    ulPercent = (ULONG)(( pPiece->ulDone * 100.0 ) / pJob->ulChars );
+    if (( ulPercent != pJob->ulPercent ) && ! pJob->fStopped ) {
+        pJob->ulPercent = ulPercent;
+        sprintf( szTitle, "%s - Pasting %u%% (Esc to cancel)", APP_TITLE, ulPercent );
+        WinSetWindowText( WinQueryWindow( pJob->hwndNotify, QW_PARENT ), szTitle );
+    }
+
+    TraceBytes( pPiece->cb, ulImported );
+    ReleasePiece( pPiece );
+    TraceEnd();
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FinishPaste                                                               *
+ *                                                                           *
+ * Cleans up after the worker has finished (or abandoned) a paste job        *
+ * (WM_JOBDONE).  Whatever was imported before a cancellation is kept.       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PPASTE_JOB pJob: The finished job.                                      *
+ * ------------------------------------------------------------------------- */
+void FinishPaste( PPASTE_JOB pJob )
+{
+    CHAR szError[ MAX_ERROR ];          // buffer for error messages
+
+    WinSendMsg( pJob->hwndMLE, MLM_SETSEL, MPFROMLONG(pJob->ipt), MPFROMLONG(pJob->ipt) );
+    WinSetWindowText( WinQueryWindow( pJob->hwndNotify, QW_PARENT ), APP_TITLE );
+
+    if ( pJob == pJobActive ) pJobActive = NULL;
+    if ( ! pJobActive ) ResumeJobs();
+    EndPasteCache( pJob, ( pJob->ulRC == ULS_SUCCESS ) && ! pJob->fCancelled && ! pJob->fStopped );
+
+    if (( pJob->ulRC != ULS_SUCCESS ) && ! pJob->fCancelled ) {
+        sprintf( szError, "Error pasting Unicode text:\n%s = %08X", pJob->pszFailed, pJob->ulRC );
+        ErrorPopup( szError );
+    }
+
+    free( pJob->psuText );
+    free( pJob );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DeferError                                                                *
+ *                                                                           *
+ * Arranges for an error message to be shown once the current message has    *
+ * been processed, rather than showing a modal popup immediately (which      *
+ * would keep the clipboard locked for as long as the popup is shown).  If   *
+ * a message is already waiting, the new one is dropped.                     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PSZ pszError: The error message.                                        *
+ * ------------------------------------------------------------------------- */
+void DeferError( PSZ pszError )
+{
+    if ( szDeferred[ 0 ] ) return;
+    strncpy( szDeferred, pszError, MAX_ERROR - 1 );
+    szDeferred[ MAX_ERROR - 1 ] = '\0';
+    WinPostMsg( hwndApp, WM_SHOWERROR, 0, 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FindCachedPaste                                                           *
+ *                                                                           *
+ * Checks whether the clipboard text about to be pasted is the same as the   *
+ * last text converted, so that the converted text can be used again (see    *
+ * PasteCachedText).  Nothing tells us when the clipboard contents change,   *
+ * so the clipboard text is compared with a copy of the text that was        *
+ * converted: first by format, codepage, length and hash, and then (if all   *
+ * of those match) byte for byte, since different texts can share a hash.    *
+ * Both are cheap next to the conversion they save.                          *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulFormat: The clipboard format being pasted (CCF_*).              *
+ *   ULONG ulCP    : The codepage the text is to be converted into.          *
+ *   PVOID pvSource: The clipboard text.                                     *
+ *   ULONG cbSource: Size of the clipboard text in bytes (with the NUL).     *
+ *   ULONG ulHash  : Hash of the clipboard text (see HashText).              *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if the converted text is in the cache.                             *
+ * ------------------------------------------------------------------------- */
+BOOL FindCachedPaste( ULONG ulFormat, ULONG ulCP, PVOID pvSource, ULONG cbSource, ULONG ulHash )
+{
+    if ( pcPaste.fComplete && ( pcPaste.ulFormat == ulFormat ) && ( pcPaste.ulCP == ulCP ) &&
+         ( pcPaste.cbSource == cbSource ) && ( pcPaste.ulHash == ulHash ) &&
+         ( memcmp( pcPaste.pvSource, pvSource, cbSource ) == 0 ))
+    {
+        ulPasteHits++;
+        return ( TRUE );
+    }
+    ulPasteMisses++;
+    return ( FALSE );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PasteCachedText                                                           *
+ *                                                                           *
+ * Pastes the converted text in the cache into the MLE, replacing the        *
+ * current selection.  Like PasteUcsText, text that fits in one chunk is     *
+ * simply inserted, and anything longer is imported a chunk at a time.       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwndMLE: Handle of the MLE that text is being pasted into.         *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes pasted.                                                 *
+ * ------------------------------------------------------------------------- */
+ULONG PasteCachedText( HWND hwndMLE )
+{
+    IPT   ipt;                          // MLE insertion point
+    ULONG ulDone,                       // bytes imported so far
+          ulChunk;                      // bytes to import in this call
+
+
+    TraceStage( TST_OUTPUT );
+    if ( pcPaste.cbText <= PASTE_CHUNK ) {
+        WinSendMsg( hwndMLE, MLM_INSERT, MPFROMP(pcPaste.pszText), 0 );
+        return ( pcPaste.cbText );
+    }
+
+    WinSendMsg( hwndMLE, MLM_CLEAR, 0, 0 );
+    ipt = (IPT) WinSendMsg( hwndMLE, MLM_QUERYSEL, MPFROMSHORT(MLFQS_CURSORSEL), 0 );
+    WinSendMsg( hwndMLE, MLM_DISABLEREFRESH, 0, 0 );
+
+    for ( ulDone = 0; ulDone < pcPaste.cbText; ulDone += ulChunk ) {
+        // Never split a CR-LF pair
+        ulChunk = min( pcPaste.cbText - ulDone, PASTE_CHUNK );
+        if (( pcPaste.pszText[ ulDone + ulChunk - 1 ] == '\r' ) && ( ulDone + ulChunk < pcPaste.cbText ))
+            ulChunk--;
+        WinSendMsg( hwndMLE, MLM_SETIMPORTEXPORT, MPFROMP(pcPaste.pszText + ulDone), MPFROMLONG(ulChunk) );
+        if ( ! WinSendMsg( hwndMLE, MLM_IMPORT, MPFROMP(&ipt), MPFROMLONG(ulChunk) ))
+            break;                      // MLE is full
+    }
+
+    WinSendMsg( hwndMLE, MLM_ENABLEREFRESH, 0, 0 );
+    WinSendMsg( hwndMLE, MLM_SETSEL, MPFROMLONG(ipt), MPFROMLONG(ipt) );
+
+    return ( ulDone );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * StartPasteCache                                                           *
+ *                                                                           *
+ * Empties the paste cache, ready for the text about to be converted to be   *
+ * added to it (see AddToPasteCache).  The converted text is only used once  *
+ * all of it has been added (see EndPasteCache).  A copy of the clipboard    *
+ * text is kept with it (see FindCachedPaste); if that is too big or cannot  *
+ * be made, nothing is cached.                                               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulFormat: The clipboard format being pasted (CCF_*).              *
+ *   ULONG ulCP    : The codepage the text is being converted into.          *
+ *   PVOID pvSource: The clipboard text.                                     *
+ *   ULONG cbSource: Size of the clipboard text in bytes (with the NUL).     *
+ *   ULONG ulHash  : Hash of the clipboard text (see HashText).              *
+ * ------------------------------------------------------------------------- */
+void StartPasteCache( ULONG ulFormat, ULONG ulCP, PVOID pvSource, ULONG cbSource, ULONG ulHash )
+{
+    free( pcPaste.pvSource );
+    pcPaste.pvSource  = NULL;
+    pcPaste.ulFormat  = 0;
+    pcPaste.fComplete = FALSE;
+    if (( cbSource > PASTE_CACHE_MAX ) || (( pcPaste.pvSource = malloc( cbSource )) == NULL )) return;
+    memcpy( pcPaste.pvSource, pvSource, cbSource );
+
+    pcPaste.ulFormat  = ulFormat;
+    pcPaste.ulCP      = ulCP;
+    pcPaste.cbSource  = cbSource;
+    pcPaste.ulHash    = ulHash;
+    pcPaste.cbText    = 0;
+    pcPaste.fComplete = FALSE;
+    pcPaste.pvFiller  = NULL;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * AddToPasteCache                                                           *
+ *                                                                           *
+ * Adds a chunk of converted text to the paste cache.  If the text turns     *
+ * out to be too big to keep (PASTE_CACHE_MAX), the cache is emptied.        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PVOID pvFiller: The paste job that converted the text (NULL if it was   *
+ *                   converted by DoPaste); it is ignored unless the cache   *
+ *                   is being filled by this job.                            *
+ *   PCHAR pchText : The converted text.                                     *
+ *   ULONG cb      : Its length in bytes.                                    *
+ * ------------------------------------------------------------------------- */
+void AddToPasteCache( PVOID pvFiller, PCHAR pchText, ULONG cb )
+{
+    PSZ   pszNew;                       // enlarged buffer
+    ULONG cbNew;                        // size of the enlarged buffer
+
+
+    if ( ! pcPaste.ulFormat || pcPaste.fComplete || ( pcPaste.pvFiller != pvFiller )) return;
+
+    if ( pcPaste.cbText + cb > PASTE_CACHE_MAX ) {
+        FreePasteCache();
+        return;
+    }
+    if ( pcPaste.cbText + cb + 1 > pcPaste.cbAlloc ) {
+        cbNew = max( pcPaste.cbAlloc * 2, max( pcPaste.cbText + cb + 1, PASTE_CHUNK + 1 ));
+        if (( pszNew = (PSZ) realloc( pcPaste.pszText, cbNew )) == NULL ) {
+            FreePasteCache();
+            return;
+        }
+        pcPaste.pszText = pszNew;
+        pcPaste.cbAlloc = cbNew;
+    }
+    memcpy( pcPaste.pszText + pcPaste.cbText, pchText, cb );
+    pcPaste.cbText += cb;
+    pcPaste.pszText[ pcPaste.cbText ] = '\0';
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * EndPasteCache                                                             *
+ *                                                                           *
+ * Marks the end of the text being added to the paste cache.  If the paste   *
+ * failed, or was stopped part of the way through, the cache is emptied.     *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PVOID pvFiller : The paste job that converted the text (NULL if it was  *
+ *                    converted by DoPaste).                                 *
+ *   BOOL fComplete : All of the text was converted and pasted.              *
+ * ------------------------------------------------------------------------- */
+void EndPasteCache( PVOID pvFiller, BOOL fComplete )
+{
+    if ( ! pcPaste.ulFormat || pcPaste.fComplete || ( pcPaste.pvFiller != pvFiller )) return;
+
+    if ( fComplete ) pcPaste.fComplete = TRUE;
+    else             FreePasteCache();
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FreePasteCache                                                            *
+ *                                                                           *
+ * Empties the paste cache and frees its memory.                             *
+ * ------------------------------------------------------------------------- */
+void FreePasteCache( void )
+{
+    free( pcPaste.pvSource );
+    free( pcPaste.pszText );
+    memset( &pcPaste, 0, sizeof(PASTE_CACHE) );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PmFormat                                                                  *
+ *                                                                           *
+ * Returns the PM clipboard format for one of the CCF_* formats.             *
+ * ------------------------------------------------------------------------- */
+ULONG PmFormat( ULONG flFormat )
+{
+    switch ( flFormat ) {
+        case CCF_UNICODE: return ( cf_Unicode );
+        case CCF_UTF8:    return ( cf_UTF8 );
+    }
+    return ( CF_TEXT );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PM clipboard backend functions (see CLIP_BACKEND).  Clipboard data is     *
+ * always given to the clipboard in giveable shared memory.                  *
+ * ------------------------------------------------------------------------- */
+BOOL PmOpenClipbrd( PCLIP_BACKEND pBackend )
+{
+    return ( WinOpenClipbrd( hab ));
+}
+
+BOOL PmCloseClipbrd( PCLIP_BACKEND pBackend )
+{
+    return ( WinCloseClipbrd( hab ));
+}
+
+// (the client window owns the clipboard, so that it is asked to render)
+BOOL PmEmptyClipbrd( PCLIP_BACKEND pBackend )
+{
+    BOOL fRC = WinEmptyClipbrd( hab );
+
+    WinSetClipbrdOwner( hab, hwndApp );
+    return ( fRC );
+}
+
+ULONG PmQueryFormats( PCLIP_BACKEND pBackend )
+{
+    ULONG ulFmtInfo,                    // clipboard format information
+          flAvailable = 0;              // clipboard formats available
+
+    if ( WinQueryClipbrdFmtInfo( hab, cf_Unicode, &ulFmtInfo )) flAvailable |= CCF_UNICODE;
+    if ( WinQueryClipbrdFmtInfo( hab, cf_UTF8, &ulFmtInfo ))    flAvailable |= CCF_UTF8;
+    if ( WinQueryClipbrdFmtInfo( hab, CF_TEXT, &ulFmtInfo ))    flAvailable |= CCF_TEXT;
+    return ( flAvailable );
+}
+
+PVOID PmQueryData( PCLIP_BACKEND pBackend, ULONG flFormat )
+{
+    return ( (PVOID) WinQueryClipbrdData( hab, PmFormat( flFormat )));
+}
+
+ULONG PmAllocData( PCLIP_BACKEND pBackend, ULONG cb, PVOID *ppvData )
+{
+    return ( DosAllocSharedMem( ppvData, NULL, cb, PAG_WRITE | PAG_COMMIT | OBJ_GIVEABLE ));
+}
+
+void PmFreeData( PCLIP_BACKEND pBackend, PVOID pvData )
+{
+    DosFreeMem( pvData );
+}
+
+BOOL PmSetData( PCLIP_BACKEND pBackend, ULONG flFormat, PVOID pvData )
+{
+    return ( WinSetClipbrdData( hab, (ULONG) pvData, PmFormat( flFormat ), CFI_POINTER ));
+}
+
+ULONG PmQueryError( PCLIP_BACKEND pBackend )
+{
+    return ( WinGetLastError( hab ));
+}
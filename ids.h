@@ -8,6 +8,8 @@
 #define IDM_PASTE   21
 #define IDM_CUT     22
 #define IDM_COPY    23
+#define IDM_RECALL  24
 
 #define IDM_HELP    90
+#define IDM_DIAG    98
 #define IDM_ABOUT   99
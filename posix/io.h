@@ -0,0 +1,29 @@
+/*****************************************************************************
+ * io.h                                                                      *
+ *                                                                           *
+ * Stand-in for the compiler's low-level I/O header, for building the        *
+ * portable parts of CLIPUNI on other systems.  There is no distinction      *
+ * between text and binary files there, so setmode() does nothing.           *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef IO_H
+#define IO_H
+
+#include <unistd.h>
+
+
+// CONSTANTS
+//
+#ifndef O_BINARY
+#define O_BINARY        0
+#endif
+
+
+// MACROS
+//
+#define setmode( fd, mode )     ((void) 0)
+
+
+#endif
@@ -0,0 +1,122 @@
+/*****************************************************************************
+ * os2.h                                                                     *
+ *                                                                           *
+ * A small stand-in for the OS/2 toolkit header, used to build the parts of  *
+ * CLIPUNI that do not need Presentation Manager on other systems (see       *
+ * CMakeLists.txt).  Only the types, constants and functions those files     *
+ * use are provided; the functions are implemented in os2shim.c.             *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef OS2_H
+#define OS2_H
+
+#include <stddef.h>
+#include <strings.h>
+
+
+// CONSTANTS
+//
+#define TRUE                    1
+#define FALSE                   0
+#define NULLHANDLE              0
+
+#define NO_ERROR                0
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_TOO_MANY_HANDLES  291
+#define ERROR_ALREADY_POSTED    299
+#define ERROR_ALREADY_RESET     300
+#define ERROR_TIMEOUT           640
+
+#define SEM_INDEFINITE_WAIT     ((ULONG) -1)
+#define SEM_IMMEDIATE_RETURN    0
+#define DCWW_WAIT               0
+#define QSV_NUMPROCESSORS       26
+
+#define WM_USER                 0x1000
+
+
+// MACROS
+//
+#define EXPENTRY
+#define APIENTRY
+
+#define MPFROMP( p )            ((MPARAM)( p ))
+#define MPFROMLONG( l )         ((MPARAM)(size_t)(ULONG)( l ))
+#define PVOIDFROMMP( mp )       ((PVOID)( mp ))
+#define LONGFROMMP( mp )        ((ULONG)(size_t)( mp ))
+
+#ifndef min
+#define min( a, b )             ((( a ) < ( b )) ? ( a ) : ( b ))
+#endif
+#ifndef max
+#define max( a, b )             ((( a ) > ( b )) ? ( a ) : ( b ))
+#endif
+
+#define stricmp( s1, s2 )       strcasecmp( s1, s2 )
+
+
+// TYPES
+//
+typedef unsigned int    ULONG, *PULONG;
+typedef int             LONG, *PLONG;
+typedef unsigned short  USHORT, *PUSHORT;
+typedef short           SHORT, *PSHORT;
+typedef unsigned char   UCHAR, *PUCHAR, BYTE, *PBYTE;
+typedef char            CHAR, *PCHAR, *PSZ;
+typedef ULONG           BOOL, *PBOOL;
+typedef void            VOID, *PVOID;
+typedef ULONG           APIRET;
+typedef ULONG           TID, *PTID;
+typedef LONG            IPT, *PIPT;
+
+// (handles are wide enough to hold a pointer)
+typedef unsigned long   LHANDLE;
+typedef LHANDLE         HMTX, *PHMTX;
+typedef LHANDLE         HEV, *PHEV;
+typedef LHANDLE         HWND;
+typedef PVOID           MPARAM;
+
+typedef struct _QWORD {
+    ULONG       ulLo;                       // low 32 bits
+    ULONG       ulHi;                       // high 32 bits
+} QWORD, *PQWORD;
+
+typedef struct _TIB2 {
+    ULONG       tib2_ultid;                 // thread ID
+} TIB2, *PTIB2;
+
+typedef struct _TIB {
+    PTIB2       tib_ptib2;                  // system-specific thread information
+} TIB, *PTIB;
+
+typedef struct _PIB {
+    ULONG       pib_ulpid;                  // process ID
+} PIB, *PPIB;
+
+
+// FUNCTION DECLARATIONS
+//
+APIRET DosCreateMutexSem( PSZ pszName, PHMTX phmtx, ULONG flAttr, BOOL fState );
+APIRET DosRequestMutexSem( HMTX hmtx, ULONG ulTimeout );
+APIRET DosReleaseMutexSem( HMTX hmtx );
+APIRET DosCloseMutexSem( HMTX hmtx );
+APIRET DosCreateEventSem( PSZ pszName, PHEV phev, ULONG flAttr, BOOL fState );
+APIRET DosPostEventSem( HEV hev );
+APIRET DosResetEventSem( HEV hev, PULONG pulPostCt );
+APIRET DosWaitEventSem( HEV hev, ULONG ulTimeout );
+APIRET DosCloseEventSem( HEV hev );
+APIRET DosWaitThread( PTID ptid, ULONG ulWait );
+APIRET DosSleep( ULONG ulMsec );
+APIRET DosGetInfoBlocks( PTIB *pptib, PPIB *pppib );
+APIRET DosQuerySysInfo( ULONG ulStart, ULONG ulLast, PVOID pBuf, ULONG cbBuf );
+APIRET DosTmrQueryFreq( PULONG pulFreq );
+APIRET DosTmrQueryTime( PQWORD pqwTime );
+
+// (supplied by the program, for those that use the conversion worker)
+BOOL   APIENTRY WinPostMsg( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 );
+
+
+#endif
@@ -0,0 +1,676 @@
+/*****************************************************************************
+ * os2shim.c                                                                 *
+ *                                                                           *
+ * Implements the few OS/2 control program and ULS functions used by the     *
+ * portable parts of CLIPUNI, so that they (and the tests and benchmarks)    *
+ * can be built and run on POSIX systems.  Threads and semaphores map onto   *
+ * pthreads; the timer counts microseconds; conversion objects are built on  *
+ * iconv(), for the codepages in aCodepages, and substitute characters that  *
+ * cannot be converted the way ULS does (counting them) rather than failing. *
+ *                                                                           *
+ * This is not a general emulation: it only does what CLIPUNI relies on.     *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#include <os2.h>
+#include <errno.h>
+#include <iconv.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <uconv.h>
+#include <process.h>
+
+
+// CONSTANTS
+//
+#define MAX_SHIM_THREADS        256         // threads that can be started and waited for
+#define SHIM_SUBST_UCS          0xFFFD      // substitution for bytes that cannot be converted
+#define SHIM_SUBST_CP           0x1A        // substitution for characters that cannot be converted
+
+
+// TYPES
+//
+typedef struct _SHIM_CODEPAGE {
+    ULONG       ulCP;                       // OS/2 codepage number
+    PSZ         pszName;                    // iconv() name for it
+    ULONG       ulMaxLen;                   // longest character (bytes)
+} SHIM_CODEPAGE;
+
+typedef struct _SHIM_UCONV {
+    iconv_t     cdToUcs;                    // converter from the codepage to UCS-2
+    iconv_t     cdFromUcs;                  // converter from UCS-2 to the codepage
+    ULONG       ulCP;                       // the codepage
+    ULONG       ulMaxLen;                   // its longest character (bytes)
+    char        achFirst[ 256 ];            // length of the character each byte starts
+} SHIM_UCONV, *PSHIM_UCONV;
+
+typedef struct _SHIM_THREAD {
+    pthread_t   thread;                     // the thread
+    BOOL        fUsed;                      // this slot is in use
+    void        (*pfnStart)( void * );      // its function
+    void        *pArg;                      // and that function's argument
+} SHIM_THREAD;
+
+typedef struct _SHIM_EVENT {
+    pthread_mutex_t mtx;                    // protects ulPosts
+    pthread_cond_t  cond;                   // signalled when posted
+    ULONG           ulPosts;                // posts since the last reset
+} SHIM_EVENT, *PSHIM_EVENT;
+
+
+// GLOBAL VARIABLES
+//
+SHIM_CODEPAGE aCodepages[] = {
+    {  437, "CP437",      1 },
+    {  850, "IBM850",     1 },
+    {  852, "IBM852",     1 },
+    {  866, "IBM866",     1 },
+    {  819, "ISO-8859-1", 1 },
+    {  912, "ISO-8859-2", 1 },
+    { 1250, "CP1250",     1 },
+    { 1251, "CP1251",     1 },
+    { 1252, "CP1252",     1 },
+    { 1208, "UTF-8",      4 },
+    {  932, "IBM-943",    2 },
+    {  943, "IBM-943",    2 },
+    {  949, "CP949",      2 },
+    {  950, "CP950",      2 },
+    { 1386, "GBK",        2 }
+};
+
+SHIM_THREAD     aThreads[ MAX_SHIM_THREADS ];
+pthread_mutex_t mtxThreads = PTHREAD_MUTEX_INITIALIZER;
+ULONG           ulLastTid;
+__thread TIB2   tib2Thread;
+__thread TIB    tibThread;
+PIB             pibProcess;
+
+
+// FUNCTION DECLARATIONS
+//
+void  *ThreadStart( void *pArg );
+PSZ   UcsEncodingName( void );
+void  ProbeLeadBytes( PSHIM_UCONV pUconv );
+
+
+/* ========================================================================= *
+ * Threads and semaphores                                                    *
+ * ========================================================================= */
+
+/* ------------------------------------------------------------------------- *
+ * _beginthread                                                              *
+ *                                                                           *
+ * Starts a thread that DosWaitThread can wait for.  Its stack grows on      *
+ * demand, so the size asked for is not needed.                              *
+ * ------------------------------------------------------------------------- */
+int _beginthread( void (*pfnStart)( void * ), void *pStack, unsigned cbStack, void *pArg )
+{
+    ULONG tid;
+
+    pthread_mutex_lock( &mtxThreads );
+    for ( tid = 1; ( tid < MAX_SHIM_THREADS ) && aThreads[ tid ].fUsed; tid++ ) ;
+    if ( tid == MAX_SHIM_THREADS ) {
+        pthread_mutex_unlock( &mtxThreads );
+        return ( -1 );
+    }
+    aThreads[ tid ].fUsed    = TRUE;
+    aThreads[ tid ].pfnStart = pfnStart;
+    aThreads[ tid ].pArg     = pArg;
+    if ( pthread_create( &(aThreads[ tid ].thread), NULL, ThreadStart, &(aThreads[ tid ])) ) {
+        aThreads[ tid ].fUsed = FALSE;
+        pthread_mutex_unlock( &mtxThreads );
+        return ( -1 );
+    }
+    pthread_mutex_unlock( &mtxThreads );
+    return ( (int) tid );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ThreadStart                                                               *
+ *                                                                           *
+ * Runs the function a thread was started with.                              *
+ * ------------------------------------------------------------------------- */
+void *ThreadStart( void *pArg )
+{
+    SHIM_THREAD *pThread = (SHIM_THREAD *) pArg;
+
+    pThread->pfnStart( pThread->pArg );
+    return ( NULL );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DosWaitThread                                                             *
+ *                                                                           *
+ * Waits for a thread started with _beginthread to end.  (Waiting for any    *
+ * thread, or not waiting, is not supported.)                                *
+ * ------------------------------------------------------------------------- */
+APIRET DosWaitThread( PTID ptid, ULONG ulWait )
+{
+    TID       tid = *ptid;
+    pthread_t thread;
+
+    if (( ulWait != DCWW_WAIT ) || ( tid == 0 ) || ( tid >= MAX_SHIM_THREADS ) ||
+        ! aThreads[ tid ].fUsed )
+        return ( ERROR_INVALID_PARAMETER );
+
+    thread = aThreads[ tid ].thread;
+    pthread_join( thread, NULL );
+    pthread_mutex_lock( &mtxThreads );
+    aThreads[ tid ].fUsed = FALSE;
+    pthread_mutex_unlock( &mtxThreads );
+    return ( NO_ERROR );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DosCreateMutexSem, DosRequestMutexSem, DosReleaseMutexSem,                *
+ * DosCloseMutexSem                                                          *
+ *                                                                           *
+ * Mutex semaphores, which (as on OS/2) the owner may request again.  Only   *
+ * private, unnamed semaphores are supported, and requests always wait.      *
+ * ------------------------------------------------------------------------- */
+APIRET DosCreateMutexSem( PSZ pszName, PHMTX phmtx, ULONG flAttr, BOOL fState )
+{
+    pthread_mutex_t     *pmtx;
+    pthread_mutexattr_t attr;
+
+    if (( pmtx = (pthread_mutex_t *) malloc( sizeof( pthread_mutex_t ))) == NULL )
+        return ( ERROR_NOT_ENOUGH_MEMORY );
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+    pthread_mutex_init( pmtx, &attr );
+    pthread_mutexattr_destroy( &attr );
+    if ( fState ) pthread_mutex_lock( pmtx );
+    *phmtx = (HMTX) pmtx;
+    return ( NO_ERROR );
+}
+
+APIRET DosRequestMutexSem( HMTX hmtx, ULONG ulTimeout )
+{
+    return ( pthread_mutex_lock( (pthread_mutex_t *) hmtx ) ? ERROR_INVALID_PARAMETER : NO_ERROR );
+}
+
+APIRET DosReleaseMutexSem( HMTX hmtx )
+{
+    return ( pthread_mutex_unlock( (pthread_mutex_t *) hmtx ) ? ERROR_INVALID_PARAMETER : NO_ERROR );
+}
+
+APIRET DosCloseMutexSem( HMTX hmtx )
+{
+    pthread_mutex_destroy( (pthread_mutex_t *) hmtx );
+    free( (pthread_mutex_t *) hmtx );
+    return ( NO_ERROR );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DosCreateEventSem, DosPostEventSem, DosResetEventSem, DosWaitEventSem,    *
+ * DosCloseEventSem                                                          *
+ *                                                                           *
+ * Event semaphores.  Only private, unnamed semaphores are supported.        *
+ * ------------------------------------------------------------------------- */
+APIRET DosCreateEventSem( PSZ pszName, PHEV phev, ULONG flAttr, BOOL fState )
+{
+    PSHIM_EVENT pEvent;
+
+    if (( pEvent = (PSHIM_EVENT) malloc( sizeof( SHIM_EVENT ))) == NULL )
+        return ( ERROR_NOT_ENOUGH_MEMORY );
+    pthread_mutex_init( &(pEvent->mtx), NULL );
+    pthread_cond_init( &(pEvent->cond), NULL );
+    pEvent->ulPosts = fState ? 1 : 0;
+    *phev = (HEV) pEvent;
+    return ( NO_ERROR );
+}
+
+APIRET DosPostEventSem( HEV hev )
+{
+    PSHIM_EVENT pEvent = (PSHIM_EVENT) hev;
+    APIRET      rc;
+
+    pthread_mutex_lock( &(pEvent->mtx) );
+    rc = pEvent->ulPosts++ ? ERROR_ALREADY_POSTED : NO_ERROR;
+    pthread_cond_broadcast( &(pEvent->cond) );
+    pthread_mutex_unlock( &(pEvent->mtx) );
+    return ( rc );
+}
+
+APIRET DosResetEventSem( HEV hev, PULONG pulPostCt )
+{
+    PSHIM_EVENT pEvent = (PSHIM_EVENT) hev;
+
+    pthread_mutex_lock( &(pEvent->mtx) );
+    *pulPostCt = pEvent->ulPosts;
+    pEvent->ulPosts = 0;
+    pthread_mutex_unlock( &(pEvent->mtx) );
+    return ( *pulPostCt ? NO_ERROR : ERROR_ALREADY_RESET );
+}
+
+APIRET DosWaitEventSem( HEV hev, ULONG ulTimeout )
+{
+    PSHIM_EVENT     pEvent = (PSHIM_EVENT) hev;
+    struct timespec tsEnd;
+    APIRET          rc = NO_ERROR;
+
+    if ( ulTimeout != SEM_INDEFINITE_WAIT ) {
+        clock_gettime( CLOCK_REALTIME, &tsEnd );
+        tsEnd.tv_sec  += ulTimeout / 1000;
+        tsEnd.tv_nsec += ( ulTimeout % 1000 ) * 1000000L;
+        if ( tsEnd.tv_nsec >= 1000000000L ) {
+            tsEnd.tv_sec++;
+            tsEnd.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock( &(pEvent->mtx) );
+    while ( ! pEvent->ulPosts && ( rc == NO_ERROR )) {
+        if ( ulTimeout == SEM_INDEFINITE_WAIT )
+            pthread_cond_wait( &(pEvent->cond), &(pEvent->mtx) );
+        else if ( pthread_cond_timedwait( &(pEvent->cond), &(pEvent->mtx), &tsEnd ) == ETIMEDOUT )
+            rc = ERROR_TIMEOUT;
+    }
+    if ( pEvent->ulPosts ) rc = NO_ERROR;
+    pthread_mutex_unlock( &(pEvent->mtx) );
+    return ( rc );
+}
+
+APIRET DosCloseEventSem( HEV hev )
+{
+    PSHIM_EVENT pEvent = (PSHIM_EVENT) hev;
+
+    pthread_cond_destroy( &(pEvent->cond) );
+    pthread_mutex_destroy( &(pEvent->mtx) );
+    free( pEvent );
+    return ( NO_ERROR );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DosSleep                                                                  *
+ * ------------------------------------------------------------------------- */
+APIRET DosSleep( ULONG ulMsec )
+{
+    struct timespec ts;
+
+    ts.tv_sec  = ulMsec / 1000;
+    ts.tv_nsec = ( ulMsec % 1000 ) * 1000000L;
+    while ( nanosleep( &ts, &ts ) && ( errno == EINTR )) ;
+    return ( NO_ERROR );
+}
+
+
+/* ========================================================================= *
+ * System information and timer                                              *
+ * ========================================================================= */
+
+/* ------------------------------------------------------------------------- *
+ * DosGetInfoBlocks                                                          *
+ *                                                                           *
+ * Only the thread ID (numbered from 1, in the order threads first ask) and  *
+ * the process ID are filled in.                                             *
+ * ------------------------------------------------------------------------- */
+APIRET DosGetInfoBlocks( PTIB *pptib, PPIB *pppib )
+{
+    if ( ! tib2Thread.tib2_ultid ) {
+        pthread_mutex_lock( &mtxThreads );
+        tib2Thread.tib2_ultid = ++ulLastTid;
+        pthread_mutex_unlock( &mtxThreads );
+        tibThread.tib_ptib2 = &tib2Thread;
+    }
+    pibProcess.pib_ulpid = (ULONG) getpid();
+    if ( pptib ) *pptib = &tibThread;
+    if ( pppib ) *pppib = &pibProcess;
+    return ( NO_ERROR );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DosQuerySysInfo                                                           *
+ *                                                                           *
+ * Only QSV_NUMPROCESSORS is supported.                                      *
+ * ------------------------------------------------------------------------- */
+APIRET DosQuerySysInfo( ULONG ulStart, ULONG ulLast, PVOID pBuf, ULONG cbBuf )
+{
+    long lProcessors;
+
+    if (( ulStart != QSV_NUMPROCESSORS ) || ( ulLast != QSV_NUMPROCESSORS ) ||
+        ( cbBuf < sizeof( ULONG )))
+        return ( ERROR_INVALID_PARAMETER );
+
+    lProcessors = sysconf( _SC_NPROCESSORS_ONLN );
+    *((PULONG) pBuf) = ( lProcessors > 0 ) ? (ULONG) lProcessors : 1;
+    return ( NO_ERROR );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * DosTmrQueryFreq, DosTmrQueryTime                                          *
+ *                                                                           *
+ * A monotonic timer counting microseconds.                                  *
+ * ------------------------------------------------------------------------- */
+APIRET DosTmrQueryFreq( PULONG pulFreq )
+{
+    *pulFreq = 1000000;
+    return ( NO_ERROR );
+}
+
+APIRET DosTmrQueryTime( PQWORD pqwTime )
+{
+    struct timespec    ts;
+    unsigned long long ullUsec;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    ullUsec = (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    pqwTime->ulLo = (ULONG) ullUsec;
+    pqwTime->ulHi = (ULONG)( ullUsec >> 32 );
+    return ( NO_ERROR );
+}
+
+
+/* ========================================================================= *
+ * Unicode API                                                               *
+ * ========================================================================= */
+
+/* ------------------------------------------------------------------------- *
+ * UniMapCpToUcsCp                                                           *
+ *                                                                           *
+ * Gives the conversion object name for a codepage ("IBM-<number>").         *
+ * ------------------------------------------------------------------------- */
+int UniMapCpToUcsCp( ULONG ulCP, UniChar *psuName, size_t stLen )
+{
+    CHAR  achName[ 16 ];
+    ULONG i;
+
+    sprintf( achName, "IBM-%u", ulCP );
+    if ( strlen( achName ) + 1 > stLen ) return ( ULS_BUFFERFULL );
+    for ( i = 0; achName[ i ]; i++ ) psuName[ i ] = (UniChar) achName[ i ];
+    psuName[ i ] = 0;
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniCreateUconvObject                                                      *
+ *                                                                           *
+ * Creates a conversion object for "IBM-<number>" (any modifiers after '@'   *
+ * are ignored: unconvertible characters are always substituted).            *
+ * ------------------------------------------------------------------------- */
+int UniCreateUconvObject( UniChar *psuSpec, UconvObject *puconv )
+{
+    PSHIM_UCONV pUconv;
+    ULONG       ulCP = 0,
+                i;
+
+    for ( i = 0; ( i < 4 ) && psuSpec[ i ] && ( psuSpec[ i ] == (UniChar) "IBM-"[ i ] ); i++ ) ;
+    if ( i < 4 ) return ( ULS_INVALID );
+    for ( ; ( psuSpec[ i ] >= '0' ) && ( psuSpec[ i ] <= '9' ); i++ )
+        ulCP = ( ulCP * 10 ) + ( psuSpec[ i ] - '0' );
+
+    for ( i = 0; ( i < sizeof( aCodepages ) / sizeof( SHIM_CODEPAGE )) && ( aCodepages[ i ].ulCP != ulCP ); i++ ) ;
+    if ( i == sizeof( aCodepages ) / sizeof( SHIM_CODEPAGE )) return ( ULS_INVALID );
+
+    if (( pUconv = (PSHIM_UCONV) calloc( 1, sizeof( SHIM_UCONV ))) == NULL ) return ( ULS_NOMEMORY );
+    pUconv->ulCP      = ulCP;
+    pUconv->ulMaxLen  = aCodepages[ i ].ulMaxLen;
+    pUconv->cdToUcs   = iconv_open( UcsEncodingName(), aCodepages[ i ].pszName );
+    pUconv->cdFromUcs = iconv_open( aCodepages[ i ].pszName, UcsEncodingName() );
+    if (( pUconv->cdToUcs == (iconv_t) -1 ) || ( pUconv->cdFromUcs == (iconv_t) -1 )) {
+        UniFreeUconvObject( pUconv );
+        return ( ULS_UNSUPPORTED );
+    }
+    ProbeLeadBytes( pUconv );
+
+    *puconv = pUconv;
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniFreeUconvObject                                                        *
+ * ------------------------------------------------------------------------- */
+int UniFreeUconvObject( UconvObject uconv )
+{
+    PSHIM_UCONV pUconv = (PSHIM_UCONV) uconv;
+
+    if ( ! pUconv ) return ( ULS_BADOBJECT );
+    if ( pUconv->cdToUcs   != (iconv_t) -1 ) iconv_close( pUconv->cdToUcs );
+    if ( pUconv->cdFromUcs != (iconv_t) -1 ) iconv_close( pUconv->cdFromUcs );
+    free( pUconv );
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniQueryUconvObject                                                       *
+ *                                                                           *
+ * Gives the character lengths of the codepage and, optionally, the length   *
+ * of the character that each byte starts.  Nothing else is filled in.       *
+ * ------------------------------------------------------------------------- */
+int UniQueryUconvObject( UconvObject uconv, uconv_attribute_t *pAttr, size_t cbAttr,
+                         char achFirst[ 256 ], char achOther[ 256 ], udcrange_t audc[ 32 ] )
+{
+    PSHIM_UCONV pUconv = (PSHIM_UCONV) uconv;
+
+    if ( ! pUconv ) return ( ULS_BADOBJECT );
+    if ( pAttr ) {
+        memset( pAttr, 0, cbAttr );
+        pAttr->mb_min_len  = 1;
+        pAttr->mb_max_len  = (char) pUconv->ulMaxLen;
+        pAttr->usc_min_len = 1;
+        pAttr->usc_max_len = 1;
+    }
+    if ( achFirst ) memcpy( achFirst, pUconv->achFirst, 256 );
+    return ( ULS_SUCCESS );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniUconvToUcs                                                             *
+ *                                                                           *
+ * Converts codepage text to UCS-2.  Bytes that cannot be converted (or an   *
+ * incomplete character at the end) each become U+FFFD, and are counted.     *
+ * ------------------------------------------------------------------------- */
+int UniUconvToUcs( UconvObject uconv, void **ppvIn, size_t *pstInLeft,
+                   UniChar **ppsuOut, size_t *pstOutLeft, size_t *pstSubst )
+{
+    PSHIM_UCONV pUconv = (PSHIM_UCONV) uconv;
+    char        *pchIn  = (char *) *ppvIn,
+                *pchOut = (char *) *ppsuOut;
+    size_t      cbOut   = *pstOutLeft * sizeof( UniChar );
+    int         rc      = ULS_SUCCESS;
+
+    if ( ! pUconv ) return ( ULS_BADOBJECT );
+    iconv( pUconv->cdToUcs, NULL, NULL, NULL, NULL );
+    while ( *pstInLeft && ( rc == ULS_SUCCESS )) {
+        if ( iconv( pUconv->cdToUcs, &pchIn, pstInLeft, &pchOut, &cbOut ) != (size_t) -1 ) break;
+        if ( errno == E2BIG ) rc = ULS_BUFFERFULL;
+        else if ( cbOut < sizeof( UniChar )) rc = ULS_BUFFERFULL;
+        else {
+            *((UniChar *) pchOut) = SHIM_SUBST_UCS;
+            pchOut += sizeof( UniChar );
+            cbOut  -= sizeof( UniChar );
+            pchIn++;
+            (*pstInLeft)--;
+            (*pstSubst)++;
+        }
+    }
+    *ppvIn      = pchIn;
+    *ppsuOut    = (UniChar *) pchOut;
+    *pstOutLeft = cbOut / sizeof( UniChar );
+    return ( rc );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniUconvFromUcs                                                           *
+ *                                                                           *
+ * Converts UCS-2 text to the codepage.  UniChars that cannot be converted   *
+ * (including unpaired surrogates) each become 0x1A, and are counted.        *
+ * ------------------------------------------------------------------------- */
+int UniUconvFromUcs( UconvObject uconv, UniChar **ppsuIn, size_t *pstInLeft,
+                     void **ppvOut, size_t *pstOutLeft, size_t *pstSubst )
+{
+    PSHIM_UCONV pUconv = (PSHIM_UCONV) uconv;
+    char        *pchIn  = (char *) *ppsuIn,
+                *pchOut = (char *) *ppvOut;
+    size_t      cbIn    = *pstInLeft * sizeof( UniChar );
+    int         rc      = ULS_SUCCESS;
+
+    if ( ! pUconv ) return ( ULS_BADOBJECT );
+    iconv( pUconv->cdFromUcs, NULL, NULL, NULL, NULL );
+    while ( cbIn && ( rc == ULS_SUCCESS )) {
+        if ( iconv( pUconv->cdFromUcs, &pchIn, &cbIn, &pchOut, pstOutLeft ) != (size_t) -1 ) break;
+        if ( errno == E2BIG ) rc = ULS_BUFFERFULL;
+        else if ( *pstOutLeft < 1 ) rc = ULS_BUFFERFULL;
+        else {
+            *pchOut++ = SHIM_SUBST_CP;
+            (*pstOutLeft)--;
+            pchIn += sizeof( UniChar );
+            cbIn  -= ( cbIn < 2 * sizeof( UniChar )) ? cbIn : sizeof( UniChar );
+            (*pstSubst)++;
+        }
+    }
+    *ppsuIn    = (UniChar *) pchIn;
+    *pstInLeft = cbIn / sizeof( UniChar );
+    *ppvOut    = pchOut;
+    return ( rc );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniStrToUcs                                                               *
+ *                                                                           *
+ * Converts a NUL-terminated codepage string; iOutLen includes the NUL.      *
+ * ------------------------------------------------------------------------- */
+int UniStrToUcs( UconvObject uconv, UniChar *psuOut, char *pszIn, int iOutLen )
+{
+    void    *pvIn   = pszIn;
+    UniChar *psu    = psuOut;
+    size_t  stIn    = strlen( pszIn ),
+            stOut   = iOutLen - 1,
+            stSubst = 0;
+    int     rc;
+
+    if ( iOutLen < 1 ) return ( ULS_BUFFERFULL );
+    rc = UniUconvToUcs( uconv, &pvIn, &stIn, &psu, &stOut, &stSubst );
+    *psu = 0;
+    return ( rc );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniStrFromUcs                                                             *
+ *                                                                           *
+ * Converts a NUL-terminated UCS-2 string; iOutLen includes the NUL.         *
+ * ------------------------------------------------------------------------- */
+int UniStrFromUcs( UconvObject uconv, char *pszOut, UniChar *psuIn, int iOutLen )
+{
+    UniChar *psu    = psuIn;
+    void    *pvOut  = pszOut;
+    size_t  stIn    = UniStrlen( psuIn ),
+            stOut   = iOutLen - 1,
+            stSubst = 0;
+    int     rc;
+
+    if ( iOutLen < 1 ) return ( ULS_BUFFERFULL );
+    rc = UniUconvFromUcs( uconv, &psu, &stIn, &pvOut, &stOut, &stSubst );
+    *((char *) pvOut) = '\0';
+    return ( rc );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UniStrlen, UniStrcpy, UniStrncpy, UniStrcat, UniStrcmp                    *
+ * ------------------------------------------------------------------------- */
+size_t UniStrlen( const UniChar *psu )
+{
+    const UniChar *p;
+
+    for ( p = psu; *p; p++ ) ;
+    return ( p - psu );
+}
+
+UniChar *UniStrcpy( UniChar *psuTo, const UniChar *psuFrom )
+{
+    UniChar *p = psuTo;
+
+    while (( *p++ = *psuFrom++ ) != 0 ) ;
+    return ( psuTo );
+}
+
+UniChar *UniStrncpy( UniChar *psuTo, const UniChar *psuFrom, size_t stLen )
+{
+    size_t i;
+
+    for ( i = 0; ( i < stLen ) && psuFrom[ i ]; i++ ) psuTo[ i ] = psuFrom[ i ];
+    for ( ; i < stLen; i++ ) psuTo[ i ] = 0;
+    return ( psuTo );
+}
+
+UniChar *UniStrcat( UniChar *psuTo, const UniChar *psuFrom )
+{
+    UniStrcpy( psuTo + UniStrlen( psuTo ), psuFrom );
+    return ( psuTo );
+}
+
+int UniStrcmp( const UniChar *psu1, const UniChar *psu2 )
+{
+    while ( *psu1 && ( *psu1 == *psu2 )) {
+        psu1++;
+        psu2++;
+    }
+    return ( (int) *psu1 - (int) *psu2 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UcsEncodingName                                                           *
+ *                                                                           *
+ * Gives the iconv() name for UCS-2 in the machine's byte order.             *
+ * ------------------------------------------------------------------------- */
+PSZ UcsEncodingName( void )
+{
+    USHORT usTest = 1;
+
+    return ( *((PBYTE) &usTest) ? "UTF-16LE" : "UTF-16BE" );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ProbeLeadBytes                                                            *
+ *                                                                           *
+ * Works out the length of the character that each byte starts, for          *
+ * UniQueryUconvObject: a byte that iconv() finds incomplete on its own      *
+ * starts a double-byte character.  (UTF-8 lead bytes are worked out from    *
+ * their bit patterns.)                                                      *
+ * ------------------------------------------------------------------------- */
+void ProbeLeadBytes( PSHIM_UCONV pUconv )
+{
+    char    chIn;
+    UniChar asuOut[ 4 ];
+    char    *pchIn, *pchOut;
+    size_t  cbIn, cbOut;
+    ULONG   i;
+
+    for ( i = 0; i < 256; i++ ) {
+        if ( pUconv->ulCP == 1208 )
+            pUconv->achFirst[ i ] = ( i < 0xC0 ) ? 1 : ( i < 0xE0 ) ? 2 : ( i < 0xF0 ) ? 3 : 4;
+        else if ( pUconv->ulMaxLen == 1 )
+            pUconv->achFirst[ i ] = 1;
+        else {
+            chIn   = (char) i;
+            pchIn  = &chIn;
+            cbIn   = 1;
+            pchOut = (char *) asuOut;
+            cbOut  = sizeof( asuOut );
+            iconv( pUconv->cdToUcs, NULL, NULL, NULL, NULL );
+            pUconv->achFirst[ i ] = (( iconv( pUconv->cdToUcs, &pchIn, &cbIn, &pchOut, &cbOut ) == (size_t) -1 ) &&
+                                    ( errno == EINVAL )) ? 2 : 1;
+        }
+    }
+}
@@ -0,0 +1,19 @@
+/*****************************************************************************
+ * process.h                                                                 *
+ *                                                                           *
+ * Stand-in for the compiler's thread functions, for building the portable   *
+ * parts of CLIPUNI on other systems (see os2shim.c).                        *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+
+// FUNCTION DECLARATIONS
+//
+int _beginthread( void (*pfnStart)( void * ), void *pStack, unsigned cbStack, void *pArg );
+
+
+#endif
@@ -0,0 +1,73 @@
+/*****************************************************************************
+ * uconv.h                                                                   *
+ *                                                                           *
+ * A small stand-in for the OS/2 Unicode API (ULS) header, for building the  *
+ * portable parts of CLIPUNI on other systems.  Conversion objects are       *
+ * implemented on top of iconv() in os2shim.c, for the codepages listed      *
+ * there; only the functions CLIPUNI uses are provided.  os2.h must be       *
+ * included before this file.                                                *
+ *                                                                           *
+ * This file is hereby placed into the public domain.                        *
+ *****************************************************************************/
+
+#ifndef UCONV_H
+#define UCONV_H
+
+#include <stddef.h>
+
+
+// CONSTANTS
+//
+#define ULS_SUCCESS             0x00000000
+#define ULS_OTHER               0x00020001
+#define ULS_ILLEGALSEQUENCE     0x00020002
+#define ULS_NOMEMORY            0x0002000D
+#define ULS_INVALID             0x0002000E
+#define ULS_BADOBJECT           0x0002000F
+#define ULS_BUFFERFULL          0x00020012
+#define ULS_UNSUPPORTED         0x00020014
+
+
+// TYPES
+//
+typedef unsigned short UniChar;
+typedef void           *UconvObject;
+
+typedef struct _uconv_attribute_t {
+    ULONG       version;                    // version of this structure
+    char        mb_min_len;                 // shortest codepage character (bytes)
+    char        mb_max_len;                 // longest codepage character (bytes)
+    char        usc_min_len;                // shortest UCS character (UniChars)
+    char        usc_max_len;                // longest UCS character (UniChars)
+    USHORT      esid;                       // encoding scheme
+    char        options;                    // substitution options
+    char        state;                      // conversion state
+} uconv_attribute_t;
+
+typedef struct _udcrange_t {
+    USHORT      first;                      // first code of a user-defined range
+    USHORT      last;                       // last code of the range
+} udcrange_t;
+
+
+// FUNCTION DECLARATIONS
+//
+int      UniCreateUconvObject( UniChar *psuSpec, UconvObject *puconv );
+int      UniFreeUconvObject( UconvObject uconv );
+int      UniQueryUconvObject( UconvObject uconv, uconv_attribute_t *pAttr, size_t cbAttr,
+                              char achFirst[ 256 ], char achOther[ 256 ], udcrange_t audc[ 32 ] );
+int      UniUconvToUcs( UconvObject uconv, void **ppvIn, size_t *pstInLeft,
+                        UniChar **ppsuOut, size_t *pstOutLeft, size_t *pstSubst );
+int      UniUconvFromUcs( UconvObject uconv, UniChar **ppsuIn, size_t *pstInLeft,
+                          void **ppvOut, size_t *pstOutLeft, size_t *pstSubst );
+int      UniStrToUcs( UconvObject uconv, UniChar *psuOut, char *pszIn, int iOutLen );
+int      UniStrFromUcs( UconvObject uconv, char *pszOut, UniChar *psuIn, int iOutLen );
+int      UniMapCpToUcsCp( ULONG ulCP, UniChar *psuName, size_t stLen );
+size_t   UniStrlen( const UniChar *psu );
+UniChar *UniStrcpy( UniChar *psuTo, const UniChar *psuFrom );
+UniChar *UniStrncpy( UniChar *psuTo, const UniChar *psuFrom, size_t stLen );
+UniChar *UniStrcat( UniChar *psuTo, const UniChar *psuFrom );
+int      UniStrcmp( const UniChar *psu1, const UniChar *psu2 );
+
+
+#endif